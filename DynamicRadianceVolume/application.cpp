@@ -64,6 +64,11 @@ Application::Application(int argc, char** argv) :
 	// Watch shader dir.
 	ShaderFileWatcher::Instance().SetShaderWatchDirectory("shader");
 	ShaderFileWatcher::Instance().SetShaderWatchDirectory("shader/cachedebug");
+	ShaderFileWatcher::Instance().SetShaderWatchDirectory("shader/occlusionculling");
+	ShaderFileWatcher::Instance().SetShaderWatchDirectory("shader/visibilitybuffer");
+	ShaderFileWatcher::Instance().SetShaderWatchDirectory("shader/clustered");
+	ShaderFileWatcher::Instance().SetShaderWatchDirectory("shader/multiviewrsm");
+	ShaderFileWatcher::Instance().SetShaderWatchDirectory("shader/sortedcacheallocation");
 
 	// Resize handler.
 	m_window->AddResizeHandler([&](int width, int height){
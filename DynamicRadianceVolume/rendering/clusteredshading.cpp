@@ -0,0 +1,135 @@
+#include "clusteredshading.hpp"
+
+#include "shadowmapatlas.hpp"
+#include "readbackring.hpp"
+#include "../scene/light.hpp"
+#include "../utilities/assert.hpp"
+#include "../utilities/logger.hpp"
+#include "../frameprofiler.hpp"
+
+#include <glhelper/shaderobject.hpp>
+#include <glhelper/buffer.hpp>
+#include <glhelper/screenalignedtriangle.hpp>
+
+ClusteredShading::ClusteredShading() :
+	m_numClusters(0),
+	m_numLights(0),
+	m_statsWritten(false),
+	m_lastNumOverflowingClusters(0)
+{
+	m_shaderAssignLights = new gl::ShaderObject("clustered - assign lights");
+	m_shaderAssignLights->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/clustered/assignlights.comp");
+	m_shaderAssignLights->CreateProgram();
+
+	m_shaderClusteredLighting = new gl::ShaderObject("clustered - direct lighting");
+	m_shaderClusteredLighting->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/screenTri.vert");
+	m_shaderClusteredLighting->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/clustered/clusteredlighting.frag");
+	m_shaderClusteredLighting->CreateProgram();
+
+	m_statsBuffer = std::make_unique<gl::Buffer>(sizeof(std::uint32_t) * 2, gl::Buffer::IMMUTABLE, nullptr);
+	m_statsReadback = std::make_unique<ReadbackRing>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * 2));
+}
+
+ClusteredShading::~ClusteredShading()
+{
+}
+
+void ClusteredShading::OnScreenResize(const ei::UVec2& newResolution)
+{
+	unsigned int numTilesX = (newResolution.x + s_tileSize - 1) / s_tileSize;
+	unsigned int numTilesY = (newResolution.y + s_tileSize - 1) / s_tileSize;
+	m_numClusters = numTilesX * numTilesY * s_numDepthSlices;
+
+	m_clusterLightCountBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * m_numClusters), gl::Buffer::IMMUTABLE);
+	m_clusterLightIndexBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * m_numClusters * s_maxNumLightsPerCluster), gl::Buffer::IMMUTABLE);
+}
+
+void ClusteredShading::UpdateLights(const std::vector<Light>& lights, const ShadowMapAtlas& shadowMapAtlas)
+{
+	Assert(lights.size() == shadowMapAtlas.GetNumRegions(), "Need exactly one shadow map atlas region per light!");
+
+	m_numLights = static_cast<unsigned int>(lights.size());
+	if (m_numLights == 0)
+		return;
+
+	// Grow light buffer if necessary.
+	size_t lightBufferSize = sizeof(ClusterLight) * lights.size();
+	if (!m_lightBuffer || static_cast<size_t>(m_lightBuffer->GetSize()) < lightBufferSize)
+	{
+		size_t newLightCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(lights.size())));
+		m_lightBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newLightCapacity * sizeof(ClusterLight)), gl::Buffer::MAP_WRITE);
+	}
+
+	ClusterLight* lightData = static_cast<ClusterLight*>(m_lightBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER));
+	for (size_t lightIndex = 0; lightIndex < lights.size(); ++lightIndex)
+	{
+		const Light& light = lights[lightIndex];
+		ClusterLight& clusterLight = lightData[lightIndex];
+
+		clusterLight.position = light.position;
+		clusterLight.cosHalfAngle = cosf(light.halfAngle);
+		clusterLight.direction = ei::normalize(light.direction);
+		clusterLight.range = light.range;
+		clusterLight.intensity = light.intensity;
+		clusterLight.shadowNormalOffset = light.normalOffsetShadowBias;
+		clusterLight.shadowBias = light.shadowBias;
+
+		// Same as in Renderer::PrepareLights
+		ei::Mat4x4 view = ei::camera(light.position, light.position + light.direction);
+		ei::Mat4x4 projection = ei::perspectiveDX(light.halfAngle * 2.0f, 1.0f, Light::farPlane, Light::nearPlane);
+		clusterLight.lightViewProjection = projection * view;
+
+		const ShadowMapAtlas::Region& region = shadowMapAtlas.GetRegion(static_cast<unsigned int>(lightIndex));
+		clusterLight.shadowMapAtlasScale = static_cast<float>(region.resolution) / shadowMapAtlas.GetResolution();
+		clusterLight.shadowMapAtlasOffset = ei::Vec2(region.offset) / static_cast<float>(shadowMapAtlas.GetResolution());
+	}
+	m_lightBuffer->Unmap();
+}
+
+void ClusteredShading::AssignLights()
+{
+	// Read result of an earlier frame, queue the last frame's result.
+	const std::uint32_t* statsData = static_cast<const std::uint32_t*>(m_statsReadback->TryRead());
+	if (statsData)
+	{
+		if (statsData[0] > 0 && m_lastNumOverflowingClusters == 0)
+			LOG_WARNING(statsData[0] << " light clusters have more than " << s_maxNumLightsPerCluster << " lights (up to " << statsData[1] << "). Lights past the limit are dropped!");
+		m_lastNumOverflowingClusters = statsData[0];
+		FrameProfiler::GetInstance().ReportValue("ClusterLightOverflows", static_cast<float>(m_lastNumOverflowingClusters));
+	}
+	if (m_statsWritten)
+	{
+		GL_CALL(glMemoryBarrier, GL_BUFFER_UPDATE_BARRIER_BIT);
+		m_statsReadback->Copy(*m_statsBuffer, 0, sizeof(std::uint32_t) * 2);
+	}
+	m_statsBuffer->ClearToZero();
+	m_statsWritten = false;
+
+	if (m_numLights == 0)
+		return;
+
+	m_lightBuffer->BindShaderStorageBuffer(12);
+	m_clusterLightCountBuffer->BindShaderStorageBuffer(13);
+	m_clusterLightIndexBuffer->BindShaderStorageBuffer(14);
+	m_statsBuffer->BindShaderStorageBuffer(23);
+
+	m_shaderAssignLights->Activate();
+	GL_CALL(glUniform1ui, 0, m_numLights);
+	GL_CALL(glDispatchCompute, (m_numClusters + 63) / 64, 1, 1);
+	m_statsWritten = true;
+
+	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void ClusteredShading::ApplyLighting(gl::ScreenAlignedTriangle& screenTriangle)
+{
+	if (m_numLights == 0)
+		return;
+
+	m_lightBuffer->BindShaderStorageBuffer(12);
+	m_clusterLightCountBuffer->BindShaderStorageBuffer(13);
+	m_clusterLightIndexBuffer->BindShaderStorageBuffer(14);
+
+	m_shaderClusteredLighting->Activate();
+	screenTriangle.Draw();
+}
\ No newline at end of file
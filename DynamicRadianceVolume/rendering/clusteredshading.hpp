@@ -0,0 +1,84 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <ei/vector.hpp>
+#include "../shaderreload/autoreloadshaderptr.hpp"
+
+namespace gl
+{
+	class ShaderObject;
+	class Buffer;
+	class ScreenAlignedTriangle;
+}
+struct Light;
+class ShadowMapAtlas;
+class ReadbackRing;
+
+/// Clustered deferred shading for direct spot light lighting.
+///
+/// The screen is divided into tiles and exponentially distributed depth slices. A compute pass assigns all lights to the clusters they might affect.
+/// A single full-screen pass then evaluates only the lights of each pixel's cluster, using the same BRDF and shadowing as directdeferredlighting.frag.
+/// All shadow maps are read from the renderer's shadow map atlas.
+/// Clusters hold at most s_maxNumLightsPerCluster lights. Overflowing clusters are counted on the GPU, reported to the FrameProfiler and logged a few frames later.
+/// Not exactly self-contained! Submodule for renderer!
+class ClusteredShading
+{
+public:
+	ClusteredShading();
+	~ClusteredShading();
+
+	/// Should be called on screen resize.
+	void OnScreenResize(const ei::UVec2& newResolution);
+
+	/// Writes light buffer.
+	///
+	/// \param shadowMapAtlas
+	///		Needs to have a region for every light.
+	void UpdateLights(const std::vector<Light>& lights, const ShadowMapAtlas& shadowMapAtlas);
+
+	/// Assigns all lights to the clusters. Expects PerFrame UBO to be bound.
+	void AssignLights();
+
+	/// Number of clusters that had more than s_maxNumLightsPerCluster lights in a recent frame.
+	unsigned int GetLastNumOverflowingClusters() const { return m_lastNumOverflowingClusters; }
+
+	/// Draws direct lighting of all lights. Expects the gbuffer and the shadow map atlas with a comparison sampler at binding 4 to be bound.
+	void ApplyLighting(gl::ScreenAlignedTriangle& screenTriangle);
+
+	// Needs to match clustered.glsl
+	static const unsigned int s_tileSize = 64;
+	static const unsigned int s_numDepthSlices = 16;
+	static const unsigned int s_maxNumLightsPerCluster = 128;
+
+private:
+	/// Needs to match ClusterLight in clustered.glsl
+	struct ClusterLight
+	{
+		ei::Vec3 position;
+		float cosHalfAngle;
+		ei::Vec3 direction;
+		float range;
+		ei::Vec3 intensity;
+		float shadowNormalOffset;
+		float shadowBias;
+		float shadowMapAtlasScale;
+		ei::Vec2 shadowMapAtlasOffset;
+		ei::Mat4x4 lightViewProjection;
+	};
+
+	AutoReloadShaderPtr m_shaderAssignLights;
+	AutoReloadShaderPtr m_shaderClusteredLighting;
+
+	unsigned int m_numClusters;
+	unsigned int m_numLights;
+
+	std::unique_ptr<gl::Buffer> m_lightBuffer;
+	std::unique_ptr<gl::Buffer> m_clusterLightCountBuffer;
+	std::unique_ptr<gl::Buffer> m_clusterLightIndexBuffer;
+	std::unique_ptr<gl::Buffer> m_statsBuffer;
+	std::unique_ptr<ReadbackRing> m_statsReadback;
+
+	bool m_statsWritten;
+	unsigned int m_lastNumOverflowingClusters;
+};
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include "lightcachehashmap.hpp"
+#include "../utilities/assert.hpp"
+#include "../utilities/utils.hpp"
+
+#include <algorithm>
+
+unsigned int LightCacheHashMap::ComputeSize(unsigned int maxNumLightCaches)
+{
+	unsigned int size = 1;
+	while (size < maxNumLightCaches * 2)
+		size *= 2;
+	return size;
+}
+
+std::uint32_t LightCacheHashMap::ComputeKey(const ei::IVec3& cell, int addressVolumeCascade, int addressVolumeResolution)
+{
+	std::uint32_t stride = static_cast<std::uint32_t>(addressVolumeResolution + 1);
+	return static_cast<std::uint32_t>(cell.x) + (static_cast<std::uint32_t>(cell.y) + (static_cast<std::uint32_t>(cell.z) + static_cast<std::uint32_t>(addressVolumeCascade) * stride) * stride) * stride + 1;
+}
+
+std::uint32_t LightCacheHashMap::Hash(std::uint32_t key)
+{
+	// Murmur3 finalizer.
+	key ^= key >> 16;
+	key *= 0x85ebca6bu;
+	key ^= key >> 13;
+	key *= 0xc2b2ae35u;
+	key ^= key >> 16;
+	return key;
+}
+
+LightCacheHashMap::LightCacheHashMap(unsigned int size) :
+	m_entries(size, Entry{ s_emptyKey, 0 })
+{
+	Assert(IsPowerOfTwo(size), "Light cache hash map size needs to be a power of two!");
+}
+
+LightCacheHashMap::LightCacheHashMap(std::vector<Entry> entries) :
+	m_entries(std::move(entries))
+{
+	Assert(IsPowerOfTwo(static_cast<unsigned int>(m_entries.size())), "Light cache hash map size needs to be a power of two!");
+}
+
+void LightCacheHashMap::Clear()
+{
+	std::fill(m_entries.begin(), m_entries.end(), Entry{ s_emptyKey, 0 });
+}
+
+std::uint32_t LightCacheHashMap::Insert(std::uint32_t key)
+{
+	Assert(key != s_emptyKey, "Empty key can not be inserted!");
+
+	std::uint32_t mask = GetSize() - 1;
+	std::uint32_t slot = Hash(key) & mask;
+	for (unsigned int probe = 0; probe < s_maxNumProbes; ++probe)
+	{
+		if (m_entries[slot].key == s_emptyKey)
+		{
+			m_entries[slot].key = key;
+			return slot;
+		}
+		if (m_entries[slot].key == key)
+			return s_invalidSlot;
+		slot = (slot + 1) & mask;
+	}
+	return s_invalidSlot;
+}
+
+void LightCacheHashMap::SetValue(std::uint32_t slot, std::uint32_t value)
+{
+	Assert(slot < m_entries.size() && m_entries[slot].key != s_emptyKey, "Invalid light cache hash map slot!");
+	m_entries[slot].value = value;
+}
+
+std::uint32_t LightCacheHashMap::Lookup(std::uint32_t key) const
+{
+	std::uint32_t mask = GetSize() - 1;
+	std::uint32_t slot = Hash(key) & mask;
+	for (unsigned int probe = 0; probe < s_maxNumProbes; ++probe)
+	{
+		if (m_entries[slot].key == key)
+			return m_entries[slot].value;
+		if (m_entries[slot].key == s_emptyKey)
+			return 0;
+		slot = (slot + 1) & mask;
+	}
+	return 0;
+}
+
+unsigned int LightCacheHashMap::CountUnreachableKeys() const
+{
+	unsigned int numUnreachableKeys = 0;
+	for (const Entry& entry : m_entries)
+	{
+		if (entry.key != s_emptyKey && Lookup(entry.key) != entry.value)
+			++numUnreachableKeys;
+	}
+	return numUnreachableKeys;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <ei/vector.hpp>
+
+/// CPU reference implementation of the light cache hash map in lightcachehashmap.glsl.
+///
+/// Open addressing with linear probing and a bounded probe count. Maps cascade local address volume cells to light cache index + 1.
+/// Inserting keys one by one gives the very same slots as the shader, so a hash map buffer read back from the GPU can be checked deterministically
+/// if the GPU inserts in the same order (see Renderer::TestLightCacheHashMap). With concurrent insertion only the found values are comparable.
+class LightCacheHashMap
+{
+public:
+	/// Needs to match LightCacheHashMapEntry in lightcachehashmap.glsl
+	struct Entry
+	{
+		std::uint32_t key;
+		std::uint32_t value;
+	};
+
+	// Needs to match lightcachehashmap.glsl
+	static const unsigned int s_maxNumProbes = 16;
+	static const std::uint32_t s_emptyKey = 0;
+	static const std::uint32_t s_invalidSlot = 0xFFFFFFFF;
+
+	/// Number of slots for the given number of light caches. Power of two with a load factor of at most 0.5.
+	static unsigned int ComputeSize(unsigned int maxNumLightCaches);
+	/// Unique key for a cascade local cell. Cells may lie up to one cell outside of the cascade.
+	static std::uint32_t ComputeKey(const ei::IVec3& cell, int addressVolumeCascade, int addressVolumeResolution);
+	static std::uint32_t Hash(std::uint32_t key);
+
+	/// \param size
+	///		Needs to be a power of two.
+	explicit LightCacheHashMap(unsigned int size);
+	/// Takes over the entries of a hash map buffer that was read back from the GPU.
+	/// \param entries
+	///		Number of entries needs to be a power of two.
+	explicit LightCacheHashMap(std::vector<Entry> entries);
+
+	/// Removes all keys.
+	void Clear();
+
+	/// Inserts the given key.
+	/// \return
+	///		Slot of the key if it was not present before. s_invalidSlot if the key was already present or if no free slot was found within s_maxNumProbes.
+	std::uint32_t Insert(std::uint32_t key);
+	/// Sets value of a slot returned by Insert.
+	void SetValue(std::uint32_t slot, std::uint32_t value);
+	/// \return
+	///		Value of the given key, zero if it is not present.
+	std::uint32_t Lookup(std::uint32_t key) const;
+
+	/// Number of stored keys that Lookup does not map to their own value.
+	///
+	/// Always zero for keys inserted by this class. For entries of the GPU hash map, a nonzero count means that hash or probing of lightcachehashmap.glsl differ.
+	unsigned int CountUnreachableKeys() const;
+
+	unsigned int GetSize() const { return static_cast<unsigned int>(m_entries.size()); }
+	/// Same memory layout as the GPU buffer.
+	const std::vector<Entry>& GetEntries() const { return m_entries; }
+
+private:
+	std::vector<Entry> m_entries;
+};
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "multiviewrsm.hpp"
+#include "shadowmapatlas.hpp"
+
+#include "../scene/model.hpp"
+#include "../scene/light.hpp"
+#include "../utilities/logger.hpp"
+#include "../utilities/assert.hpp"
+
+#include <glhelper/shaderobject.hpp>
+#include <glhelper/buffer.hpp>
+
+#include <cstring>
+
+namespace
+{
+	/// (Re)creates buffer with the next power of two size if it is too small for the given number of bytes.
+	void EnsureBufferSize(std::unique_ptr<gl::Buffer>& buffer, size_t minSizeInBytes, gl::Buffer::UsageFlag usageFlag)
+	{
+		if (buffer && static_cast<size_t>(buffer->GetSize()) >= minSizeInBytes)
+			return;
+
+		size_t newSize = static_cast<size_t>(1) << static_cast<int>(ceil(log2(ei::max<size_t>(minSizeInBytes, 4))));
+		buffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newSize), usageFlag);
+	}
+}
+
+MultiViewRSM::MultiViewRSM() :
+	m_supported(false),
+	m_maxNumViews(1)
+{
+	GLint numExtensions = 0;
+	GL_CALL(glGetIntegerv, GL_NUM_EXTENSIONS, &numExtensions);
+	for (GLint i = 0; i < numExtensions && !m_supported; ++i)
+		m_supported = strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_shader_viewport_layer_array") == 0;
+	if (!m_supported)
+		LOG_WARNING("GL_ARB_shader_viewport_layer_array is not supported. Multi view RSM rendering is not available.");
+
+	GLint maxViewports = 1;
+	GL_CALL(glGetIntegerv, GL_MAX_VIEWPORTS, &maxViewports);
+	m_maxNumViews = ei::min(s_maxNumViews, static_cast<unsigned int>(maxViewports));
+
+	ReloadGeometryShaders("");
+	m_shaderCull = new gl::ShaderObject("multi view rsm - cull");
+	m_shaderCull->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/multiviewrsm/cull.comp");
+	m_shaderCull->CreateProgram();
+
+	m_viewBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(View) * s_maxNumViews), gl::Buffer::MAP_WRITE);
+}
+
+MultiViewRSM::~MultiViewRSM()
+{
+}
+
+void MultiViewRSM::ReloadGeometryShaders(const std::string& settings)
+{
+	// Fill shaders do not compile without the extension.
+	if (!m_supported)
+		return;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		std::string postfix = i == 0 ? " - no alphatest" : " - alphatest";
+		std::string define = settings + "#define MULTI_VIEW\n";
+		if (i == 1)
+			define += "#define ALPHATESTING 0.1";
+
+		m_shaderFill[i] = new gl::ShaderObject("fill rsm multi view" + postfix);
+		m_shaderFill[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/defaultmodel_rsm.vert", define);
+		m_shaderFill[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/fillrsm.frag", define);
+		m_shaderFill[i]->CreateProgram();
+	}
+}
+
+void MultiViewRSM::ActivateFillShader(bool alphaTesting)
+{
+	m_shaderFill[alphaTesting ? 1 : 0]->Activate();
+}
+
+void MultiViewRSM::PrepareDrawCommands(const std::vector<Renderer::InstanceBatch>& batches, const std::vector<std::uint32_t>& instanceIndices)
+{
+	// One draw command per batch and mesh, one cull item per instance and mesh.
+	// Every draw command reserves room for all its instances in every view in the culled instance index buffer.
+	m_cullItems.clear();
+	m_drawCommands.clear();
+	for (const Renderer::InstanceBatch& batch : batches)
+	{
+		for (const Model::Mesh& mesh : batch.model->GetMeshes())
+		{
+			std::uint32_t drawCommandIndex = static_cast<std::uint32_t>(m_drawCommands.size());
+			m_drawCommands.push_back(DrawElementsIndirectCommand{ mesh.numIndices, 0, mesh.startIndex, 0, static_cast<std::uint32_t>(m_cullItems.size() * s_maxNumViews) });
+
+			for (unsigned int instance = batch.firstInstance; instance < batch.firstInstance + batch.instanceCount; ++instance)
+				m_cullItems.push_back(CullItem{ mesh.boundingBox.min, instanceIndices[instance], mesh.boundingBox.max, drawCommandIndex });
+		}
+	}
+	if (m_cullItems.empty())
+		return;
+
+	EnsureBufferSize(m_cullItemBuffer, sizeof(CullItem) * m_cullItems.size(), gl::Buffer::MAP_WRITE);
+	EnsureBufferSize(m_drawCommandBuffer, sizeof(DrawElementsIndirectCommand) * m_drawCommands.size(), gl::Buffer::MAP_WRITE);
+	EnsureBufferSize(m_culledInstanceIndexBuffer, sizeof(std::uint32_t) * m_cullItems.size() * s_maxNumViews, gl::Buffer::IMMUTABLE);
+
+	void* cullItemData = m_cullItemBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER);
+	memcpy(cullItemData, m_cullItems.data(), sizeof(CullItem) * m_cullItems.size());
+	m_cullItemBuffer->Unmap();
+}
+
+void MultiViewRSM::Cull(Renderer& renderer, const std::vector<Light>& lights, const std::vector<unsigned int>& lightIndices, const ShadowMapAtlas& shadowMapAtlas)
+{
+	Assert(lightIndices.size() <= m_maxNumViews, "Too many lights for a single multi view RSM pass!");
+
+	View* viewData = static_cast<View*>(m_viewBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER));
+	std::vector<float> viewports;
+	for (size_t viewIndex = 0; viewIndex < lightIndices.size(); ++viewIndex)
+	{
+		const Light& light = lights[lightIndices[viewIndex]];
+		const ShadowMapAtlas::Region& region = shadowMapAtlas.GetRegion(lightIndices[viewIndex]);
+		View& view = viewData[viewIndex];
+
+		// Same as in Renderer::PrepareLights
+		ei::Mat4x4 lightView = ei::camera(light.position, light.position + light.direction);
+		ei::Mat4x4 projection = ei::perspectiveDX(light.halfAngle * 2.0f, 1.0f, Light::farPlane, Light::nearPlane);
+		view.viewProjection = projection * lightView;
+		view.position = light.position;
+		view.cosHalfAngle = cosf(light.halfAngle);
+		view.direction = ei::normalize(light.direction);
+		view._padding0 = 0.0f;
+		view.intensity = light.intensity;
+		view.renderResolution = static_cast<float>(region.resolution);
+
+		viewports.insert(viewports.end(), { static_cast<float>(region.offset.x), static_cast<float>(region.offset.y), static_cast<float>(region.resolution), static_cast<float>(region.resolution) });
+	}
+	m_viewBuffer->Unmap();
+
+	if (!viewports.empty())
+		GL_CALL(glViewportArrayv, 0, static_cast<GLsizei>(lightIndices.size()), viewports.data());
+
+	if (m_cullItems.empty())
+		return;
+
+	// Reset instance counts, previous pass may still read the culled instance indices.
+	void* drawCommandData = m_drawCommandBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER);
+	memcpy(drawCommandData, m_drawCommands.data(), sizeof(DrawElementsIndirectCommand) * m_drawCommands.size());
+	m_drawCommandBuffer->Unmap();
+	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+
+	renderer.BindInstanceBuffer();
+	m_cullItemBuffer->BindShaderStorageBuffer(0);
+	m_drawCommandBuffer->BindShaderStorageBuffer(1);
+	m_culledInstanceIndexBuffer->BindShaderStorageBuffer(2);
+	m_viewBuffer->BindShaderStorageBuffer(15);
+
+	m_shaderCull->Activate();
+	GL_CALL(glUniform1ui, 0, static_cast<GLuint>(m_cullItems.size()));
+	GL_CALL(glUniform1ui, 1, static_cast<GLuint>(lightIndices.size()));
+	GL_CALL(glDispatchCompute, static_cast<GLuint>((m_cullItems.size() + 63) / 64), 1, 1);
+
+	GL_CALL(glMemoryBarrier, GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void MultiViewRSM::BindDrawBuffers()
+{
+	m_viewBuffer->BindShaderStorageBuffer(15);
+	if (m_cullItems.empty())
+		return;
+
+	m_drawCommandBuffer->BindIndirectDrawBuffer();
+	m_culledInstanceIndexBuffer->BindShaderStorageBuffer(6);
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <ei/vector.hpp>
+#include "renderer.hpp"
+#include "../shaderreload/autoreloadshaderptr.hpp"
+
+namespace gl
+{
+	class ShaderObject;
+	class Buffer;
+}
+struct Light;
+class ShadowMapAtlas;
+
+/// Renders the RSMs of several lights with a single submission of the scene geometry.
+///
+/// Every mesh of every instance is culled against the frustums of all lights of a pass on the GPU. Visible instances are appended to indirect draw commands
+/// together with the index of the light's view. The vertex shader selects light and atlas region via gl_ViewportIndex (GL_ARB_shader_viewport_layer_array).
+/// The number of lights per pass is limited by the number of viewports, more lights need several passes.
+/// Does not perform any GPU profiling itself, since profiling queries can not be nested.
+/// Not exactly self-contained! Submodule for renderer!
+class MultiViewRSM
+{
+public:
+	MultiViewRSM();
+	~MultiViewRSM();
+
+	/// False if GL_ARB_shader_viewport_layer_array is not available.
+	bool IsSupported() const				{ return m_supported; }
+	/// Maximum number of lights per pass.
+	unsigned int GetMaxNumViews() const		{ return m_maxNumViews; }
+
+	/// Reloads fill shaders with the given geometry settings. See Renderer::ReloadGeometryShaders.
+	void ReloadGeometryShaders(const std::string& settings);
+	/// Activates the RSM fill shader (see fillrsm.frag) that reads its light from the view selected per instance.
+	void ActivateFillShader(bool alphaTesting);
+
+	/// Writes cull items and draw commands for the given batches.
+	///
+	/// Draw commands are ordered by batch and then by mesh, skipping no mesh. See Renderer::DrawScene.
+	/// \param batches
+	///		Unculled batches, culling against the light frustums happens on the GPU.
+	/// \param instanceIndices
+	///		Entity indices the batches refer to.
+	void PrepareDrawCommands(const std::vector<Renderer::InstanceBatch>& batches, const std::vector<std::uint32_t>& instanceIndices);
+
+	/// Writes views for the given lights, sets one viewport per light to its atlas region and culls all items against the light frustums.
+	///
+	/// \param lightIndices
+	///		At most GetMaxNumViews() lights.
+	void Cull(Renderer& renderer, const std::vector<Light>& lights, const std::vector<unsigned int>& lightIndices, const ShadowMapAtlas& shadowMapAtlas);
+
+	/// Binds draw commands as indirect draw buffer, the culled instance indices (see instancedata.glsl) and the views of the last Cull call (see multiviewrsm.glsl).
+	void BindDrawBuffers();
+
+	/// Instance indices hold the view index in their upper bits. Needs to match instancedata.glsl
+	static const unsigned int s_maxNumViews = 16;
+
+private:
+	/// Needs to match RSMView in multiviewrsm.glsl
+	struct View
+	{
+		ei::Mat4x4 viewProjection;
+		ei::Vec3 position;
+		float cosHalfAngle;
+		ei::Vec3 direction;
+		float _padding0;
+		ei::Vec3 intensity;
+		float renderResolution;
+	};
+
+	struct CullItem
+	{
+		ei::Vec3 boxMin;
+		std::uint32_t entityIndex;
+		ei::Vec3 boxMax;
+		std::uint32_t drawCommandIndex;
+	};
+
+	struct DrawElementsIndirectCommand
+	{
+		std::uint32_t count;
+		std::uint32_t instanceCount;
+		std::uint32_t firstIndex;
+		std::uint32_t baseVertex;
+		std::uint32_t baseInstance;
+	};
+
+	AutoReloadShaderPtr m_shaderFill[2];
+	AutoReloadShaderPtr m_shaderCull;
+
+	bool m_supported;
+	unsigned int m_maxNumViews;
+
+	std::vector<CullItem> m_cullItems;
+	std::vector<DrawElementsIndirectCommand> m_drawCommands;
+
+	std::unique_ptr<gl::Buffer> m_viewBuffer;
+	std::unique_ptr<gl::Buffer> m_cullItemBuffer;
+	std::unique_ptr<gl::Buffer> m_drawCommandBuffer;
+	std::unique_ptr<gl::Buffer> m_culledInstanceIndexBuffer; ///< Room for every cull item in every view.
+};
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "occlusionculling.hpp"
+#include "readbackring.hpp"
+
+#include "../scene/model.hpp"
+#include "../frameprofiler.hpp"
+#include "../utilities/logger.hpp"
+
+#include <glhelper/samplerobject.hpp>
+#include <glhelper/shaderobject.hpp>
+#include <glhelper/texture2d.hpp>
+#include <glhelper/buffer.hpp>
+
+namespace
+{
+	/// (Re)creates buffer with the next power of two size if it is too small for the given number of bytes.
+	void EnsureBufferSize(std::unique_ptr<gl::Buffer>& buffer, size_t minSizeInBytes, gl::Buffer::UsageFlag usageFlag)
+	{
+		if (buffer && static_cast<size_t>(buffer->GetSize()) >= minSizeInBytes)
+			return;
+
+		size_t newSize = static_cast<size_t>(1) << static_cast<int>(ceil(log2(ei::max<size_t>(minSizeInBytes, 4))));
+		buffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newSize), usageFlag);
+	}
+}
+
+OcclusionCulling::OcclusionCulling() :
+	m_samplerNearest(gl::SamplerObject::GetSamplerObject(gl::SamplerObject::Desc(gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST,
+																				gl::SamplerObject::Border::CLAMP))),
+	m_lastViewProjectionValid(false),
+	m_statsWritten(false),
+	m_lastNumOcclusionCulled(0)
+{
+	m_shaderHiZReproject = new gl::ShaderObject("hi-z reproject");
+	m_shaderHiZReproject->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/occlusionculling/hizreproject.comp");
+	m_shaderHiZReproject->CreateProgram();
+
+	m_shaderHiZInit = new gl::ShaderObject("hi-z init");
+	m_shaderHiZInit->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/occlusionculling/hizinit.comp");
+	m_shaderHiZInit->CreateProgram();
+
+	m_shaderHiZDownsample = new gl::ShaderObject("hi-z downsample");
+	m_shaderHiZDownsample->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/occlusionculling/hizdownsample.comp");
+	m_shaderHiZDownsample->CreateProgram();
+
+	m_shaderCull[(int)Phase::FIRST] = new gl::ShaderObject("occlusion cull - first phase");
+	m_shaderCull[(int)Phase::FIRST]->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/occlusionculling/occlusioncull.comp");
+	m_shaderCull[(int)Phase::FIRST]->CreateProgram();
+
+	m_shaderCull[(int)Phase::SECOND] = new gl::ShaderObject("occlusion cull - second phase");
+	m_shaderCull[(int)Phase::SECOND]->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/occlusionculling/occlusioncull.comp", "#define SECOND_PHASE");
+	m_shaderCull[(int)Phase::SECOND]->CreateProgram();
+
+	m_statsBuffer = std::make_unique<gl::Buffer>(sizeof(std::uint32_t) * 4, gl::Buffer::IMMUTABLE, nullptr);
+	m_statsReadback = std::make_unique<ReadbackRing>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * 4));
+}
+
+OcclusionCulling::~OcclusionCulling()
+{
+}
+
+void OcclusionCulling::OnScreenResize(const ei::UVec2& newResolution)
+{
+	m_hiZ = std::make_unique<gl::Texture2D>(newResolution.x, newResolution.y, gl::TextureFormat::R32UI, 0, 0);
+	ResetHistory();
+}
+
+void OcclusionCulling::PrepareDrawCommands(const std::vector<Renderer::InstanceBatch>& batches, const std::vector<std::uint32_t>& instanceIndices)
+{
+	// Read result of an earlier frame, queue the last frame's result.
+	const std::uint32_t* statsData = static_cast<const std::uint32_t*>(m_statsReadback->TryRead());
+	if (statsData)
+	{
+		m_lastNumOcclusionCulled = statsData[0];
+		FrameProfiler::GetInstance().ReportValue("OcclusionCulled", static_cast<float>(m_lastNumOcclusionCulled));
+	}
+	if (m_statsWritten)
+	{
+		GL_CALL(glMemoryBarrier, GL_BUFFER_UPDATE_BARRIER_BIT);
+		m_statsReadback->Copy(*m_statsBuffer, 0, sizeof(std::uint32_t));
+	}
+	m_statsBuffer->ClearToZero();
+	m_statsWritten = false;
+
+	// One draw command per batch and mesh, one cull item per instance and mesh.
+	// Every draw command reserves room for all its instances in the culled instance index buffer.
+	m_cullItems.clear();
+	m_drawCommands.clear();
+	for (const Renderer::InstanceBatch& batch : batches)
+	{
+		for (const Model::Mesh& mesh : batch.model->GetMeshes())
+		{
+			std::uint32_t drawCommandIndex = static_cast<std::uint32_t>(m_drawCommands.size());
+			m_drawCommands.push_back(DrawElementsIndirectCommand{ mesh.numIndices, 0, mesh.startIndex, 0, static_cast<std::uint32_t>(m_cullItems.size()) });
+
+			for (unsigned int instance = batch.firstInstance; instance < batch.firstInstance + batch.instanceCount; ++instance)
+				m_cullItems.push_back(CullItem{ mesh.boundingBox.min, instanceIndices[instance], mesh.boundingBox.max, drawCommandIndex });
+		}
+	}
+	if (m_cullItems.empty())
+		return;
+
+	EnsureBufferSize(m_cullItemBuffer, sizeof(CullItem) * m_cullItems.size(), gl::Buffer::MAP_WRITE);
+	EnsureBufferSize(m_drawCommandBuffer[(int)Phase::FIRST], sizeof(DrawElementsIndirectCommand) * m_drawCommands.size(), gl::Buffer::MAP_WRITE);
+	EnsureBufferSize(m_drawCommandBuffer[(int)Phase::SECOND], sizeof(DrawElementsIndirectCommand) * m_drawCommands.size(), gl::Buffer::MAP_WRITE);
+	EnsureBufferSize(m_culledInstanceIndexBuffer, sizeof(std::uint32_t) * m_cullItems.size() * 2, gl::Buffer::IMMUTABLE);
+	EnsureBufferSize(m_occludedInFirstPhaseBuffer, sizeof(std::uint32_t) * m_cullItems.size(), gl::Buffer::IMMUTABLE);
+
+	void* cullItemData = m_cullItemBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER);
+	memcpy(cullItemData, m_cullItems.data(), sizeof(CullItem) * m_cullItems.size());
+	m_cullItemBuffer->Unmap();
+
+	void* drawCommandData = m_drawCommandBuffer[(int)Phase::FIRST]->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER);
+	memcpy(drawCommandData, m_drawCommands.data(), sizeof(DrawElementsIndirectCommand) * m_drawCommands.size());
+	m_drawCommandBuffer[(int)Phase::FIRST]->Unmap();
+
+	// Second phase writes its instances to the second half of the culled instance index buffer.
+	for (DrawElementsIndirectCommand& drawCommand : m_drawCommands)
+		drawCommand.baseInstance += static_cast<std::uint32_t>(m_cullItems.size());
+	drawCommandData = m_drawCommandBuffer[(int)Phase::SECOND]->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER);
+	memcpy(drawCommandData, m_drawCommands.data(), sizeof(DrawElementsIndirectCommand) * m_drawCommands.size());
+	m_drawCommandBuffer[(int)Phase::SECOND]->Unmap();
+}
+
+void OcclusionCulling::BuildReprojectedHiZ(const gl::Texture2D& lastFrameDepth, const ei::Mat4x4& viewProjection)
+{
+	GL_CALL(glClearTexImage, m_hiZ->GetInternHandle(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+	if (m_lastViewProjectionValid)
+	{
+		ei::Mat4x4 lastInverseViewProjection = ei::invert(m_lastViewProjection);
+
+		m_shaderHiZReproject->Activate();
+		GL_CALL(glUniformMatrix4fv, 0, 1, GL_FALSE, reinterpret_cast<const float*>(&lastInverseViewProjection));
+		lastFrameDepth.Bind(0);
+		m_hiZ->BindImage(0, gl::Texture::ImageAccess::READ_WRITE, 0);
+
+		GL_CALL(glMemoryBarrier, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		GL_CALL(glDispatchCompute, (m_hiZ->GetWidth() + 15) / 16, (m_hiZ->GetHeight() + 15) / 16, 1);
+	}
+
+	m_lastViewProjection = viewProjection;
+	m_lastViewProjectionValid = true;
+
+	DownsampleHiZ();
+}
+
+void OcclusionCulling::BuildHiZ(const gl::Texture2D& depth)
+{
+	m_shaderHiZInit->Activate();
+	depth.Bind(0);
+	m_hiZ->BindImage(0, gl::Texture::ImageAccess::WRITE, 0);
+	GL_CALL(glDispatchCompute, (m_hiZ->GetWidth() + 15) / 16, (m_hiZ->GetHeight() + 15) / 16, 1);
+
+	DownsampleHiZ();
+}
+
+void OcclusionCulling::DownsampleHiZ()
+{
+	m_shaderHiZDownsample->Activate();
+	for (GLsizei targetLevel = 1; targetLevel < m_hiZ->GetNumMipLevels(); ++targetLevel)
+	{
+		unsigned int targetWidth = ei::max<unsigned int>(1, m_hiZ->GetWidth() >> targetLevel);
+		unsigned int targetHeight = ei::max<unsigned int>(1, m_hiZ->GetHeight() >> targetLevel);
+
+		GL_CALL(glMemoryBarrier, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		m_hiZ->BindImage(0, gl::Texture::ImageAccess::READ, targetLevel - 1);
+		m_hiZ->BindImage(1, gl::Texture::ImageAccess::WRITE, targetLevel);
+		GL_CALL(glDispatchCompute, (targetWidth + 7) / 8, (targetHeight + 7) / 8, 1);
+	}
+	GL_CALL(glMemoryBarrier, GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void OcclusionCulling::Cull(Renderer& renderer, Phase phase)
+{
+	if (m_cullItems.empty())
+		return;
+
+	renderer.BindInstanceBuffer();
+	m_cullItemBuffer->BindShaderStorageBuffer(0);
+	m_drawCommandBuffer[(int)phase]->BindShaderStorageBuffer(1);
+	m_culledInstanceIndexBuffer->BindShaderStorageBuffer(2);
+	m_occludedInFirstPhaseBuffer->BindShaderStorageBuffer(3);
+	m_statsBuffer->BindShaderStorageBuffer(4);
+	m_hiZ->Bind(0);
+	m_samplerNearest.BindSampler(0);
+
+	m_shaderCull[(int)phase]->Activate();
+	GL_CALL(glUniform1ui, 0, static_cast<GLuint>(m_cullItems.size()));
+	GL_CALL(glDispatchCompute, static_cast<GLuint>((m_cullItems.size() + 63) / 64), 1, 1);
+
+	GL_CALL(glMemoryBarrier, GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	if (phase == Phase::SECOND)
+		m_statsWritten = true;
+}
+
+void OcclusionCulling::BindDrawBuffers(Phase phase)
+{
+	if (m_cullItems.empty())
+		return;
+
+	m_drawCommandBuffer[(int)phase]->BindIndirectDrawBuffer();
+	m_culledInstanceIndexBuffer->BindShaderStorageBuffer(6);
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <ei/vector.hpp>
+#include "renderer.hpp"
+#include "../shaderreload/autoreloadshaderptr.hpp"
+
+namespace gl
+{
+	class ShaderObject;
+	class Texture2D;
+	class Buffer;
+	class SamplerObject;
+}
+class ReadbackRing;
+
+/// Two phase GPU occlusion culling for the gbuffer pass using a hierarchical z-buffer (Hi-Z).
+///
+/// The first phase tests against the depth buffer of the last frame, reprojected to the current camera.
+/// The second phase tests all objects that were occluded in the first phase against the Hi-Z of the depth buffer that was filled by the first phase,
+/// so objects that just became visible are drawn in the same frame.
+/// Every mesh of every instance is tested separately. Results are written to indirect draw commands, one per batch and mesh.
+/// Does not perform any GPU profiling itself, since profiling queries can not be nested.
+/// Not exactly self-contained! Submodule for renderer!
+class OcclusionCulling
+{
+public:
+	OcclusionCulling();
+	~OcclusionCulling();
+
+	enum class Phase
+	{
+		FIRST,
+		SECOND
+	};
+
+	/// Should be called on screen resize. Also resets the reprojection history.
+	void OnScreenResize(const ei::UVec2& newResolution);
+
+	/// Next first phase will not use the depth buffer of the last frame.
+	void ResetHistory() { m_lastViewProjectionValid = false; }
+
+	/// Reads back statistics of an earlier frame (see ReadbackRing) and writes cull items and draw commands for the given batches.
+	///
+	/// Draw commands are ordered by batch and then by mesh, skipping no mesh. See Renderer::DrawScene.
+	/// \param instanceIndices
+	///		Entity indices the batches refer to.
+	void PrepareDrawCommands(const std::vector<Renderer::InstanceBatch>& batches, const std::vector<std::uint32_t>& instanceIndices);
+
+	/// Builds Hi-Z from the depth buffer of the last frame, reprojected into the current view.
+	///
+	/// \attention Needs to be called before the depth buffer is cleared and after the PerFrame UBO was updated.
+	/// \param viewProjection
+	///		Current view projection matrix. Will be used to reproject the next frame.
+	void BuildReprojectedHiZ(const gl::Texture2D& lastFrameDepth, const ei::Mat4x4& viewProjection);
+	/// Builds Hi-Z from the given depth buffer.
+	void BuildHiZ(const gl::Texture2D& depth);
+
+	/// Culls all items (first phase) or all items that were occluded in the first phase (second phase) against the current Hi-Z.
+	void Cull(Renderer& renderer, Phase phase);
+
+	/// Binds draw commands as indirect draw buffer and the culled instance indices (see instancedata.glsl) of the given phase.
+	void BindDrawBuffers(Phase phase);
+
+	/// Number of meshes (counting all instances) that were culled by occlusion in a recent frame.
+	unsigned int GetLastNumOcclusionCulled() const { return m_lastNumOcclusionCulled; }
+
+private:
+	struct CullItem
+	{
+		ei::Vec3 boxMin;
+		std::uint32_t entityIndex;
+		ei::Vec3 boxMax;
+		std::uint32_t drawCommandIndex;
+	};
+
+	struct DrawElementsIndirectCommand
+	{
+		std::uint32_t count;
+		std::uint32_t instanceCount;
+		std::uint32_t firstIndex;
+		std::uint32_t baseVertex;
+		std::uint32_t baseInstance;
+	};
+
+	/// Generates all Hi-Z levels from the first one.
+	void DownsampleHiZ();
+
+	AutoReloadShaderPtr m_shaderHiZReproject;
+	AutoReloadShaderPtr m_shaderHiZInit;
+	AutoReloadShaderPtr m_shaderHiZDownsample;
+	AutoReloadShaderPtr m_shaderCull[2];
+
+	const gl::SamplerObject& m_samplerNearest; ///< Integer textures are incomplete with linear filtering.
+
+	/// Hi-Z pyramid with full mip chain. Depth floats stored as uint to allow atomic operations.
+	std::unique_ptr<gl::Texture2D> m_hiZ;
+
+	std::vector<CullItem> m_cullItems;
+	std::vector<DrawElementsIndirectCommand> m_drawCommands;
+
+	std::unique_ptr<gl::Buffer> m_cullItemBuffer;
+	std::unique_ptr<gl::Buffer> m_drawCommandBuffer[2];
+	std::unique_ptr<gl::Buffer> m_culledInstanceIndexBuffer; ///< Room for all cull items, once for each phase.
+	std::unique_ptr<gl::Buffer> m_occludedInFirstPhaseBuffer;
+	std::unique_ptr<gl::Buffer> m_statsBuffer;
+	std::unique_ptr<ReadbackRing> m_statsReadback;
+
+	ei::Mat4x4 m_lastViewProjection;
+	bool m_lastViewProjectionValid;
+
+	bool m_statsWritten;
+	unsigned int m_lastNumOcclusionCulled;
+};
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "readbackring.hpp"
+#include "../utilities/assert.hpp"
+
+#include <glhelper/buffer.hpp>
+
+ReadbackRing::ReadbackRing(std::uint32_t slotSizeInBytes, unsigned int numSlots) :
+	m_buffer(0),
+	m_mappedData(nullptr),
+	m_slotSize(slotSizeInBytes),
+	m_fences(numSlots, nullptr),
+	m_nextSlot(0),
+	m_numInFlight(0)
+{
+	Assert(numSlots > 0, "Readback ring needs at least one slot!");
+
+	// gl::Buffer does not support persistent mapping.
+	GL_CALL(glCreateBuffers, 1, &m_buffer);
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GL_CALL(glNamedBufferStorage, m_buffer, static_cast<GLsizeiptr>(m_slotSize) * numSlots, nullptr, flags);
+	void* mappedData = GL_RET_CALL(glMapNamedBufferRange, m_buffer, 0, static_cast<GLsizeiptr>(m_slotSize) * numSlots, flags);
+	m_mappedData = static_cast<const std::uint8_t*>(mappedData);
+}
+
+ReadbackRing::~ReadbackRing()
+{
+	for (GLsync fence : m_fences)
+	{
+		if (fence)
+			GL_CALL(glDeleteSync, fence);
+	}
+	GL_CALL(glUnmapNamedBuffer, m_buffer);
+	GL_CALL(glDeleteBuffers, 1, &m_buffer);
+}
+
+void ReadbackRing::Copy(const gl::Buffer& source, std::uint32_t sourceOffsetInBytes, std::uint32_t sizeInBytes)
+{
+	Assert(sizeInBytes <= m_slotSize, "Readback exceeds slot size!");
+
+	// Ring is full. Dropping the oldest pending result instead would starve TryRead if the GPU is as many frames behind as there are slots.
+	if (m_numInFlight == m_fences.size())
+		return;
+
+	GL_CALL(glCopyNamedBufferSubData, source.GetInternHandle(), m_buffer, sourceOffsetInBytes, static_cast<GLintptr>(m_slotSize) * m_nextSlot, sizeInBytes);
+	GLsync fence = GL_RET_CALL(glFenceSync, GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_fences[m_nextSlot] = fence;
+
+	m_nextSlot = (m_nextSlot + 1) % m_fences.size();
+	++m_numInFlight;
+}
+
+const void* ReadbackRing::TryRead()
+{
+	// Fences are signaled in order, so the first unsignaled one ends the search.
+	const void* result = nullptr;
+	while (m_numInFlight > 0)
+	{
+		unsigned int oldestSlot = static_cast<unsigned int>((m_nextSlot + m_fences.size() - m_numInFlight) % m_fences.size());
+		GLenum waitResult = GL_RET_CALL(glClientWaitSync, m_fences[oldestSlot], 0, 0);
+		if (waitResult != GL_ALREADY_SIGNALED && waitResult != GL_CONDITION_SATISFIED)
+			break;
+
+		GL_CALL(glDeleteSync, m_fences[oldestSlot]);
+		m_fences[oldestSlot] = nullptr;
+		--m_numInFlight;
+		result = m_mappedData + static_cast<size_t>(m_slotSize) * oldestSlot;
+	}
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glhelper/gl.hpp>
+
+namespace gl
+{
+	class Buffer;
+}
+
+/// Ring of persistently mapped buffers for reading small GPU results (statistics, counters) back to the CPU without stalling.
+///
+/// Every Copy writes into the next slot and places a fence (glFenceSync) behind it. Results are only read once their fence was signaled,
+/// which usually happens two to three frames later. If all slots are still in flight, the new copy is skipped - pending results are never dropped,
+/// so results keep arriving even if the GPU runs more frames behind than there are slots.
+/// Results are therefore always late and may skip frames - only suitable for values that are not needed in the frame they were written.
+class ReadbackRing
+{
+public:
+	/// \param slotSizeInBytes
+	///		Maximum size of a single copy.
+	ReadbackRing(std::uint32_t slotSizeInBytes, unsigned int numSlots = 3);
+	~ReadbackRing();
+
+	/// Copies the given range of a buffer into the next slot. Needs a GL_BUFFER_UPDATE_BARRIER_BIT barrier after shader writes to the source.
+	/// Does nothing if all slots are in flight.
+	void Copy(const gl::Buffer& source, std::uint32_t sourceOffsetInBytes, std::uint32_t sizeInBytes);
+
+	/// Returns the most recent copy that is finished, never waits.
+	/// \return
+	///		Pointer to the slot's data, valid until the next call to Copy. nullptr if no new copy finished since the last call.
+	const void* TryRead();
+
+private:
+	GLuint m_buffer;
+	const std::uint8_t* m_mappedData;
+	std::uint32_t m_slotSize;
+
+	std::vector<GLsync> m_fences;	///< One per slot, nullptr if not in flight.
+	unsigned int m_nextSlot;		///< Slot of the next copy.
+	unsigned int m_numInFlight;		///< Number of slots in flight, these are the ones before m_nextSlot.
+};
\ No newline at end of file
@@ -1,6 +1,14 @@
 #include "renderer.hpp"
 #include "voxelization.hpp"
+#include "occlusionculling.hpp"
+#include "visibilitybuffer.hpp"
+#include "clusteredshading.hpp"
+#include "shadowmapatlas.hpp"
+#include "multiviewrsm.hpp"
 #include "hdrimage.hpp"
+#include "lightcachehashmap.hpp"
+#include "sortedcacheallocation.hpp"
+#include "readbackring.hpp"
 
 #include "../utilities/utils.hpp"
 
@@ -15,13 +23,73 @@
 #include <glhelper/shaderobject.hpp>
 #include <glhelper/texture3d.hpp>
 #include <glhelper/screenalignedtriangle.hpp>
-#include <glhelper/persistentringbuffer.hpp>
 #include <glhelper/framebufferobject.hpp>
 #include <glhelper/statemanagement.hpp>
 #include <glhelper/utils/flagoperators.hpp>
 
 #include <limits>
+#include <algorithm>
 
+namespace
+{
+	/// Bounding sphere of the cone of a spot light.
+	void ComputeSpotLightBoundingSphere(const Light& light, ei::Vec3& center, float& radius)
+	{
+		ei::Vec3 direction = ei::normalize(light.direction);
+		float cosHalfAngle = cosf(light.halfAngle);
+		if (light.halfAngle > ei::PI / 4)
+		{
+			center = light.position + direction * (cosHalfAngle * light.range);
+			radius = sinf(light.halfAngle) * light.range;
+		}
+		else
+		{
+			radius = light.range / (2.0f * cosHalfAngle);
+			center = light.position + direction * radius;
+		}
+	}
+
+	/// Smallest sphere (xyz center, w radius) that contains both given spheres.
+	ei::Vec4 MergeSpheres(const ei::Vec4& a, const ei::Vec4& b)
+	{
+		ei::Vec3 aToB = ei::Vec3(b.x, b.y, b.z) - ei::Vec3(a.x, a.y, a.z);
+		float distance = ei::len(aToB);
+		if (distance + b.w <= a.w)
+			return a;
+		if (distance + a.w <= b.w)
+			return b;
+
+		float radius = (distance + a.w + b.w) * 0.5f;
+		ei::Vec3 center = ei::Vec3(a.x, a.y, a.z) + aToB * ((radius - a.w) / distance);
+		return ei::Vec4(center, radius);
+	}
+
+	/// Reduces the number of spheres to the given maximum. Every sphere past the maximum is merged into the sphere whose radius grows least.
+	void ReduceSphereCount(std::vector<ei::Vec4>& spheres, size_t maxNumSpheres)
+	{
+		if (spheres.size() <= maxNumSpheres)
+			return;
+
+		for (size_t overflowIndex = maxNumSpheres; overflowIndex < spheres.size(); ++overflowIndex)
+		{
+			size_t bestIndex = 0;
+			ei::Vec4 bestMergedSphere = MergeSpheres(spheres[0], spheres[overflowIndex]);
+			for (size_t i = 1; i < maxNumSpheres; ++i)
+			{
+				ei::Vec4 mergedSphere = MergeSpheres(spheres[i], spheres[overflowIndex]);
+				if (mergedSphere.w - spheres[i].w < bestMergedSphere.w - spheres[bestIndex].w)
+				{
+					bestIndex = i;
+					bestMergedSphere = mergedSphere;
+				}
+			}
+			spheres[bestIndex] = bestMergedSphere;
+		}
+		spheres.resize(maxNumSpheres);
+	}
+}
+
+const float Renderer::s_lightCacheForceRelightSphereScale = 2.0f;
 
 Renderer::Renderer(const std::shared_ptr<const Scene>& scene, const ei::UVec2& resolution) :
 	m_samplerLinearRepeat(gl::SamplerObject::GetSamplerObject(gl::SamplerObject::Desc(gl::SamplerObject::Filter::LINEAR, gl::SamplerObject::Filter::LINEAR, gl::SamplerObject::Filter::LINEAR,
@@ -47,6 +115,43 @@ Renderer::Renderer(const std::shared_ptr<const Scene>& scene, const ei::UVec2& r
 	m_CAVCascadeTransitionSize(2.0f),
 	m_indirectShadow(true),
 	m_indirectSpecular(false),
+	m_occlusionCullingEnabled(false),
+	m_depthPrepass(false),
+	m_visibilityBufferEnabled(false),
+	m_pretransformedVertices(false),
+	m_timeDependentMeshDeformation(false),
+	m_clusteredShadingEnabled(false),
+	m_lightVolumes(false),
+	m_rsmCaching(false),
+	m_numSkippedRSMs(0),
+	m_multiViewRSMEnabled(false),
+	m_rsmComputeDownsample(true),
+	m_adaptiveRSMResolution(false),
+	m_indirectLightImportanceThreshold(0.0f),
+	m_batchedLightCaches(false),
+	m_valTreeEnabled(false),
+	m_valTreeErrorBound(0.1f),
+	m_valTreeComparison(false),
+	m_sampledVALs(false),
+	m_valSampleBudget(64),
+	m_valSampleBlendFactor(0.1f),
+	m_valSampleFrame(0),
+	m_lightCacheHashMapEnabled(false),
+	m_validateLightCacheHashMap(false),
+	m_sortedCacheAllocationEnabled(false),
+	m_packedLightCaches(false),
+	m_persistentLightCaches(false),
+	m_lightCacheRelightFraction(0.125f),
+	m_lightCacheRelightPhase(0),
+	m_previousLightCachesValid(false),
+	m_lightSelectionFrame(0),
+	m_numVALs(0),
+	m_maxNumVALsPerLight(0),
+	m_numVALTreeNodes(0),
+	m_maxVALTreeDepth(0),
+	m_valTreeComparisonWritten(false),
+	m_lastVALTreeMeanError(0.0f),
+	m_lastVALTreeMaxError(0.0f),
 
 	m_passedTime(0.0f)
 {
@@ -55,6 +160,9 @@ Renderer::Renderer(const std::shared_ptr<const Scene>& scene, const ei::UVec2& r
 
 	m_screenTriangle = std::make_unique<gl::ScreenAlignedTriangle>();
 
+	// Create sorted cache allocation module. Needs to exist before loading the cache setting dependent shaders.
+	m_sortedCacheAllocation = std::make_unique<SortedCacheAllocation>();
+
 	LoadAllShaders();
 	
 	// Init global ubos.
@@ -72,18 +180,19 @@ Renderer::Renderer(const std::shared_ptr<const Scene>& scene, const ei::UVec2& r
 	m_uboVolumeInfo = std::make_unique<gl::Buffer>(m_uboInfoVolumeInfo.bufferDataSizeByte, gl::Buffer::MAP_WRITE);
 	uboPrototypeShader->BindUBO(*m_uboVolumeInfo, "VolumeInfo");
 
-	// Expecting about 16 objects.
-	const unsigned int maxExpectedObjects = 16;
-	m_uboInfoPerObject = uboPrototypeShader->GetUniformBufferInfo()["PerObject"];
-	m_uboRing_PerObject = std::make_unique<gl::PersistentRingBuffer>(maxExpectedObjects * RoundSizeToUBOAlignment(m_uboInfoPerObject.bufferDataSizeByte) * 3);
-
-	// Light UBO.
-	const unsigned int maxExpectedLights = 16;
-	m_uboInfoSpotLight = uboPrototypeShader->GetUniformBufferInfo()["SpotLight"];
-	m_uboRing_SpotLight = std::make_unique<gl::PersistentRingBuffer>(maxExpectedLights * RoundSizeToUBOAlignment(m_uboInfoSpotLight.bufferDataSizeByte) * 3);
-
 	// Create voxelization module.
 	m_voxelization = std::make_unique<Voxelization>(128);
+	// Create occlusion culling module.
+	m_occlusionCulling = std::make_unique<OcclusionCulling>();
+	// Create visibility buffer module.
+	m_visibilityBuffer = std::make_unique<VisibilityBuffer>();
+	// Create clustered shading module.
+	m_clusteredShading = std::make_unique<ClusteredShading>();
+	// Create shadow map atlas.
+	m_shadowMapAtlas = std::make_unique<ShadowMapAtlas>();
+	m_rsmComputeDownsample = m_shadowMapAtlas->IsComputeDownsampleSupported();
+	// Create multi view RSM module.
+	m_multiViewRSM = std::make_unique<MultiViewRSM>();
 
 	// Allocate light cache buffer
 	SetMaxCacheCount(16384);
@@ -117,10 +226,14 @@ Renderer::Renderer(const std::shared_ptr<const Scene>& scene, const ei::UVec2& r
 	GL_CALL(glClipControl, GL_LOWER_LEFT, GL_ZERO_TO_ONE);
 
 	GL_CALL(glBlendFunc, GL_ONE, GL_ONE);
+
+	// Light volumes are generated in the vertex shader, but a vertex array needs to be bound anyway.
+	GL_CALL(glCreateVertexArrays, 1, &m_lightVolumeVAO);
 }
 
 Renderer::~Renderer()
 {
+	GL_CALL(glDeleteVertexArrays, 1, &m_lightVolumeVAO);
 }
 
 void Renderer::LoadAllShaders()
@@ -130,27 +243,26 @@ void Renderer::LoadAllShaders()
 	m_shaderDebugGBuffer->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/debuggbuffer.frag");
 	m_shaderDebugGBuffer->CreateProgram();
 
-	for (int i = 0; i < 2; ++i)
-	{
-		std::string postfix = (i == (int)ShaderAlphaTest::OFF) ? " - no alphatest" : " - alphatest";
-		std::string define = (i == (int)ShaderAlphaTest::OFF) ? "" : "#define ALPHATESTING 0.1";
-
-		m_shaderFillGBuffer[i] = new gl::ShaderObject("fill gbuffer" + postfix);
-		m_shaderFillGBuffer[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/defaultmodel.vert", define);
-		m_shaderFillGBuffer[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/fillgbuffer.frag", define);
-		m_shaderFillGBuffer[i]->CreateProgram();
+	ReloadGeometryShaders();
 
-		m_shaderFillRSM[i] = new gl::ShaderObject("fill rsm" + postfix);
-		m_shaderFillRSM[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/defaultmodel_rsm.vert", define);
-		m_shaderFillRSM[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/fillrsm.frag", define);
-		m_shaderFillRSM[i]->CreateProgram();
-	}
+	m_shaderDeformVertices = new gl::ShaderObject("deform vertices");
+	m_shaderDeformVertices->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/deformvertices.comp");
+	m_shaderDeformVertices->CreateProgram();
 
 	m_shaderDeferredDirectLighting_Spot = new gl::ShaderObject("direct lighting - spot");
 	m_shaderDeferredDirectLighting_Spot->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/screenTri.vert");
 	m_shaderDeferredDirectLighting_Spot->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/directdeferredlighting.frag");
 	m_shaderDeferredDirectLighting_Spot->CreateProgram();
 
+	m_shaderDeferredDirectLighting_SpotVolume = new gl::ShaderObject("direct lighting - spot light volume");
+	m_shaderDeferredDirectLighting_SpotVolume->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/lightvolume.vert");
+	m_shaderDeferredDirectLighting_SpotVolume->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/directdeferredlighting.frag", "#define LIGHT_VOLUME");
+	m_shaderDeferredDirectLighting_SpotVolume->CreateProgram();
+
+	m_shaderLightVolumeStencil = new gl::ShaderObject("light volume stencil");
+	m_shaderLightVolumeStencil->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/lightvolume.vert");
+	m_shaderLightVolumeStencil->CreateProgram();
+
 	m_shaderTonemap = new gl::ShaderObject("texture output");
 	m_shaderTonemap->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/screenTri.vert");
 	m_shaderTonemap->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/tonemapping.frag");
@@ -177,6 +289,14 @@ void Renderer::LoadAllShaders()
 	m_shaderLightCachePrepare->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/cachePrepareLighting.comp");
 	m_shaderLightCachePrepare->CreateProgram();
 
+	m_shaderLightCachePrepareVALs = new gl::ShaderObject("cache lighting prepare vals");
+	m_shaderLightCachePrepareVALs->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/cachePrepareVALs.comp");
+	m_shaderLightCachePrepareVALs->CreateProgram();
+
+	m_shaderLightCacheBuildVALTree = new gl::ShaderObject("cache lighting build val tree");
+	m_shaderLightCacheBuildVALTree->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/cacheBuildVALTree.comp");
+	m_shaderLightCacheBuildVALTree->CreateProgram();
+
 	m_shaderSpecularEnvmapMipMap = new gl::ShaderObject("specular envmap mipmap");
 	m_shaderSpecularEnvmapMipMap->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/specularenvmap.vert");
 	m_shaderSpecularEnvmapMipMap->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/specularenvmap_mipmap.frag");
@@ -191,9 +311,49 @@ void Renderer::LoadAllShaders()
 	m_shaderCacheDebug_Prepare->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/cachedebug/prepareindirectdrawbuffer.comp");
 	m_shaderCacheDebug_Prepare->CreateProgram();
 
+	m_shaderLightCacheHashMapTest = new gl::ShaderObject("light cache hash map test");
+	m_shaderLightCacheHashMapTest->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/lightcachehashmaptest.comp");
+	m_shaderLightCacheHashMapTest->CreateProgram();
+
 	ReloadLightingSettingDependentCacheShader();
 }
 
+void Renderer::ReloadGeometryShaders()
+{
+	std::string settings;
+	if (m_pretransformedVertices)
+		settings += "#define PRETRANSFORMED_VERTICES\n";
+
+	for (int i = 0; i < 2; ++i)
+	{
+		std::string postfix = (i == (int)ShaderAlphaTest::OFF) ? " - no alphatest" : " - alphatest";
+		std::string define = (i == (int)ShaderAlphaTest::OFF) ? settings : settings + "#define ALPHATESTING 0.1";
+
+		m_shaderFillGBuffer[i] = new gl::ShaderObject("fill gbuffer" + postfix);
+		m_shaderFillGBuffer[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/defaultmodel.vert", define);
+		m_shaderFillGBuffer[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/fillgbuffer.frag", define);
+		m_shaderFillGBuffer[i]->CreateProgram();
+
+		m_shaderDepthPrepass[i] = new gl::ShaderObject("depth prepass" + postfix);
+		m_shaderDepthPrepass[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/depthprepass.vert", define);
+		m_shaderDepthPrepass[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/depthprepass.frag", define);
+		m_shaderDepthPrepass[i]->CreateProgram();
+
+		m_shaderFillRSM[i] = new gl::ShaderObject("fill rsm" + postfix);
+		m_shaderFillRSM[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/defaultmodel_rsm.vert", define);
+		m_shaderFillRSM[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/fillrsm.frag", define);
+		m_shaderFillRSM[i]->CreateProgram();
+	}
+
+	// Submodules are created after the first shader load.
+	if (m_voxelization)
+		m_voxelization->ReloadGeometryShaders(settings);
+	if (m_visibilityBuffer)
+		m_visibilityBuffer->ReloadGeometryShaders(settings);
+	if (m_multiViewRSM)
+		m_multiViewRSM->ReloadGeometryShaders(settings);
+}
+
 void Renderer::ReloadLightingSettingDependentCacheShader()
 {
 	std::string settings;
@@ -211,6 +371,22 @@ void Renderer::ReloadLightingSettingDependentCacheShader()
 		settings += "#define SHOW_ADDRESSVOL_CASCADES\n";
 	if (m_CAVCascadeTransitionSize > 0.0f)
 		settings += "#define ADDRESSVOL_CASCADE_TRANSITIONS\n";
+	if (m_lightCacheHashMapEnabled)
+		settings += "#define LIGHTCACHE_HASHMAP\n";
+	if (m_packedLightCaches)
+		settings += "#define PACKED_LIGHTCACHES\n";
+	if (IsVALTreeActive())
+	{
+		settings += "#define VAL_TREE\n";
+		if (m_valTreeComparison)
+			settings += "#define VAL_TREE_COMPARISON\n";
+	}
+	else if (m_valTreeEnabled)
+		LOG_WARNING("VAL trees are not used with indirect shadow or indirect specular. Deactivate both to use them.");
+	if (m_sampledVALs && !m_indirectShadow && !m_indirectSpecular)
+		settings += "#define SAMPLED_VALS\n";
+	else if (m_sampledVALs)
+		LOG_WARNING("Sampled VALs are not used with indirect shadow or indirect specular. Deactivate both to use them.");
 	
 	switch (m_indirectDiffuseMode)
 	{
@@ -225,14 +401,27 @@ void Renderer::ReloadLightingSettingDependentCacheShader()
 	}
 
 
+	// Cache layout may have changed.
+	m_previousLightCachesValid = false;
+
 	m_shaderCacheGather = new gl::ShaderObject("cache gather");
 	m_shaderCacheGather->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/cacheGather.comp", settings);
 	m_shaderCacheGather->CreateProgram();
 
+	m_sortedCacheAllocation->ReloadShaders(settings);
+
 	m_shaderLightCachesRSM = new gl::ShaderObject("cache lighting rsm");
 	m_shaderLightCachesRSM->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/cacheLightingRSM.comp", settings);
 	m_shaderLightCachesRSM->CreateProgram();
 
+	m_shaderLightCachesRSMBatched = new gl::ShaderObject("cache lighting rsm batched");
+	m_shaderLightCachesRSMBatched->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/cacheLightingRSM.comp", settings + "#define BATCHED_LIGHTS\n");
+	m_shaderLightCachesRSMBatched->CreateProgram();
+
+	m_shaderLightCacheResolveLighting = new gl::ShaderObject("cache resolve lighting");
+	m_shaderLightCacheResolveLighting->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/cacheResolveLighting.comp", settings);
+	m_shaderLightCacheResolveLighting->CreateProgram();
+
 	m_shaderCacheApply = new gl::ShaderObject("apply caches");
 	m_shaderCacheApply->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/screenTri.vert");
 	m_shaderCacheApply->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/cacheApply.frag", settings);
@@ -262,14 +451,23 @@ void Renderer::AllocateCacheData()
 		demandedSpecularEnvMapSize = maxTextureSize;
 	}
 
-	// Maximum size per cache
-	const unsigned int lightCacheSizeInBytes = sizeof(float) * 4 * 8;
+	// Maximum size per cache of the irradiance stream. The position stream needs at most 16 bytes per cache.
+	const unsigned int lightCacheSizeInBytes = sizeof(float) * 4 * 7;
 
 	// Allocate cache buffer.
 	unsigned int cacheBufferSizeInBytes = m_maxNumLightCaches * lightCacheSizeInBytes;
 	if (!m_lightCacheBuffer || m_lightCacheBuffer->GetSize() != cacheBufferSizeInBytes)
 	{
 		m_lightCacheBuffer = std::make_unique<gl::Buffer>(cacheBufferSizeInBytes, gl::Buffer::IMMUTABLE, nullptr);
+		m_lightCacheBufferPrevious = std::make_unique<gl::Buffer>(cacheBufferSizeInBytes, gl::Buffer::IMMUTABLE, nullptr);
+		m_lightCachePositionBuffer = std::make_unique<gl::Buffer>(m_maxNumLightCaches * static_cast<unsigned int>(sizeof(float) * 4), gl::Buffer::IMMUTABLE, nullptr);
+		m_relightCacheBuffer = std::make_unique<gl::Buffer>(m_maxNumLightCaches * static_cast<unsigned int>(sizeof(std::uint32_t)), gl::Buffer::IMMUTABLE, nullptr);
+		std::vector<float> zeroScratch(m_maxNumLightCaches * 4 * 9, 0.0f); // Kept cleared by cacheResolveLighting.comp from there on.
+		m_lightCacheScratchBuffer = std::make_unique<gl::Buffer>(static_cast<unsigned int>(zeroScratch.size() * sizeof(float)), gl::Buffer::IMMUTABLE, zeroScratch.data());
+		unsigned int hashMapSizeInBytes = LightCacheHashMap::ComputeSize(m_maxNumLightCaches) * static_cast<unsigned int>(sizeof(LightCacheHashMap::Entry));
+		m_lightCacheHashMap = std::make_unique<gl::Buffer>(hashMapSizeInBytes, gl::Buffer::IMMUTABLE, nullptr);
+		m_lightCacheHashMapPrevious = std::make_unique<gl::Buffer>(hashMapSizeInBytes, gl::Buffer::IMMUTABLE, nullptr);
+		m_previousLightCachesValid = false;
 		SetReadLightCacheCount(false); // (Re)creates the lightcache buffer
 
 		LOG_INFO("Allocated " << cacheBufferSizeInBytes/1024 << " kb cache buffer.");
@@ -312,6 +510,7 @@ void Renderer::UpdateConstantUBO()
 	mappedMemory["NumAddressVolumeCascades"].Set(static_cast<int>(GetCAVCascadeCount()));
 
 	mappedMemory["MaxNumLightCaches"].Set(m_maxNumLightCaches);
+	mappedMemory["LightCacheHashMapSize"].Set(LightCacheHashMap::ComputeSize(m_maxNumLightCaches));
 	
 	mappedMemory["SpecularEnvmapTotalSize"].Set(m_specularEnvmap->GetWidth());
 	mappedMemory["SpecularEnvmapPerCacheSize_Texel"].Set(static_cast<int>(m_specularEnvmapPerCacheSize));
@@ -326,6 +525,7 @@ void Renderer::UpdatePerFrameUBO(const Camera& camera)
 	auto view = camera.ComputeViewMatrix();
 	auto projection = camera.ComputeProjectionMatrix();
 	auto viewProjection = projection * view;
+	m_viewProjection = viewProjection;
 
 	gl::MappedUBOView mappedMemory(m_uboInfoPerFrame, m_uboPerFrame->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER));
 
@@ -337,6 +537,8 @@ void Renderer::UpdatePerFrameUBO(const Camera& camera)
 	mappedMemory["CameraPosition"].Set(camera.GetPosition());
 	mappedMemory["CameraDirection"].Set(camera.GetDirection());
 	mappedMemory["PassedTime"].Set(m_passedTime);//static_cast<float>(ezTime::Now().GetSeconds()));
+	mappedMemory["CameraNearPlane"].Set(camera.GetNearPlane());
+	mappedMemory["CameraFarPlane"].Set(camera.GetFarPlane());
 	
 
 
@@ -419,6 +621,9 @@ void Renderer::UpdateVolumeUBO(const Camera& camera)
 		ei::Vec3 decisionMin = frustumBox.min + cascadeVoxelSize * 1.5f;
 		ei::Vec3 decisionMax = frustumBox.max * 1.5f; */
 
+		m_CAVCascadeMin.resize(m_CAVCascadeWorldSize.size());
+		m_CAVCascadeMin[i] = min;
+
 		std::string num = std::to_string(i);
 		mappedMemory["AddressVolumeCascades[" + num + "].Min"].Set(min);
 		mappedMemory["AddressVolumeCascades[" + num + "].WorldVoxelSize"].Set(cascadeVoxelSize);
@@ -468,7 +673,7 @@ void Renderer::OnScreenResize(const ei::UVec2& newResolution)
 	m_GBuffer_diffuse = std::make_unique<gl::Texture2D>(newResolution.x, newResolution.y, gl::TextureFormat::SRGB8, 1, 0);
 	m_GBuffer_roughnessMetallic = std::make_unique<gl::Texture2D>(newResolution.x, newResolution.y, gl::TextureFormat::RG8, 1, 0);
 	m_GBuffer_normal = std::make_unique<gl::Texture2D>(newResolution.x, newResolution.y, gl::TextureFormat::RG16I, 1, 0);
-	m_GBuffer_depth = std::make_unique<gl::Texture2D>(newResolution.x, newResolution.y, gl::TextureFormat::DEPTH_COMPONENT32F, 1, 0);
+	m_GBuffer_depth = std::make_unique<gl::Texture2D>(newResolution.x, newResolution.y, gl::TextureFormat::DEPTH32F_STENCIL8, 1, 0);
 
 	// Render to snorm integer makes problems.
 	// Others seem to have this problem too http://www.gamedev.net/topic/657167-opengl-44-render-to-snorm/
@@ -484,6 +689,10 @@ void Renderer::OnScreenResize(const ei::UVec2& newResolution)
 
 	GL_CALL(glViewport, 0, 0, newResolution.x, newResolution.y);
 
+	m_occlusionCulling->OnScreenResize(newResolution);
+	m_visibilityBuffer->OnScreenResize(newResolution, *m_GBuffer_depth);
+	m_clusteredShading->OnScreenResize(newResolution);
+	m_sortedCacheAllocation->OnScreenResize(newResolution);
 
 	UpdateConstantUBO();
 }
@@ -511,27 +720,29 @@ void Renderer::Draw(const Camera& camera, bool detachViewFromCameraUpdate, float
 	UpdatePerFrameUBO(camera);
 	if (!detachViewFromCameraUpdate)
 		UpdateVolumeUBO(camera);
-	UpdatePerObjectUBORingBuffer();
+	UpdateInstanceBuffer(camera);
+	if (m_pretransformedVertices)
+		DeformVertices();
+	UpdateLightRSMSettings(camera);
 	PrepareLights();
 	//PROFILE_GPU_END()
 
 	// Scene dependent renderings.
-	DrawSceneToGBuffer();
+	if (m_visibilityBufferEnabled)
+		DrawSceneToGBufferViaVisibilityBuffer();
+	else
+		DrawSceneToGBuffer();
 	DrawShadowMaps();
 
 	switch (m_mode)
 	{
 	case Mode::RSM_BRUTEFORCE:
-		m_uboRing_PerObject->CompleteFrame();
-
 		m_HDRBackbuffer->Bind(true);
 		GL_CALL(glClear, GL_COLOR_BUFFER_BIT);
 		ApplyDirectLighting();
 
 		ApplyRSMsBruteForce();
 
-		m_uboRing_SpotLight->CompleteFrame();
-
 		OutputHDRTextureToBackbuffer();
 		break;
 
@@ -543,8 +754,6 @@ void Renderer::Draw(const Camera& camera, bool detachViewFromCameraUpdate, float
 		if (m_indirectShadow)
 			m_voxelization->VoxelizeScene(*this);
 
-		m_uboRing_PerObject->CompleteFrame();
-
 		if (!detachViewFromCameraUpdate)
 		{
 			AllocateCaches();
@@ -565,14 +774,13 @@ void Renderer::Draw(const Camera& camera, bool detachViewFromCameraUpdate, float
 		//if (m_mode != Mode::DIRECTONLY_CACHE)
 			ApplyDirectLighting();
 
-		m_uboRing_SpotLight->CompleteFrame();
-
 		ApplyCaches();
 
 		if (m_mode == Mode::DYN_RADIANCE_VOLUME_DEBUG && m_debugSphereModel)
 		{
 			m_lightCacheBuffer->BindShaderStorageBuffer(0);
 			m_lightCacheCounter->BindShaderStorageBuffer(1);
+			m_lightCachePositionBuffer->BindShaderStorageBuffer(20);
 			m_cacheDebugIndirectDrawBuffer->BindShaderStorageBuffer(4);
 
 			m_shaderCacheDebug_Prepare->Activate();
@@ -595,44 +803,29 @@ void Renderer::Draw(const Camera& camera, bool detachViewFromCameraUpdate, float
 
 
 	case Mode::DIRECTONLY:
-		m_uboRing_PerObject->CompleteFrame();
-
 		m_HDRBackbuffer->Bind(true);
 		GL_CALL(glClear, GL_COLOR_BUFFER_BIT);
 		ApplyDirectLighting();
 
-		m_uboRing_SpotLight->CompleteFrame();
-
 		OutputHDRTextureToBackbuffer();
 		break;
 
 
 	case Mode::GBUFFER_DEBUG:
-		m_uboRing_PerObject->CompleteFrame();
-		m_uboRing_SpotLight->CompleteFrame();
-
 		DrawGBufferDebug();
 		break;
 
 
 	case Mode::VOXELVIS:
-		m_uboRing_SpotLight->CompleteFrame();
-
 		m_voxelization->VoxelizeScene(*this);
-		
-		m_uboRing_PerObject->CompleteFrame();
 
 		GL_CALL(glViewport, 0, 0, m_HDRBackbufferTexture->GetWidth(), m_HDRBackbufferTexture->GetHeight());
 		m_voxelization->DrawVoxelRepresentation();
 		break;
 
 	case Mode::AMBIENTOCCLUSION:
-		m_uboRing_SpotLight->CompleteFrame();
-
 		m_voxelization->VoxelizeScene(*this);
 
-		m_uboRing_PerObject->CompleteFrame();
-
 		m_HDRBackbuffer->Bind(true);
 		GL_CALL(glClear, GL_COLOR_BUFFER_BIT);
 		ConeTraceAO();
@@ -644,84 +837,308 @@ void Renderer::Draw(const Camera& camera, bool detachViewFromCameraUpdate, float
 	gl::Disable(gl::Cap::FRAMEBUFFER_SRGB);
 }
 
-void Renderer::UpdatePerObjectUBORingBuffer()
+void Renderer::AppendInstanceBatches(std::vector<unsigned int>& entityIndices, std::vector<InstanceBatch>& outBatches)
 {
-	for (unsigned int entityIndex = 0; entityIndex < m_scene->GetEntities().size(); ++entityIndex)
+	const std::vector<SceneEntity>& entities = m_scene->GetEntities();
+
+	// Sort entities by model so that all instances of a model form a consecutive range.
+	std::sort(entityIndices.begin(), entityIndices.end(), [&entities](unsigned int a, unsigned int b)
+		{
+			Model* modelA = entities[a].GetModel().get();
+			Model* modelB = entities[b].GetModel().get();
+			return modelA < modelB || (modelA == modelB && a < b);
+		});
+
+	outBatches.clear();
+	for (unsigned int entityIndex : entityIndices)
 	{
-		const SceneEntity& entity = m_scene->GetEntities()[entityIndex];
-		
-		void* blockMemory = nullptr;
-		size_t blockIndex = 0;	
-		m_uboRing_PerObject->AddBlock(blockMemory, blockIndex, sizeof(ei::Mat4x4), m_UBOAlignment);
-		Assert(blockIndex == entityIndex, "Entity index and memory block index are different.");
+		Model* model = entities[entityIndex].GetModel().get();
+		if (outBatches.empty() || outBatches.back().model != model)
+			outBatches.push_back(InstanceBatch{ model, static_cast<unsigned int>(m_instanceIndices.size()), 0 });
+		++outBatches.back().instanceCount;
+		m_instanceIndices.push_back(entityIndex);
+	}
+}
 
-		auto worldMatrix = entity.ComputeWorldMatrix();
-		memcpy(blockMemory, &worldMatrix, sizeof(ei::Mat4x4));
+void Renderer::UpdateInstanceBuffer(const Camera& camera)
+{
+	const std::vector<SceneEntity>& entities = m_scene->GetEntities();
+	const DynamicAABBTree& bvh = m_scene->GetBVH();
+
+	m_instanceIndices.clear();
+	m_instanceBatchesLights.resize(m_scene->GetLights().size());
+
+	// All entities with a model.
+	std::vector<unsigned int> visibleEntities;
+	visibleEntities.reserve(entities.size());
+	for (unsigned int entityIndex = 0; entityIndex < entities.size(); ++entityIndex)
+	{
+		if (entities[entityIndex].GetModel())
+			visibleEntities.push_back(entityIndex);
 	}
-	m_uboRing_PerObject->FlushAllBlocks();
+	AppendInstanceBatches(visibleEntities, m_instanceBatches);
+	if (visibleEntities.empty())
+	{
+		m_instanceBatchesCamera.clear();
+		for (auto& lightBatches : m_instanceBatchesLights)
+			lightBatches.clear();
+		return;
+	}
+
+	auto collectEntity = [&visibleEntities](unsigned int entityIndex) { visibleEntities.push_back(entityIndex); };
+
+	// Camera frustum.
+	visibleEntities.clear();
+	bvh.QueryFrustum(DynamicAABBTree::ExtractFrustum(camera.ComputeProjectionMatrix() * camera.ComputeViewMatrix()), collectEntity);
+	AppendInstanceBatches(visibleEntities, m_instanceBatchesCamera);
+
+	// Spot light cones. The RSM is square, so its corners reach further than the spot angle.
+	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
+	{
+		const Light& light = m_scene->GetLights()[lightIndex];
+		float rsmHalfAngle = atanf(tanf(light.halfAngle) * sqrtf(2.0f));
+
+		visibleEntities.clear();
+		bvh.QueryCone(light.position, ei::normalize(light.direction), rsmHalfAngle, Light::farPlane, collectEntity);
+		AppendInstanceBatches(visibleEntities, m_instanceBatchesLights[lightIndex]);
+	}
+
+	// Grow instance buffers if necessary.
+	size_t instanceBufferSize = sizeof(ei::Mat4x4) * entities.size();
+	if (!m_instanceBuffer || static_cast<size_t>(m_instanceBuffer->GetSize()) < instanceBufferSize)
+	{
+		size_t newInstanceCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(entities.size())));
+		m_instanceBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newInstanceCapacity * sizeof(ei::Mat4x4)), gl::Buffer::MAP_WRITE);
+		LOG_INFO("Resized instance buffer to " << newInstanceCapacity << " instances.");
+	}
+	size_t instanceIndexBufferSize = sizeof(std::uint32_t) * m_instanceIndices.size();
+	if (!m_instanceIndexBuffer || static_cast<size_t>(m_instanceIndexBuffer->GetSize()) < instanceIndexBufferSize)
+	{
+		size_t newIndexCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(m_instanceIndices.size())));
+		m_instanceIndexBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newIndexCapacity * sizeof(std::uint32_t)), gl::Buffer::MAP_WRITE);
+	}
+
+	ei::Mat4x4* instanceData = static_cast<ei::Mat4x4*>(m_instanceBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER));
+	for (unsigned int entityIndex = 0; entityIndex < entities.size(); ++entityIndex)
+	{
+		if (entities[entityIndex].GetModel())
+			instanceData[entityIndex] = entities[entityIndex].ComputeWorldMatrix();
+	}
+	m_instanceBuffer->Unmap();
+
+	std::uint32_t* indexData = static_cast<std::uint32_t*>(m_instanceIndexBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER));
+	memcpy(indexData, m_instanceIndices.data(), instanceIndexBufferSize);
+	m_instanceIndexBuffer->Unmap();
 }
 
-void Renderer::PrepareLights()
+void Renderer::UpdateLightRSMSettings(const Camera& camera)
 {
-	m_shadowMaps.resize(m_scene->GetLights().size());
+	const std::vector<Light>& lights = m_scene->GetLights();
+	m_lightRSMSettings.resize(lights.size(), LightRSMSettings{ 0, 0, 0, 0, 1.0f });
+
+	// Luminance of the light's flux. Flux of a spot light is its intensity times the solid angle of its cone.
+	auto computeFluxLuminance = [](const Light& light)
+	{
+		return ei::dot(light.intensity, ei::Vec3(0.212671f, 0.715160f, 0.072169f)) * 2.0f * ei::PI * (1.0f - cosf(light.halfAngle));
+	};
+	float maxFluxLuminance = 0.0f;
+	for (const Light& light : lights)
+		maxFluxLuminance = ei::max(maxFluxLuminance, computeFluxLuminance(light));
+
+	float tanHalfFov = tanf(camera.GetHFov() * (ei::PI / 180.0f) * 0.5f);
+	const float downscaleHysteresis = 0.25f;
+
+	// Light caches are only allocated within the largest address volume cascade around the camera (see UpdateVolumeUBO).
+	ei::Vec3 cacheVolumeMin = camera.GetPosition() - m_CAVCascadeWorldSize.back() * 0.5f;
+	ei::Vec3 cacheVolumeMax = camera.GetPosition() + m_CAVCascadeWorldSize.back() * 0.5f;
+
+	std::vector<float> indirectImportance(lights.size());
+	for (unsigned int lightIndex = 0; lightIndex < lights.size(); ++lightIndex)
+	{
+		const Light& light = lights[lightIndex];
+		LightRSMSettings& settings = m_lightRSMSettings[lightIndex];
+
+		unsigned int maxResolution = 1 << static_cast<int>(ceil(log2(light.rsmResolution)));
+		if (maxResolution != light.rsmResolution)
+			LOG_WARNING("RSM resolution needs to be a power of 2! Using " << maxResolution);
+
+		// Projected size of the bounding sphere of the light cone in relation to the view.
+		// Lights outside of the view frustum still contribute indirect light, so there is no frustum test.
+		ei::Vec3 sphereCenter;
+		float sphereRadius;
+		ComputeSpotLightBoundingSphere(light, sphereCenter, sphereRadius);
+		float distance = ei::len(sphereCenter - camera.GetPosition());
+		float coverage = distance <= sphereRadius ? 1.0f : ei::min(1.0f, (sphereRadius * sphereRadius) / (distance * distance * tanHalfFov * tanHalfFov));
+		float relativeFlux = computeFluxLuminance(light) / ei::max(maxFluxLuminance, 1e-6f);
+
+		// Proximity to the light caches: One if the cone's bounding sphere overlaps the cache volume, falling off with the distance to it otherwise.
+		ei::Vec3 closestCacheVolumePoint = ei::clamp(sphereCenter, cacheVolumeMin, cacheVolumeMax);
+		float cacheVolumeDistance = ei::max(0.0f, ei::len(sphereCenter - closestCacheVolumePoint) - sphereRadius);
+		float proximity = sphereRadius / (sphereRadius + cacheVolumeDistance);
+		indirectImportance[lightIndex] = relativeFlux * coverage * proximity * proximity;
+
+		if (m_adaptiveRSMResolution)
+		{
+			// Every downscale step quarters the number of RSM texels and VALs.
+			// Hysteresis: Current step is kept until the target leaves it by a margin.
+			float importance = coverage * relativeFlux;
+			float targetDownscale = -0.5f * log2(ei::max(importance, 1e-6f));
+			if (targetDownscale < settings.downscale - downscaleHysteresis || targetDownscale > settings.downscale + 1.0f + downscaleHysteresis)
+				settings.downscale = static_cast<unsigned int>(floorf(targetDownscale));
+
+			unsigned int maxDownscale = 0;
+			while (maxDownscale < s_maxRSMDownscale && (maxResolution >> (maxDownscale + 1)) >= s_minAdaptiveRSMResolution)
+				++maxDownscale;
+			settings.downscale = ei::min(settings.downscale, maxDownscale);
+		}
+		else
+			settings.downscale = 0;
+
+		// Read lod is kept, so the read resolution shrinks as well. Mip chain ends at 2x2.
+		settings.resolution = maxResolution >> settings.downscale;
+		settings.readLod = light.rsmReadLod;
+		settings.indirectShadowComputationLod = light.indirectShadowComputationLod;
+	}
+
+	// Indirect light budget.
+	float maxIndirectImportance = 0.0f;
+	for (float importance : indirectImportance)
+		maxIndirectImportance = ei::max(maxIndirectImportance, importance);
+	++m_lightSelectionFrame;
+	// Skipping is only unbiased if every cache is relit every frame. A persistent cache would otherwise miss a skipped light until its next relight.
+	bool allCachesRelit = !m_persistentLightCaches || m_indirectSpecular || m_lightCacheRelightFraction >= 1.0f ||
+							(m_sampledVALs && !m_indirectShadow);
+	for (unsigned int lightIndex = 0; lightIndex < lights.size(); ++lightIndex)
+	{
+		LightRSMSettings& settings = m_lightRSMSettings[lightIndex];
+		float relativeImportance = indirectImportance[lightIndex] / ei::max(maxIndirectImportance, 1e-6f);
+
+		settings.indirectScale = 1.0f;
+		if (relativeImportance < m_indirectLightImportanceThreshold)
+		{
+			// Coarser level holds the summed flux of the finer one, so the energy stays the same.
+			++settings.readLod;
 
+			// Russian roulette, selection probability is compensated by the scale.
+			// Golden ratio sequence per light avoids that several lights vanish in the same frame.
+			float skipThreshold = m_indirectLightImportanceThreshold * 0.25f;
+			if (allCachesRelit && relativeImportance < skipThreshold)
+			{
+				float selectionProbability = ei::max(relativeImportance / skipThreshold, 0.05f);
+				float random = fmodf(0.5f + m_lightSelectionFrame * 0.618034f + lightIndex * 0.754878f, 1.0f);
+				settings.indirectScale = random < selectionProbability ? 1.0f / selectionProbability : 0.0f;
+			}
+		}
+
+		unsigned int numLevels = static_cast<unsigned int>(log2(settings.resolution));
+		settings.readLod = ei::min(settings.readLod, numLevels - ei::min(numLevels, 1u));
+		settings.indirectShadowComputationLod = ei::min(settings.indirectShadowComputationLod, numLevels - settings.readLod);
+	}
+}
+
+void Renderer::PrepareLights()
+{
+	// (Re)allocate atlas regions, does not do anything if nothing changed.
+	std::vector<unsigned int> rsmResolutions;
+	rsmResolutions.reserve(m_lightRSMSettings.size());
+	for (const LightRSMSettings& settings : m_lightRSMSettings)
+		rsmResolutions.push_back(settings.resolution);
+	m_shadowMapAtlas->Init(rsmResolutions);
+
+	// All lights in a single buffer, per-light passes select their light via LightIndex (see globalubos.glsl).
+	std::vector<SpotLightData> lightData(m_scene->GetLights().size());
+	m_numVALs = 0;
+	m_maxNumVALsPerLight = 0;
+	m_numVALTreeNodes = 0;
+	m_maxVALTreeDepth = 0;
 	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
 	{
 		const Light& light = m_scene->GetLights()[lightIndex];
 		Assert(light.type == Light::Type::SPOT, "Only spot lights are supported so far!");
 
-		void* blockMemory = nullptr;
-		size_t blockIndex = 0;
-		m_uboRing_SpotLight->AddBlock(blockMemory, blockIndex, m_uboInfoSpotLight.bufferDataSizeByte, m_UBOAlignment);
-		Assert(blockIndex == lightIndex, "Light index and memory block index are different.");
-
-		gl::MappedUBOView uboView(m_uboInfoSpotLight, blockMemory);
-		uboView["LightIntensity"].Set(light.intensity);
-		uboView["ShadowNormalOffset"].Set(light.normalOffsetShadowBias);
-		uboView["ShadowBias"].Set(light.shadowBias);
+		SpotLightData& spotLight = lightData[lightIndex];
+		spotLight.intensity = light.intensity;
+		spotLight.shadowNormalOffset = light.normalOffsetShadowBias;
+		spotLight.shadowBias = light.shadowBias;
 		
-		uboView["LightPosition"].Set(light.position);
-		uboView["LightDirection"].Set(ei::normalize(light.direction));
-		uboView["LightCosHalfAngle"].Set(cosf(light.halfAngle));
+		spotLight.position = light.position;
+		spotLight.direction = ei::normalize(light.direction);
+		spotLight.cosHalfAngle = cosf(light.halfAngle);
+		spotLight.range = light.range;
+		spotLight.indirectScale = m_lightRSMSettings[lightIndex].indirectScale;
 
 		ei::Mat4x4 view = ei::camera(light.position, light.position + light.direction);
 		ei::Mat4x4 projection = ei::perspectiveDX(light.halfAngle * 2.0f, 1.0f, light.farPlane, light.nearPlane); // far and near intentionally swapped!
-		ei::Mat4x4 viewProjection = projection * view;
-		ei::Mat4x4 inverseViewProjection = ei::invert(viewProjection);
-		uboView["LightViewProjection"].Set(viewProjection);
-		uboView["InverseLightViewProjection"].Set(inverseViewProjection);
-
-		int shadowMapResolution_nextPow2 = 1 << static_cast<int>(ceil(log2(light.rsmResolution)));
-		if (shadowMapResolution_nextPow2 != light.rsmResolution)
-			LOG_WARNING("RSM resolution needs to be a power of 2! Using " << shadowMapResolution_nextPow2);
-		
-		uboView["RSMRenderResolution"].Set(shadowMapResolution_nextPow2);
+		spotLight.viewProjection = projection * view;
+		spotLight.inverseViewProjection = ei::invert(spotLight.viewProjection);
+
+		const LightRSMSettings& rsmSettings = m_lightRSMSettings[lightIndex];
+		spotLight.rsmRenderResolution = static_cast<std::int32_t>(rsmSettings.resolution);
 		
-		int rsmReadResolution = static_cast<int>(shadowMapResolution_nextPow2 / pow(2, light.rsmReadLod));
-		uboView["RSMReadResolution"].Set(rsmReadResolution);
+		int rsmReadResolution = static_cast<int>(rsmSettings.resolution >> rsmSettings.readLod);
+		spotLight.rsmReadResolution = rsmReadResolution;
+		spotLight.rsmReadLod = static_cast<std::int32_t>(rsmSettings.readLod);
+
+		// One VAL per read RSM texel, see cachePrepareVALs.comp
+		// The VAL tree has (numVALs - 1) / 3 inner nodes, see valtree.glsl
+		spotLight.valOffset = -1;
+		spotLight.valTreeOffset = -1;
+		if (rsmSettings.indirectScale != 0.0f)
+		{
+			unsigned int numVALs = static_cast<unsigned int>(rsmReadResolution * rsmReadResolution);
+			spotLight.valOffset = static_cast<std::int32_t>(m_numVALs);
+			m_numVALs += numVALs;
+			m_maxNumVALsPerLight = ei::max(m_maxNumVALsPerLight, numVALs);
+
+			spotLight.valTreeOffset = static_cast<std::int32_t>(m_numVALTreeNodes);
+			m_numVALTreeNodes += (numVALs - 1) / 3;
+			m_maxVALTreeDepth = ei::max(m_maxVALTreeDepth, static_cast<unsigned int>(log2(rsmReadResolution)));
+		}
+
+		const ShadowMapAtlas::Region& atlasRegion = m_shadowMapAtlas->GetRegion(lightIndex);
+		spotLight.rsmAtlasScale = static_cast<float>(atlasRegion.resolution) / m_shadowMapAtlas->GetResolution();
+		spotLight.rsmAtlasOffset = ei::Vec2(atlasRegion.offset) / static_cast<float>(m_shadowMapAtlas->GetResolution());
 
 		float clipPlaneWidth = sinf(light.halfAngle) * light.nearPlane * 2.0f;
 		float valAreaFactor = clipPlaneWidth * clipPlaneWidth / (light.nearPlane * light.nearPlane * rsmReadResolution * rsmReadResolution);
 		//float valAreaFactor = powf(sinf(light.halfAngle) * 2.0f / light.shadowMapResolution, 2.0);
-		uboView["ValAreaFactor"].Set(valAreaFactor);
+		spotLight.valAreaFactor = valAreaFactor;
 
 		// Indirect shadowing
-		uboView["IndirectShadowComputationLod"].Set(static_cast<float>(light.indirectShadowComputationLod));
-		float indirectShadowComputationBlockSize = static_cast<float>(1 << light.indirectShadowComputationLod);
-		uboView["IndirectShadowComputationBlockSize"].Set(indirectShadowComputationBlockSize);
+		spotLight.indirectShadowComputationLod = static_cast<float>(rsmSettings.indirectShadowComputationLod);
+		float indirectShadowComputationBlockSize = static_cast<float>(1 << rsmSettings.indirectShadowComputationLod);
+		spotLight.indirectShadowComputationBlockSize = indirectShadowComputationBlockSize;
 		std::int32_t indirectShadowComputationSampleInterval = static_cast<int>(indirectShadowComputationBlockSize * indirectShadowComputationBlockSize);
 		Assert(indirectShadowComputationBlockSize <= rsmReadResolution, "Shadow sample interval can not be larger than the RSM.");
 		
-		uboView["IndirectShadowComputationSampleInterval"].Set(indirectShadowComputationSampleInterval);
+		spotLight.indirectShadowComputationSampleInterval = indirectShadowComputationSampleInterval;
 
 		
-		uboView["IndirectShadowComputationSuperValWidth"].Set(sqrtf(valAreaFactor) * indirectShadowComputationBlockSize);
-		uboView["IndirectShadowSamplingOffset"].Set(0.5f + sqrtf(2.0f) * indirectShadowComputationBlockSize / 2.0f);
+		spotLight.indirectShadowComputationSuperValWidth = sqrtf(valAreaFactor) * indirectShadowComputationBlockSize;
+		spotLight.indirectShadowSamplingOffset = 0.5f + sqrtf(2.0f) * indirectShadowComputationBlockSize / 2.0f;
+
+	}
+	if (lightData.empty())
+		return;
 
+	// Upload only if any light changed.
+	if (lightData.size() != m_lightData.size() || memcmp(lightData.data(), m_lightData.data(), sizeof(SpotLightData) * lightData.size()) != 0)
+	{
+		// Grow light buffer if necessary.
+		size_t lightBufferSize = sizeof(SpotLightData) * lightData.size();
+		if (!m_lightBuffer || static_cast<size_t>(m_lightBuffer->GetSize()) < lightBufferSize)
+		{
+			size_t newLightCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(lightData.size())));
+			m_lightBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newLightCapacity * sizeof(SpotLightData)), gl::Buffer::MAP_WRITE);
+			LOG_INFO("Resized spot light buffer to " << newLightCapacity << " lights.");
+		}
 
-		// (Re)Init shadow map if necessary (function does not do anything if already intialized with same settings.
-		m_shadowMaps[lightIndex].Init(light.rsmResolution);
+		void* lightBufferData = m_lightBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER);
+		memcpy(lightBufferData, lightData.data(), lightBufferSize);
+		m_lightBuffer->Unmap();
+		m_lightData = std::move(lightData);
 	}
+	m_lightBuffer->BindShaderStorageBuffer(16);
 }
 
 void Renderer::BindGBuffer()
@@ -737,9 +1154,77 @@ void Renderer::BindGBuffer()
 	m_samplerNearest.BindSampler(3);
 }
 
-void Renderer::BindObjectUBO(unsigned int _objectIndex)
+void Renderer::BindInstanceBuffer()
+{
+	if (m_instanceBuffer)
+	{
+		m_instanceBuffer->BindShaderStorageBuffer(5);
+		m_instanceIndexBuffer->BindShaderStorageBuffer(6);
+	}
+	if (m_pretransformedVertices && m_deformedVertexBuffer)
+	{
+		m_deformedVertexBuffer->BindShaderStorageBuffer(10);
+		m_deformedVertexOffsetBuffer->BindShaderStorageBuffer(11);
+	}
+}
+
+void Renderer::DeformVertices()
 {
-	m_uboRing_PerObject->BindBlockAsUBO(m_uboInfoPerObject.bufferBinding, _objectIndex);
+	PROFILE_GPU_SCOPED(DeformVertices);
+
+	const std::vector<SceneEntity>& entities = m_scene->GetEntities();
+
+	size_t numDeformedVertices = 0;
+	for (const InstanceBatch& batch : m_instanceBatches)
+		numDeformedVertices += static_cast<size_t>(batch.instanceCount) * batch.model->GetNumVertices();
+	if (numDeformedVertices == 0)
+		return;
+
+	// Grow buffers if necessary.
+	const size_t deformedVertexSize = sizeof(ei::Vec4) * 2; // See deformedvertices.glsl
+	if (!m_deformedVertexBuffer || static_cast<size_t>(m_deformedVertexBuffer->GetSize()) < deformedVertexSize * numDeformedVertices)
+	{
+		size_t newVertexCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(numDeformedVertices)));
+		m_deformedVertexBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newVertexCapacity * deformedVertexSize), gl::Buffer::IMMUTABLE);
+		LOG_INFO("Resized deformed vertex buffer to " << newVertexCapacity << " vertices.");
+	}
+	if (!m_deformedVertexOffsetBuffer || static_cast<size_t>(m_deformedVertexOffsetBuffer->GetSize()) < sizeof(std::uint32_t) * entities.size())
+	{
+		size_t newOffsetCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(entities.size())));
+		m_deformedVertexOffsetBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newOffsetCapacity * sizeof(std::uint32_t)), gl::Buffer::MAP_WRITE);
+	}
+
+	// Every entity gets a consecutive range of vertices, in the same order as they are written by the dispatches below.
+	std::uint32_t* offsetData = static_cast<std::uint32_t*>(m_deformedVertexOffsetBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER));
+	std::uint32_t outputOffset = 0;
+	for (const InstanceBatch& batch : m_instanceBatches)
+	{
+		for (unsigned int instance = batch.firstInstance; instance < batch.firstInstance + batch.instanceCount; ++instance)
+		{
+			offsetData[m_instanceIndices[instance]] = outputOffset;
+			outputOffset += batch.model->GetNumVertices();
+		}
+	}
+	m_deformedVertexOffsetBuffer->Unmap();
+
+	BindInstanceBuffer();
+	m_shaderDeformVertices->Activate();
+	outputOffset = 0;
+	for (const InstanceBatch& batch : m_instanceBatches)
+	{
+		std::uint32_t numBatchVertices = batch.instanceCount * batch.model->GetNumVertices();
+
+		GL_CALL(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 8, batch.model->GetVertexBuffer().GetInternHandle());
+		GL_CALL(glUniform1ui, 0, batch.model->GetNumVertices());
+		GL_CALL(glUniform1ui, 1, batch.firstInstance);
+		GL_CALL(glUniform1ui, 2, batch.instanceCount);
+		GL_CALL(glUniform1ui, 3, outputOffset);
+		GL_CALL(glDispatchCompute, (numBatchVertices + 63) / 64, 1, 1);
+
+		outputOffset += numBatchVertices;
+	}
+
+	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
 void Renderer::OutputHDRTextureToBackbuffer()
@@ -759,20 +1244,147 @@ void Renderer::OutputHDRTextureToBackbuffer()
 
 void Renderer::DrawSceneToGBuffer()
 {
-	PROFILE_GPU_SCOPED(DrawSceneToGBuffer);
-
 	gl::Enable(gl::Cap::DEPTH_TEST);
 	gl::SetDepthWrite(true);
 
 	m_samplerLinearRepeat.BindSampler(0);
 
+	// Draws either depth only or the full gbuffer. With occlusion culling, the draw commands of the given phase are used.
+	// After a depth prepass alpha testing is no longer necessary, since only the fragments that passed it already will pass the depth test.
+	bool culled = m_occlusionCullingEnabled;
+	auto drawScene = [this, culled](OcclusionCulling::Phase phase, bool depthOnly)
+	{
+		if (culled)
+		{
+			BindInstanceBuffer();
+			m_occlusionCulling->BindDrawBuffers(phase);
+		}
+
+		if (depthOnly)
+		{
+			DrawSceneDepthPrepass(m_instanceBatchesCamera, culled);
+		}
+		else if (m_depthPrepass)
+		{
+			m_shaderFillGBuffer[(int)ShaderAlphaTest::OFF]->Activate();
+			DrawScene(m_instanceBatchesCamera, true, SceneDrawSubset::ALL, culled);
+		}
+		else
+		{
+			m_shaderFillGBuffer[(int)ShaderAlphaTest::OFF]->Activate();
+			DrawScene(m_instanceBatchesCamera, true, SceneDrawSubset::FULLOPAQUE_ONLY, culled);
+			m_shaderFillGBuffer[(int)ShaderAlphaTest::ON]->Activate();
+			DrawScene(m_instanceBatchesCamera, true, SceneDrawSubset::ALPHATESTED_ONLY, culled);
+		}
+	};
+	// Second culling phase: Everything that was occluded in the first phase but is visible with the new depth buffer.
+	auto cullSecondPhase = [this]()
+	{
+		PROFILE_GPU_SCOPED(OcclusionCullSecondPhase);
+		m_occlusionCulling->BuildHiZ(*m_GBuffer_depth);
+		m_occlusionCulling->Cull(*this, OcclusionCulling::Phase::SECOND);
+	};
+
+	// First culling phase: Everything that is visible with the reprojected depth of the last frame.
+	// Depth buffer still contains the last frame.
+	if (culled)
+	{
+		m_occlusionCulling->PrepareDrawCommands(m_instanceBatchesCamera, m_instanceIndices);
+
+		PROFILE_GPU_SCOPED(OcclusionCullFirstPhase);
+		m_occlusionCulling->BuildReprojectedHiZ(*m_GBuffer_depth, m_viewProjection);
+		m_occlusionCulling->Cull(*this, OcclusionCulling::Phase::FIRST);
+	}
+
 	m_GBuffer->Bind(false);
 	GL_CALL(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	m_shaderFillGBuffer[(int)ShaderAlphaTest::OFF]->Activate();
-	DrawScene(true, SceneDrawSubset::FULLOPAQUE_ONLY);
-	m_shaderFillGBuffer[(int)ShaderAlphaTest::ON]->Activate();
-	DrawScene(true, SceneDrawSubset::ALPHATESTED_ONLY);
+	if (m_depthPrepass)
+	{
+		GL_CALL(glColorMask, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		{
+			PROFILE_GPU_SCOPED(DepthPrepass);
+			drawScene(OcclusionCulling::Phase::FIRST, true);
+		}
+		if (culled)
+		{
+			cullSecondPhase();
+
+			PROFILE_GPU_SCOPED(DepthPrepassSecondPhase);
+			m_GBuffer->Bind(false);
+			drawScene(OcclusionCulling::Phase::SECOND, true);
+		}
+		GL_CALL(glColorMask, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+		// Depth buffer is complete, every pixel is shaded exactly once.
+		gl::SetDepthFunc(gl::DepthFunc::EQUAL);
+		gl::SetDepthWrite(false);
+		{
+			PROFILE_GPU_SCOPED(DrawSceneToGBuffer);
+			m_GBuffer->Bind(false);
+			drawScene(OcclusionCulling::Phase::FIRST, false);
+			if (culled)
+				drawScene(OcclusionCulling::Phase::SECOND, false);
+		}
+		gl::SetDepthFunc(gl::DepthFunc::GREATER);
+		gl::SetDepthWrite(true);
+	}
+	else
+	{
+		{
+			PROFILE_GPU_SCOPED(DrawSceneToGBuffer);
+			drawScene(OcclusionCulling::Phase::FIRST, false);
+		}
+		if (culled)
+		{
+			cullSecondPhase();
+
+			PROFILE_GPU_SCOPED(DrawSceneToGBufferSecondPhase);
+			m_GBuffer->Bind(false);
+			drawScene(OcclusionCulling::Phase::SECOND, false);
+		}
+	}
+}
+
+std::uint64_t Renderer::ComputeRSMSignature(unsigned int lightIndex) const
+{
+	// FNV-1a
+	std::uint64_t signature = 14695981039346656037ull;
+	auto hash = [&signature](const void* data, size_t size)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			signature ^= static_cast<const std::uint8_t*>(data)[i];
+			signature *= 1099511628211ull;
+		}
+	};
+
+	const Light& light = m_scene->GetLights()[lightIndex];
+	hash(&light.type, sizeof(light.type));
+	hash(&light.intensity, sizeof(light.intensity));
+	hash(&light.position, sizeof(light.position));
+	hash(&light.direction, sizeof(light.direction));
+	hash(&light.halfAngle, sizeof(light.halfAngle));
+	hash(&light.range, sizeof(light.range));
+	hash(&m_lightRSMSettings[lightIndex].resolution, sizeof(m_lightRSMSettings[lightIndex].resolution));
+	// Deformed shadow casters change with time.
+	if (m_timeDependentMeshDeformation)
+		hash(&m_passedTime, sizeof(m_passedTime));
+
+	const std::vector<SceneEntity>& entities = m_scene->GetEntities();
+	for (const InstanceBatch& batch : m_instanceBatchesLights[lightIndex])
+	{
+		hash(&batch.model, sizeof(batch.model));
+		for (unsigned int instance = batch.firstInstance; instance < batch.firstInstance + batch.instanceCount; ++instance)
+		{
+			ei::Mat4x4 worldMatrix = entities[m_instanceIndices[instance]].ComputeWorldMatrix();
+			hash(&m_instanceIndices[instance], sizeof(m_instanceIndices[instance]));
+			hash(&worldMatrix, sizeof(worldMatrix));
+		}
+	}
+
+	// 0 is reserved for invalid content.
+	return signature == 0 ? 1 : signature;
 }
 
 void Renderer::DrawShadowMaps()
@@ -784,29 +1396,87 @@ void Renderer::DrawShadowMaps()
 
 	m_samplerLinearClamp.BindSampler(0);
 
-	
+	// Find out which RSMs need to be updated.
+	std::vector<bool> rsmOutdated(m_scene->GetLights().size(), true);
+	m_numSkippedRSMs = 0;
+	// Changes are collected until the next cache allocation, see AllocateCaches.
+	if (m_lightsChangedSinceCacheAllocation.size() != m_scene->GetLights().size())
+	{
+		m_lightsChangedSinceCacheAllocation.assign(m_scene->GetLights().size(), true);
+		m_previousLightCachesValid = false;
+	}
 	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
 	{
-		m_uboRing_SpotLight->BindBlockAsUBO(m_uboInfoSpotLight.bufferBinding, lightIndex);
+		std::uint64_t signature = ComputeRSMSignature(lightIndex);
+		ShadowMapAtlas::Region& atlasRegion = m_shadowMapAtlas->GetRegion(lightIndex);
+		if (atlasRegion.contentSignature != signature)
+			m_lightsChangedSinceCacheAllocation[lightIndex] = true;
+		if (m_rsmCaching && atlasRegion.contentSignature == signature)
+		{
+			rsmOutdated[lightIndex] = false;
+			++m_numSkippedRSMs;
+		}
+		atlasRegion.contentSignature = signature;
+	}
 
-		m_shadowMaps[lightIndex].BindFBO_RSM();
-		GL_CALL(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// All lights render into the same atlas, only the viewport changes.
+	std::vector<unsigned int> renderedRegions;
+	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
+	{
+		if (rsmOutdated[lightIndex])
+			renderedRegions.push_back(lightIndex);
+	}
 
-		m_shaderFillRSM[(int)ShaderAlphaTest::OFF]->Activate();
-		DrawScene(true, SceneDrawSubset::FULLOPAQUE_ONLY);
-		m_shaderFillRSM[(int)ShaderAlphaTest::ON]->Activate();
-		DrawScene(true, SceneDrawSubset::ALPHATESTED_ONLY);
+	m_shadowMapAtlas->BindFBO_RSM();
+	if (m_multiViewRSMEnabled)
+		DrawShadowMapsMultiView(renderedRegions);
+	else
+	{
+		for (unsigned int lightIndex : renderedRegions)
+		{
+			m_shadowMapAtlas->BeginRegion(lightIndex);
+
+			m_shaderFillRSM[(int)ShaderAlphaTest::OFF]->Activate();
+			GL_CALL(glUniform1ui, s_lightIndexUniformLocation, lightIndex);
+			DrawScene(m_instanceBatchesLights[lightIndex], true, SceneDrawSubset::FULLOPAQUE_ONLY);
+			m_shaderFillRSM[(int)ShaderAlphaTest::ON]->Activate();
+			GL_CALL(glUniform1ui, s_lightIndexUniformLocation, lightIndex);
+			DrawScene(m_instanceBatchesLights[lightIndex], true, SceneDrawSubset::ALPHATESTED_ONLY);
+		}
 	}
 
-	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
+	// Generate RSM mipmaps. Lights read from their RSMReadLod (see SpotLightBuffer in globalubos.glsl).
+	if (m_rsmComputeDownsample)
+		m_shadowMapAtlas->PrepareRSMsCompute(renderedRegions);
+	else
+		m_shadowMapAtlas->PrepareRSMs(renderedRegions, *m_screenTriangle);
+}
+
+void Renderer::DrawShadowMapsMultiView(const std::vector<unsigned int>& lightIndices)
+{
+	if (lightIndices.empty())
+		return;
+
+	// All instances are culled against the light frustums on the GPU.
+	m_multiViewRSM->PrepareDrawCommands(m_instanceBatches, m_instanceIndices);
+
+	for (size_t firstLight = 0; firstLight < lightIndices.size(); firstLight += m_multiViewRSM->GetMaxNumViews())
 	{
-		// Resolve and generate RSM mipmaps
-		m_shadowMaps[lightIndex].PrepareRSM(*m_screenTriangle);
+		std::vector<unsigned int> passLightIndices(lightIndices.begin() + firstLight,
+													lightIndices.begin() + ei::min<size_t>(lightIndices.size(), firstLight + m_multiViewRSM->GetMaxNumViews()));
+
+		// Clear all regions of this pass before the viewports are set.
+		for (unsigned int lightIndex : passLightIndices)
+			m_shadowMapAtlas->BeginRegion(lightIndex);
+
+		m_multiViewRSM->Cull(*this, m_scene->GetLights(), passLightIndices, *m_shadowMapAtlas);
 
-		// Set base levels for reading.
-		GL_CALL(glTextureParameteri, m_shadowMaps[lightIndex].GetFlux().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, m_scene->GetLights()[lightIndex].rsmReadLod);
-		GL_CALL(glTextureParameteri, m_shadowMaps[lightIndex].GetNormal().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, m_scene->GetLights()[lightIndex].rsmReadLod);
-		GL_CALL(glTextureParameteri, m_shadowMaps[lightIndex].GetDepthLinSq().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, m_scene->GetLights()[lightIndex].rsmReadLod);
+		BindInstanceBuffer();
+		m_multiViewRSM->BindDrawBuffers();
+		m_multiViewRSM->ActivateFillShader(false);
+		DrawScene(m_instanceBatches, true, SceneDrawSubset::FULLOPAQUE_ONLY, true);
+		m_multiViewRSM->ActivateFillShader(true);
+		DrawScene(m_instanceBatches, true, SceneDrawSubset::ALPHATESTED_ONLY, true);
 	}
 }
 
@@ -826,6 +1496,17 @@ void Renderer::DrawGBufferDebug()
 
 void Renderer::ApplyDirectLighting()
 {
+	if (m_clusteredShadingEnabled)
+	{
+		ApplyDirectLightingClustered();
+		return;
+	}
+	if (m_lightVolumes)
+	{
+		ApplyDirectLightingLightVolumes();
+		return;
+	}
+
 	PROFILE_GPU_SCOPED(ApplyDirectLighting);
 
 	gl::Disable(gl::Cap::CULL_FACE);
@@ -836,18 +1517,89 @@ void Renderer::ApplyDirectLighting()
 
 	BindGBuffer();
 	m_samplerShadow.BindSampler(4);
+	m_shadowMapAtlas->GetHighResDepth().Bind(4);
 
 	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
 	{
-		m_shadowMaps[lightIndex].GetHighResDepth().Bind(4);
-		
-		m_uboRing_SpotLight->BindBlockAsUBO(m_uboInfoSpotLight.bufferBinding, lightIndex);
+		GL_CALL(glUniform1ui, s_lightIndexUniformLocation, lightIndex);
 		m_screenTriangle->Draw();
 	}
 
 	gl::Disable(gl::Cap::BLEND);
 }
 
+void Renderer::ApplyDirectLightingLightVolumes()
+{
+	PROFILE_GPU_SCOPED(ApplyDirectLightingLightVolumes);
+
+	// Stencil marking needs the gbuffer's depth stencil buffer.
+	m_HDRBackbufferWithGBufferDepth->Bind(false);
+	GL_CALL(glClear, GL_STENCIL_BUFFER_BIT);
+
+	gl::Disable(gl::Cap::CULL_FACE);
+	gl::SetDepthWrite(false);
+	gl::Enable(gl::Cap::BLEND);
+	gl::Enable(gl::Cap::STENCIL_TEST);
+	// Cones may reach beyond near and far plane.
+	gl::Enable(gl::Cap::DEPTH_CLAMP);
+
+	BindGBuffer();
+	m_samplerShadow.BindSampler(4);
+	m_shadowMapAtlas->GetHighResDepth().Bind(4);
+	GL_CALL(glBindVertexArray, m_lightVolumeVAO);
+
+	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
+	{
+		// Mark pixels whose surface lies within the cone: Back faces behind the surface increment, front faces behind the surface decrement.
+		// Independent of the winding, since only non-zero values are of interest.
+		m_shaderLightVolumeStencil->Activate();
+		GL_CALL(glUniform1ui, s_lightIndexUniformLocation, lightIndex);
+		gl::Enable(gl::Cap::DEPTH_TEST);
+		GL_CALL(glColorMask, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		GL_CALL(glStencilFunc, GL_ALWAYS, 0, 0xFF);
+		GL_CALL(glStencilOpSeparate, GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+		GL_CALL(glStencilOpSeparate, GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+		GL_CALL(glDrawArrays, GL_TRIANGLES, 0, s_numLightVolumeVertices);
+
+		// Shade marked pixels. The first fragment resets the stencil value, so every pixel is lit once and the stencil buffer is clean for the next light.
+		m_shaderDeferredDirectLighting_SpotVolume->Activate();
+		GL_CALL(glUniform1ui, s_lightIndexUniformLocation, lightIndex);
+		gl::Disable(gl::Cap::DEPTH_TEST);
+		GL_CALL(glColorMask, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		GL_CALL(glStencilFunc, GL_NOTEQUAL, 0, 0xFF);
+		GL_CALL(glStencilOp, GL_KEEP, GL_KEEP, GL_ZERO);
+		GL_CALL(glDrawArrays, GL_TRIANGLES, 0, s_numLightVolumeVertices);
+	}
+
+	gl::Disable(gl::Cap::DEPTH_CLAMP);
+	gl::Disable(gl::Cap::STENCIL_TEST);
+	gl::Disable(gl::Cap::BLEND);
+	gl::SetDepthWrite(true);
+
+	m_HDRBackbuffer->Bind(false);
+}
+
+void Renderer::ApplyDirectLightingClustered()
+{
+	gl::Disable(gl::Cap::CULL_FACE);
+	gl::Disable(gl::Cap::DEPTH_TEST);
+
+	{
+		PROFILE_GPU_SCOPED(AssignLightsToClusters);
+		m_clusteredShading->UpdateLights(m_scene->GetLights(), *m_shadowMapAtlas);
+		m_clusteredShading->AssignLights();
+	}
+	{
+		PROFILE_GPU_SCOPED(ApplyDirectLightingClustered);
+		gl::Enable(gl::Cap::BLEND);
+		BindGBuffer();
+		m_samplerShadow.BindSampler(4);
+		m_shadowMapAtlas->GetHighResDepth().Bind(4);
+		m_clusteredShading->ApplyLighting(*m_screenTriangle);
+		gl::Disable(gl::Cap::BLEND);
+	}
+}
+
 void Renderer::ApplyRSMsBruteForce()
 {
 	gl::Disable(gl::Cap::DEPTH_TEST);
@@ -859,14 +1611,13 @@ void Renderer::ApplyRSMsBruteForce()
 	m_samplerNearest.BindSampler(4);
 	m_samplerNearest.BindSampler(5);
 	m_samplerNearest.BindSampler(6);
+	m_shadowMapAtlas->GetFlux().Bind(4);
+	m_shadowMapAtlas->GetDepthLinSq().Bind(5);
+	m_shadowMapAtlas->GetNormal().Bind(6);
 
 	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
 	{
-		m_shadowMaps[lightIndex].GetFlux().Bind(4);
-		m_shadowMaps[lightIndex].GetDepthLinSq().Bind(5);
-		m_shadowMaps[lightIndex].GetNormal().Bind(6);
-
-		m_uboRing_SpotLight->BindBlockAsUBO(m_uboInfoSpotLight.bufferBinding, lightIndex);
+		GL_CALL(glUniform1ui, s_lightIndexUniformLocation, lightIndex);
 		m_screenTriangle->Draw();
 	}
 
@@ -882,6 +1633,7 @@ void Renderer::ApplyRSMsBruteForce()
 	m_shaderLightCachesDirect->BindSSBO(*m_lightCacheCounter, "LightCacheCounter");
 
 	m_samplerShadow.BindSampler(0);
+	m_shadowMapAtlas->GetHighResDepth().Bind(0);
 
 	m_shaderLightCachesDirect->Activate();
 
@@ -889,9 +1641,7 @@ void Renderer::ApplyRSMsBruteForce()
 
 	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
 	{
-		m_shadowMaps[lightIndex].depthBuffer->Bind(0);
-
-		m_uboRing_SpotLight->BindBlockAsUBO(m_uboInfoSpotLight.bufferBinding, lightIndex);
+		GL_CALL(glUniform1ui, s_lightIndexUniformLocation, lightIndex);
 		GL_CALL(glDispatchComputeIndirect, 0);
 	}
 }*/
@@ -903,13 +1653,25 @@ void Renderer::LightCachesRSM()
 	m_specularEnvmap->ClearToZero();
 	m_specularEnvmap->BindImage(0, gl::Texture::ImageAccess::WRITE);
 
+	gl::ShaderObject* shaderLightCaches = m_batchedLightCaches ? m_shaderLightCachesRSMBatched.get() : m_shaderLightCachesRSM.get();
+
 	m_lightCacheCounter->BindIndirectDispatchBuffer();
-	m_shaderLightCachesRSM->BindSSBO(*m_lightCacheBuffer, "LightCacheBuffer");
-	m_shaderLightCachesRSM->BindSSBO(*m_lightCacheCounter, "LightCacheCounter");
+	shaderLightCaches->BindSSBO(*m_lightCacheBuffer, "LightCacheBuffer");
+	shaderLightCaches->BindSSBO(*m_lightCachePositionBuffer, "LightCachePositionBuffer");
+	shaderLightCaches->BindSSBO(*m_lightCacheCounter, "LightCacheCounter");
+	shaderLightCaches->BindSSBO(*m_relightCacheBuffer, "RelightCacheBuffer");
+	// See LIGHTCACHE_RESOLVE_LIGHTING in lightcache.glsl
+	bool sampledVALs = m_sampledVALs && !m_indirectShadow && !m_indirectSpecular;
+	bool resolveLighting = sampledVALs || (m_packedLightCaches && !m_batchedLightCaches);
+	if (resolveLighting)
+		shaderLightCaches->BindSSBO(*m_lightCacheScratchBuffer, "LightCacheScratchBuffer");
 
 	m_samplerNearest.BindSampler(0);
 	m_samplerLinearClamp.BindSampler(1); // filtering allowed for depthLinSq
 	m_samplerNearest.BindSampler(2);
+	m_shadowMapAtlas->GetFlux().Bind(0);
+	m_shadowMapAtlas->GetDepthLinSq().Bind(1);
+	m_shadowMapAtlas->GetNormal().Bind(2);
 
 	if (m_indirectShadow)
 	{
@@ -917,17 +1679,85 @@ void Renderer::LightCachesRSM()
 		m_voxelization->GetVoxelTexture().Bind(4);
 	}
 	
-	m_shaderLightCachesRSM->Activate();
+	// Convert the RSMs of all lights to virtual area lights once, all cache lighting workgroups stream them.
+	if (m_numVALs > 0)
+	{
+		const size_t valSizeInBytes = sizeof(float) * 8; // Needs to match VirtualAreaLight in virtualarealights.glsl
+		if (!m_valBuffer || static_cast<size_t>(m_valBuffer->GetSize()) < valSizeInBytes * m_numVALs)
+		{
+			size_t newVALCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(m_numVALs)));
+			m_valBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newVALCapacity * valSizeInBytes), gl::Buffer::IMMUTABLE);
+		}
+		m_valBuffer->BindShaderStorageBuffer(21);
+
+		m_shaderLightCachePrepareVALs->Activate();
+		GL_CALL(glDispatchCompute, (m_maxNumVALsPerLight + 63) / 64, static_cast<GLuint>(m_scene->GetLights().size()), 1);
+	}
+
+	// Build VAL trees bottom-up, one depth per dispatch.
+	bool valTree = IsVALTreeActive();
+	if ((valTree || sampledVALs) && m_numVALTreeNodes > 0)
+	{
+		const size_t valTreeNodeSizeInBytes = sizeof(float) * 16; // Needs to match VALTreeNode in valtree.glsl
+		if (!m_valTreeBuffer || static_cast<size_t>(m_valTreeBuffer->GetSize()) < valTreeNodeSizeInBytes * m_numVALTreeNodes)
+		{
+			size_t newNodeCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(m_numVALTreeNodes)));
+			m_valTreeBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newNodeCapacity * valTreeNodeSizeInBytes), gl::Buffer::IMMUTABLE);
+		}
+		m_valTreeBuffer->BindShaderStorageBuffer(22);
+
+		m_shaderLightCacheBuildVALTree->Activate();
+		for (int depth = static_cast<int>(m_maxVALTreeDepth) - 1; depth >= 0; --depth)
+		{
+			GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+			GL_CALL(glUniform1i, 0, depth);
+			GL_CALL(glDispatchCompute, ((1u << (2 * depth)) + 63) / 64, static_cast<GLuint>(m_scene->GetLights().size()), 1);
+		}
+	}
+
+	shaderLightCaches->Activate();
+	if (sampledVALs)
+	{
+		// Wraps around before the sample index loses float precision.
+		m_valSampleFrame = (m_valSampleFrame + 1) % 4096;
+		GL_CALL(glUniform1ui, 2, m_valSampleFrame);
+		GL_CALL(glUniform1ui, 3, m_valSampleBudget);
+	}
+	else if (valTree)
+	{
+		GL_CALL(glUniform1f, 1, m_valTreeErrorBound);
+		if (m_valTreeComparison)
+			CompareVALTree();
+	}
 
 	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
 
-	for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
+	// Single dispatch, skips lights with zero IndirectScale itself.
+	if (m_batchedLightCaches)
 	{
-		m_shadowMaps[lightIndex].GetFlux().Bind(0);
-		m_shadowMaps[lightIndex].GetDepthLinSq().Bind(1);
-		m_shadowMaps[lightIndex].GetNormal().Bind(2);
+		GL_CALL(glUniform1ui, 0, static_cast<GLuint>(m_scene->GetLights().size()));
+		GL_CALL(glDispatchComputeIndirect, 0);
+	}
+	else
+	{
+		for (unsigned int lightIndex = 0; lightIndex < m_scene->GetLights().size(); ++lightIndex)
+		{
+			// Skipped by the indirect light budget, see UpdateLightRSMSettings.
+			if (m_lightRSMSettings[lightIndex].indirectScale == 0.0f)
+				continue;
+
+			GL_CALL(glUniform1ui, s_lightIndexUniformLocation, lightIndex);
+			GL_CALL(glDispatchComputeIndirect, 0);
+		}
+	}
 
-		m_uboRing_SpotLight->BindBlockAsUBO(m_uboInfoSpotLight.bufferBinding, lightIndex);
+	// Writes the accumulated lighting of all lights to the caches.
+	if (resolveLighting)
+	{
+		m_shaderLightCacheResolveLighting->Activate();
+		if (sampledVALs)
+			GL_CALL(glUniform1f, 0, m_valSampleBlendFactor);
+		GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
 		GL_CALL(glDispatchComputeIndirect, 0);
 	}
 }
@@ -956,34 +1786,128 @@ void Renderer::AllocateCaches()
 	gl::Disable(gl::Cap::DEPTH_TEST);
 	gl::SetDepthWrite(false);
 
-	// Optionally read old light cache count
+	// Optionally read old light cache count. Counters of the last allocation are copied before they are cleared and arrive a few frames later.
 	if (m_readLightCacheCount)
 	{
-		const void* counterData = m_lightCacheCounter->Map(gl::Buffer::MapType::READ, gl::Buffer::MapWriteFlag::NONE);
-		m_lastNumLightCaches = reinterpret_cast<const int*>(counterData)[3];
-		m_lightCacheCounter->Unmap();
-		FrameProfiler::GetInstance().ReportValue("CacheCount", static_cast<float>(m_lastNumLightCaches));
+		const int* counterData = static_cast<const int*>(m_lightCacheCounterReadback->TryRead());
+		if (counterData)
+		{
+			m_lastNumLightCaches = counterData[3];
+			int numRelightCaches = counterData[4];
+			int numHashMapOverflows = counterData[5];
+			FrameProfiler::GetInstance().ReportValue("CacheCount", static_cast<float>(m_lastNumLightCaches));
+			if (m_lightCacheHashMapEnabled)
+				FrameProfiler::GetInstance().ReportValue("CacheHashMapOverflows", static_cast<float>(numHashMapOverflows));
+			ReportLightCacheTraffic(static_cast<unsigned int>(numRelightCaches));
+		}
+
+		GL_CALL(glMemoryBarrier, GL_BUFFER_UPDATE_BARRIER_BIT);
+		m_lightCacheCounterReadback->Copy(*m_lightCacheCounter, 0, sizeof(unsigned int) * 6);
 	}
 
+	// Caches and address volume of the last allocation become the previous ones. New caches take over the lighting of their cell (see cacheGather.comp).
+	std::swap(m_lightCacheBuffer, m_lightCacheBufferPrevious);
+	std::swap(m_CAVAtlas, m_CAVAtlasPrevious);
+	std::swap(m_lightCacheHashMap, m_lightCacheHashMapPrevious);
+
+	// Force relighting of caches around everything that changed since the last allocation.
+	bool reusePreviousCaches = m_persistentLightCaches && m_previousLightCachesValid && !m_indirectSpecular;
+	std::vector<ei::Vec4> forceRelightSpheres;
+	for (unsigned int lightIndex = 0; lightIndex < m_lightsChangedSinceCacheAllocation.size(); ++lightIndex)
+	{
+		if (!m_lightsChangedSinceCacheAllocation[lightIndex])
+			continue;
+		ei::Vec3 sphereCenter;
+		float sphereRadius;
+		ComputeSpotLightBoundingSphere(m_scene->GetLights()[lightIndex], sphereCenter, sphereRadius);
+		forceRelightSpheres.push_back(ei::Vec4(sphereCenter, sphereRadius * s_lightCacheForceRelightSphereScale));
+	}
+	const std::vector<SceneEntity>& entities = m_scene->GetEntities();
+	if (m_entityBoundingBoxesAtCacheAllocation.size() != entities.size())
+	{
+		m_entityBoundingBoxesAtCacheAllocation.resize(entities.size());
+		reusePreviousCaches = false;
+	}
+	for (size_t entityIndex = 0; entityIndex < entities.size(); ++entityIndex)
+	{
+		if (!entities[entityIndex].GetModel())
+			continue;
+		ei::Box boundingBox = entities[entityIndex].ComputeWorldBoundingBox();
+		ei::Box& lastBoundingBox = m_entityBoundingBoxesAtCacheAllocation[entityIndex];
+		if (memcmp(&boundingBox, &lastBoundingBox, sizeof(ei::Box)) == 0)
+			continue;
+
+		for (const ei::Box& box : { lastBoundingBox, boundingBox })
+			forceRelightSpheres.push_back(ei::Vec4((box.min + box.max) * 0.5f, ei::len(box.max - box.min) * 0.5f * s_lightCacheForceRelightSphereScale));
+		lastBoundingBox = boundingBox;
+	}
+	m_lightsChangedSinceCacheAllocation.assign(m_lightsChangedSinceCacheAllocation.size(), false);
+	// Too many changes are covered by larger spheres, which relights more caches but keeps the others.
+	ReduceSphereCount(forceRelightSpheres, s_maxNumLightCacheForceRelightSpheres);
+	if (m_CAVCascadeMinPrevious.size() != m_CAVCascadeMin.size())
+		reusePreviousCaches = false;
+
 	// Clear cache counter and atlas. No need to clear the cache buffer itself!
 	m_lightCacheCounter->ClearToZero();
-	m_CAVAtlas->ClearToZero(); // TODO: Consider making it int and clearing with -1, simplifying the shaders
+	if (m_lightCacheHashMapEnabled)
+		m_lightCacheHashMap->ClearToZero();
+	else
+		m_CAVAtlas->ClearToZero(); // TODO: Consider making it int and clearing with -1, simplifying the shaders
 
 	BindGBuffer();
 
-	m_shaderCacheGather->BindSSBO(*m_lightCacheCounter, "LightCacheCounter");
-	m_shaderCacheGather->BindSSBO(*m_lightCacheBuffer, "LightCacheBuffer");
-	//m_shaderCacheGather->BindSSBO(*m_lightCacheHashMap);
-	m_CAVAtlas->BindImage(0, gl::Texture::ImageAccess::READ_WRITE, gl::TextureFormat::R32UI, 0);
+	if (m_sortedCacheAllocationEnabled)
+	{
+		// Keys are either address volume atlas texels or hash map keys (see sortedcacheallocation.glsl)
+		std::uint32_t addressVolumeResolution = GetCAVResolution();
+		std::uint32_t numCellKeyValues = (addressVolumeResolution + 1) * (addressVolumeResolution + 1) * (addressVolumeResolution + 1) * GetCAVCascadeCount();
+		m_sortedCacheAllocation->SortCellKeys(numCellKeyValues);
+	}
+	gl::ShaderObject& allocationShader = m_sortedCacheAllocationEnabled ? m_sortedCacheAllocation->GetAllocationShader() : *m_shaderCacheGather;
+
+	allocationShader.BindSSBO(*m_lightCacheCounter, "LightCacheCounter");
+	allocationShader.BindSSBO(*m_lightCacheBuffer, "LightCacheBuffer");
+	allocationShader.BindSSBO(*m_lightCachePositionBuffer, "LightCachePositionBuffer");
+	allocationShader.BindSSBO(*m_lightCacheBufferPrevious, "PreviousLightCacheBuffer");
+	allocationShader.BindSSBO(*m_relightCacheBuffer, "RelightCacheBuffer");
+	if (m_lightCacheHashMapEnabled)
+	{
+		allocationShader.BindSSBO(*m_lightCacheHashMap, "LightCacheHashMapBuffer");
+		allocationShader.BindSSBO(*m_lightCacheHashMapPrevious, "PreviousLightCacheHashMapBuffer");
+	}
+	else
+	{
+		m_CAVAtlas->BindImage(0, gl::Texture::ImageAccess::READ_WRITE, gl::TextureFormat::R32UI, 0);
+		m_CAVAtlasPrevious->BindImage(1, gl::Texture::ImageAccess::READ, gl::TextureFormat::R32UI, 0);
+	}
 
-	m_shaderCacheGather->Activate();
+	allocationShader.Activate();
+	GL_CALL(glUniform1i, 0, reusePreviousCaches ? 1 : 0);
+	GL_CALL(glUniform1ui, 1, static_cast<GLuint>(ceil(1.0f / ei::clamp(m_lightCacheRelightFraction, 0.001f, 1.0f))));
+	GL_CALL(glUniform1ui, 2, m_lightCacheRelightPhase++);
+	GL_CALL(glUniform1ui, 3, reusePreviousCaches ? static_cast<GLuint>(forceRelightSpheres.size()) : 0);
+	if (reusePreviousCaches)
+	{
+		GL_CALL(glUniform3fv, 4, static_cast<GLsizei>(m_CAVCascadeMinPrevious.size()), reinterpret_cast<const float*>(m_CAVCascadeMinPrevious.data()));
+		if (!forceRelightSpheres.empty())
+			GL_CALL(glUniform4fv, 8, static_cast<GLsizei>(forceRelightSpheres.size()), reinterpret_cast<const float*>(forceRelightSpheres.data()));
+	}
+	m_CAVCascadeMinPrevious = m_CAVCascadeMin;
+	m_previousLightCachesValid = true;
 
-	const unsigned int threadsPerGroupX = 16;
-	const unsigned int threadsPerGroupY = 16;
-	unsigned numThreadGroupsX = (m_HDRBackbufferTexture->GetWidth() + threadsPerGroupX - 1) / threadsPerGroupX;
-	unsigned numThreadGroupsY = (m_HDRBackbufferTexture->GetHeight() + threadsPerGroupY - 1) / threadsPerGroupY;
-	GL_CALL(glDispatchCompute, numThreadGroupsX, numThreadGroupsY, 1);
+	if (m_sortedCacheAllocationEnabled)
+		m_sortedCacheAllocation->AllocateCaches();
+	else
+	{
+		const unsigned int threadsPerGroupX = 16;
+		const unsigned int threadsPerGroupY = 16;
+		unsigned numThreadGroupsX = (m_HDRBackbufferTexture->GetWidth() + threadsPerGroupX - 1) / threadsPerGroupX;
+		unsigned numThreadGroupsY = (m_HDRBackbufferTexture->GetHeight() + threadsPerGroupY - 1) / threadsPerGroupY;
+		GL_CALL(glDispatchCompute, numThreadGroupsX, numThreadGroupsY, 1);
+	}
 
+	if (m_lightCacheHashMapEnabled && m_validateLightCacheHashMap)
+		ValidateLightCacheHashMap();
 
 	// Write command buffer.
 	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
@@ -991,6 +1915,81 @@ void Renderer::AllocateCaches()
 	GL_CALL(glDispatchCompute, 1, 1, 1);
 }
 
+void Renderer::ValidateLightCacheHashMap()
+{
+	GL_CALL(glMemoryBarrier, GL_BUFFER_UPDATE_BARRIER_BIT);
+	std::vector<LightCacheHashMap::Entry> entries(LightCacheHashMap::ComputeSize(m_maxNumLightCaches));
+	GL_CALL(glGetNamedBufferSubData, m_lightCacheHashMap->GetInternHandle(), 0, static_cast<GLsizeiptr>(entries.size() * sizeof(LightCacheHashMap::Entry)), entries.data());
+
+	LightCacheHashMap hashMap(std::move(entries));
+	unsigned int numUnreachableKeys = hashMap.CountUnreachableKeys();
+	if (numUnreachableKeys > 0)
+		LOG_ERROR(numUnreachableKeys << " keys of the light cache hash map can not be found by the CPU reference. lightcachehashmap.glsl and LightCacheHashMap differ!");
+}
+
+bool Renderer::TestLightCacheHashMap()
+{
+	// Same size as the actual hash map, since the shader reads it from the constant UBO.
+	unsigned int hashMapSize = LightCacheHashMap::ComputeSize(m_maxNumLightCaches);
+
+	// Cells of all cascades in order, filling three quarters of the map to provoke long probe sequences.
+	int cellsPerAxis = static_cast<int>(GetCAVResolution()) + 1;
+	unsigned int numCells = GetCAVCascadeCount() * cellsPerAxis * cellsPerAxis * cellsPerAxis;
+	std::vector<std::uint32_t> keys(ei::min(hashMapSize / 4 * 3, numCells));
+	for (unsigned int i = 0; i < keys.size(); ++i)
+	{
+		ei::IVec3 cell(i % cellsPerAxis, (i / cellsPerAxis) % cellsPerAxis, (i / (cellsPerAxis * cellsPerAxis)) % cellsPerAxis);
+		int cascade = i / (cellsPerAxis * cellsPerAxis * cellsPerAxis);
+		keys[i] = LightCacheHashMap::ComputeKey(cell, cascade, cellsPerAxis - 1);
+	}
+
+	LightCacheHashMap reference(hashMapSize);
+	for (unsigned int i = 0; i < keys.size(); ++i)
+	{
+		std::uint32_t slot = reference.Insert(keys[i]);
+		if (slot != LightCacheHashMap::s_invalidSlot)
+			reference.SetValue(slot, i + 1);
+	}
+
+	gl::Buffer keyBuffer(static_cast<std::uint32_t>(keys.size() * sizeof(std::uint32_t)), gl::Buffer::IMMUTABLE, keys.data());
+	gl::Buffer hashMapBuffer(hashMapSize * static_cast<std::uint32_t>(sizeof(LightCacheHashMap::Entry)), gl::Buffer::IMMUTABLE, nullptr);
+	gl::Buffer counterBuffer(m_lightCacheCounter->GetSize(), gl::Buffer::IMMUTABLE, nullptr);
+	hashMapBuffer.ClearToZero();
+	counterBuffer.ClearToZero();
+
+	m_shaderLightCacheHashMapTest->Activate();
+	m_shaderLightCacheHashMapTest->BindSSBO(hashMapBuffer, "LightCacheHashMapBuffer");
+	m_shaderLightCacheHashMapTest->BindSSBO(counterBuffer, "LightCacheCounter");
+	keyBuffer.BindShaderStorageBuffer(24);
+	GL_CALL(glUniform1ui, 0, static_cast<GLuint>(keys.size()));
+	GL_CALL(glDispatchCompute, 1, 1, 1);
+
+	GL_CALL(glMemoryBarrier, GL_BUFFER_UPDATE_BARRIER_BIT);
+	std::vector<LightCacheHashMap::Entry> entries(hashMapSize);
+	GL_CALL(glGetNamedBufferSubData, hashMapBuffer.GetInternHandle(), 0, static_cast<GLsizeiptr>(entries.size() * sizeof(LightCacheHashMap::Entry)), entries.data());
+
+	const std::vector<LightCacheHashMap::Entry>& referenceEntries = reference.GetEntries();
+	unsigned int numMismatchingSlots = 0;
+	for (unsigned int slot = 0; slot < hashMapSize; ++slot)
+	{
+		if (entries[slot].key != referenceEntries[slot].key || entries[slot].value != referenceEntries[slot].value)
+		{
+			if (numMismatchingSlots == 0)
+				LOG_ERROR("Light cache hash map slot " << slot << " differs: GPU key " << entries[slot].key << " value " << entries[slot].value <<
+							", CPU key " << referenceEntries[slot].key << " value " << referenceEntries[slot].value);
+			++numMismatchingSlots;
+		}
+	}
+
+	if (numMismatchingSlots > 0)
+	{
+		LOG_ERROR(numMismatchingSlots << " of " << hashMapSize << " light cache hash map slots differ between GPU and CPU reference after inserting " << keys.size() << " keys.");
+		return false;
+	}
+	LOG_INFO("Light cache hash map test passed: " << keys.size() << " keys in " << hashMapSize << " slots are identical on GPU and CPU.");
+	return true;
+}
+
 void Renderer::PrepareSpecularEnvmaps()
 {
 	PROFILE_GPU_SCOPED(ProcessSpecularEnvmap);
@@ -1044,6 +2043,70 @@ void Renderer::PrepareSpecularEnvmaps()
 	GL_CALL(glColorMask, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 }
 
+void Renderer::ReportLightCacheTraffic(unsigned int numRelightCaches)
+{
+	// Stream sizes per cache, need to match lightcache.glsl
+	unsigned int numSHCoefficients = m_indirectDiffuseMode == IndirectDiffuseMode::SH2 ? 9 : 4;
+	unsigned int positionSize = m_packedLightCaches ? sizeof(std::uint32_t) : sizeof(float) * 4;
+	unsigned int irradianceSize = m_packedLightCaches ? (numSHCoefficients * 3 + 1) / 2 * sizeof(std::uint32_t) : (numSHCoefficients == 9 ? 7 : 3) * sizeof(float) * 4;
+	unsigned int scratchSize = numSHCoefficients * sizeof(float) * 4;
+
+	unsigned int numLightDispatches = 1;
+	if (!m_batchedLightCaches)
+		numLightDispatches = static_cast<unsigned int>(std::count_if(m_lightRSMSettings.begin(), m_lightRSMSettings.end(), [](const LightRSMSettings& settings) { return settings.indirectScale != 0.0f; }));
+
+	// Every light dispatch reads the position. Batched lighting writes the irradiance once, per-light dispatches accumulate it (packed: in the scratch buffer).
+	double lightingBytes = static_cast<double>(numRelightCaches) * numLightDispatches * positionSize;
+	if (m_batchedLightCaches)
+		lightingBytes += static_cast<double>(numRelightCaches) * irradianceSize;
+	else if (m_packedLightCaches)
+		lightingBytes += static_cast<double>(numRelightCaches) * ((numLightDispatches + 1) * 2 * scratchSize + irradianceSize);
+	else
+		lightingBytes += static_cast<double>(numRelightCaches) * numLightDispatches * 2 * irradianceSize;
+
+	// Trilinear interpolation of 8 caches per pixel, only the irradiance stream. Ignores cascade transitions.
+	double applyBytes = static_cast<double>(m_HDRBackbufferTexture->GetWidth()) * m_HDRBackbufferTexture->GetHeight() * 8 * irradianceSize;
+
+	FrameProfiler::GetInstance().ReportValue("CacheBytesLighting", static_cast<float>(lightingBytes));
+	FrameProfiler::GetInstance().ReportValue("CacheBytesApply", static_cast<float>(applyBytes));
+}
+
+void Renderer::CompareVALTree()
+{
+	const std::uint32_t comparisonSizeInBytes = sizeof(std::uint32_t) * 6; // Needs to match VALTreeComparisonBuffer in cacheLightingRSM.comp
+	const double fixedPointScale = 4096.0; // Needs to match VAL_TREE_COMPARISON_FIXED_POINT_SCALE in cacheLightingRSM.comp
+	if (!m_valTreeComparisonBuffer)
+	{
+		m_valTreeComparisonBuffer = std::make_unique<gl::Buffer>(comparisonSizeInBytes, gl::Buffer::IMMUTABLE, nullptr);
+		m_valTreeComparisonReadback = std::make_unique<ReadbackRing>(comparisonSizeInBytes);
+		m_valTreeComparisonWritten = false;
+	}
+
+	// Read result of an earlier frame, queue the last frame's result.
+	const std::uint32_t* comparisonData = static_cast<const std::uint32_t*>(m_valTreeComparisonReadback->TryRead());
+	if (comparisonData && comparisonData[0] > 0)
+	{
+		double errorSum = (static_cast<double>(comparisonData[3]) * 4294967296.0 + comparisonData[2]) / fixedPointScale;
+		double referenceSum = (static_cast<double>(comparisonData[5]) * 4294967296.0 + comparisonData[4]) / fixedPointScale;
+		float maxError;
+		memcpy(&maxError, &comparisonData[1], sizeof(float));
+
+		m_lastVALTreeMeanError = static_cast<float>(errorSum / comparisonData[0]);
+		m_lastVALTreeMaxError = maxError;
+		FrameProfiler::GetInstance().ReportValue("VALTreeMeanError", m_lastVALTreeMeanError);
+		FrameProfiler::GetInstance().ReportValue("VALTreeMaxError", m_lastVALTreeMaxError);
+		FrameProfiler::GetInstance().ReportValue("VALTreeMeanIrradiance", static_cast<float>(referenceSum / comparisonData[0]));
+	}
+	if (m_valTreeComparisonWritten)
+	{
+		GL_CALL(glMemoryBarrier, GL_BUFFER_UPDATE_BARRIER_BIT);
+		m_valTreeComparisonReadback->Copy(*m_valTreeComparisonBuffer, 0, comparisonSizeInBytes);
+	}
+	m_valTreeComparisonBuffer->ClearToZero();
+	m_valTreeComparisonBuffer->BindShaderStorageBuffer(25);
+	m_valTreeComparisonWritten = true;
+}
+
 void Renderer::ApplyCaches()
 {
 	PROFILE_GPU_SCOPED(ApplyCaches);
@@ -1055,11 +2118,15 @@ void Renderer::ApplyCaches()
 	BindGBuffer();
 
 
-	//m_shaderCacheApply->BindSSBO(*m_lightCacheHashMap);
 	m_shaderCacheApply->BindSSBO(*m_lightCacheBuffer, "LightCacheBuffer");
 
-	m_CAVAtlas->Bind(4);
-	m_samplerNearest.BindSampler(4);
+	if (m_lightCacheHashMapEnabled)
+		m_shaderCacheApply->BindSSBO(*m_lightCacheHashMap, "LightCacheHashMapBuffer");
+	else
+	{
+		m_CAVAtlas->Bind(4);
+		m_samplerNearest.BindSampler(4);
+	}
 
 	/*if (m_indirectShadow)
 	{
@@ -1078,7 +2145,7 @@ void Renderer::ApplyCaches()
 	gl::Disable(gl::Cap::BLEND);
 }
 
-void Renderer::DrawScene(bool setTextures, SceneDrawSubset drawSubset)
+void Renderer::DrawScene(const std::vector<InstanceBatch>& batches, bool setTextures, SceneDrawSubset drawSubset, bool indirectDraw)
 {
 	Model::BindVAO();
 
@@ -1096,16 +2163,17 @@ void Renderer::DrawScene(bool setTextures, SceneDrawSubset drawSubset)
 	else if (drawSubset == SceneDrawSubset::ALPHATESTED_ONLY)
 		m_samplerLinearRepeat.BindSampler(0);
 
-	for (unsigned int entityIndex =0; entityIndex < m_scene->GetEntities().size(); ++entityIndex)
-	{
-		const SceneEntity& entity = m_scene->GetEntities()[entityIndex];
-		if (!entity.GetModel())
-			continue;
+	if (!indirectDraw)
+		BindInstanceBuffer();
 
-		BindObjectUBO(entityIndex);
-		entity.GetModel()->BindBuffers();
-		for (const Model::Mesh& mesh : entity.GetModel()->GetMeshes())
+	unsigned int drawCommandIndex = 0;
+	for (const InstanceBatch& batch : batches)
+	{
+		batch.model->BindBuffers();
+		for (const Model::Mesh& mesh : batch.model->GetMeshes())
 		{
+			unsigned int meshDrawCommandIndex = drawCommandIndex++;
+
 			Assert(mesh.diffuse, "Mesh has no diffuse texture. This is not supported by the renderer.");
 			Assert(mesh.normalmap, "Mesh has no normal map. This is not supported by the renderer.");
 			Assert(mesh.roughnessMetallic, "Mesh has no roughnessMetallic map. This is not supported by the renderer.");
@@ -1137,18 +2205,150 @@ void Renderer::DrawScene(bool setTextures, SceneDrawSubset drawSubset)
 				mesh.diffuse->Bind(0);
 
 
-			GL_CALL(glDrawElements, GL_TRIANGLES, mesh.numIndices, GL_UNSIGNED_INT, reinterpret_cast<const void*>(sizeof(std::uint32_t) * mesh.startIndex));
+			if (indirectDraw)
+			{
+				GL_CALL(glDrawElementsIndirect, GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(sizeof(std::uint32_t) * 5 * meshDrawCommandIndex));
+			}
+			else
+			{
+				GL_CALL(glDrawElementsInstancedBaseInstance, GL_TRIANGLES, mesh.numIndices, GL_UNSIGNED_INT, reinterpret_cast<const void*>(sizeof(std::uint32_t) * mesh.startIndex),
+							batch.instanceCount, batch.firstInstance);
+			}
 		}
 	}
 }
 
+void Renderer::DrawSceneToGBufferViaVisibilityBuffer()
+{
+	if (!m_visibilityBuffer->PrepareDraws(m_instanceBatches, m_instanceBatchesCamera, m_instanceIndices))
+	{
+		DrawSceneToGBuffer();
+		return;
+	}
+
+	gl::Enable(gl::Cap::DEPTH_TEST);
+	gl::SetDepthWrite(true);
+
+	m_samplerLinearRepeat.BindSampler(0);
+	BindInstanceBuffer();
+
+	{
+		PROFILE_GPU_SCOPED(DrawSceneToVisibilityBuffer);
+		m_visibilityBuffer->Draw(m_instanceBatchesCamera);
+	}
+	{
+		PROFILE_GPU_SCOPED(ResolveVisibilityBuffer);
+		m_GBuffer->Bind(false);
+		GL_CALL(glClear, GL_COLOR_BUFFER_BIT);
+		m_visibilityBuffer->Resolve(*m_screenTriangle);
+	}
+}
+
+void Renderer::DrawSceneDepthPrepass(const std::vector<InstanceBatch>& batches, bool indirectDraw)
+{
+	// Opaque meshes need only positions.
+	m_shaderDepthPrepass[(int)ShaderAlphaTest::OFF]->Activate();
+	Model::BindPositionOnlyVAO();
+	if (!indirectDraw)
+		BindInstanceBuffer();
+
+	unsigned int drawCommandIndex = 0;
+	for (const InstanceBatch& batch : batches)
+	{
+		batch.model->BindPositionOnlyBuffers();
+		for (const Model::Mesh& mesh : batch.model->GetMeshes())
+		{
+			unsigned int meshDrawCommandIndex = drawCommandIndex++;
+			if (mesh.alphaTesting)
+				continue;
+
+			if (mesh.doubleSided)
+				gl::Disable(gl::Cap::CULL_FACE);
+			else
+				gl::Enable(gl::Cap::CULL_FACE);
+
+			if (indirectDraw)
+			{
+				GL_CALL(glDrawElementsIndirect, GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(sizeof(std::uint32_t) * 5 * meshDrawCommandIndex));
+			}
+			else
+			{
+				GL_CALL(glDrawElementsInstancedBaseInstance, GL_TRIANGLES, mesh.numIndices, GL_UNSIGNED_INT, reinterpret_cast<const void*>(sizeof(std::uint32_t) * mesh.startIndex),
+							batch.instanceCount, batch.firstInstance);
+			}
+		}
+	}
+
+	// Alpha tested meshes need texture coordinates and the diffuse texture.
+	m_shaderDepthPrepass[(int)ShaderAlphaTest::ON]->Activate();
+	DrawScene(batches, false, SceneDrawSubset::ALPHATESTED_ONLY, indirectDraw);
+}
+
+void Renderer::SetPretransformedVertices(bool enabled)
+{
+	if (m_pretransformedVertices == enabled)
+		return;
+
+	m_pretransformedVertices = enabled;
+	ReloadGeometryShaders();
+}
+
+void Renderer::SetRSMCaching(bool enabled)
+{
+	m_rsmCaching = enabled;
+	if (!enabled)
+		m_numSkippedRSMs = 0;
+}
+
+void Renderer::SetMultiViewRSM(bool enabled)
+{
+	if (enabled && !m_multiViewRSM->IsSupported())
+	{
+		LOG_ERROR("Multi view RSM rendering is not supported on this device!");
+		return;
+	}
+	m_multiViewRSMEnabled = enabled;
+}
+
+void Renderer::SetVisibilityBuffer(bool enabled)
+{
+	if (enabled && !m_visibilityBuffer->IsSupported())
+	{
+		LOG_WARNING("Visibility buffer rendering is not supported on this device!");
+		return;
+	}
+	m_visibilityBufferEnabled = enabled;
+}
+
+void Renderer::SetRSMComputeDownsample(bool enabled)
+{
+	if (enabled && !m_shadowMapAtlas->IsComputeDownsampleSupported())
+	{
+		LOG_ERROR("Compute RSM downsampling is not supported on this device!");
+		return;
+	}
+	m_rsmComputeDownsample = enabled;
+}
+
+void Renderer::SetOcclusionCulling(bool enabled)
+{
+	m_occlusionCullingEnabled = enabled;
+	m_occlusionCulling->ResetHistory();
+}
+
+unsigned int Renderer::GetOcclusionCulledCount() const
+{
+	return m_occlusionCulling->GetLastNumOcclusionCulled();
+}
+
 void Renderer::SetReadLightCacheCount(bool trackLightCacheHashCollisionCount)
 {
 	m_readLightCacheCount = trackLightCacheHashCollisionCount;
-	gl::Buffer::UsageFlag usageFlag = gl::Buffer::IMMUTABLE;
+	m_lightCacheCounter = std::make_unique<gl::Buffer>(sizeof(unsigned int) * 6, gl::Buffer::IMMUTABLE, nullptr);
 	if (trackLightCacheHashCollisionCount)
-		usageFlag = gl::Buffer::MAP_READ;
-	m_lightCacheCounter = std::make_unique<gl::Buffer>(sizeof(unsigned int) * 4, usageFlag, nullptr);
+		m_lightCacheCounterReadback = std::make_unique<ReadbackRing>(static_cast<std::uint32_t>(sizeof(unsigned int) * 6));
+	else
+		m_lightCacheCounterReadback.reset();
 	m_lastNumLightCaches = 0;
 }
 
@@ -1177,6 +2377,8 @@ void Renderer::SetCAVCascades(unsigned int numCascades, unsigned int resolutionP
 	Assert(numCascades <= s_maxNumCAVCascades, "Maximum number of cascades exceeded!");
 
 	m_CAVAtlas = std::make_unique<gl::Texture3D>(numCascades * resolutionPerCascade, resolutionPerCascade, resolutionPerCascade, gl::TextureFormat::R32UI);
+	m_CAVAtlasPrevious = std::make_unique<gl::Texture3D>(numCascades * resolutionPerCascade, resolutionPerCascade, resolutionPerCascade, gl::TextureFormat::R32UI);
+	m_previousLightCachesValid = false;
 	
 	// Fill in new voxel sizes if necessary.
 	size_t previousSize = m_CAVCascadeWorldSize.size();
@@ -1203,6 +2405,7 @@ void Renderer::SetCAVCascadeWorldSize(unsigned int cascade, float voxelWorldSize
 	}*/
 
 	m_CAVCascadeWorldSize[cascade] = voxelWorldSize;
+	m_previousLightCachesValid = false;
 }
 
 void Renderer::SetCAVCascadeTransitionSize(float transitionZoneSize)
@@ -1232,113 +2435,4 @@ void Renderer::SaveToPFM(const std::string& filename) const
 	m_HDRBackbufferTexture->ReadImage(0, gl::TextureReadFormat::RGBA, gl::TextureReadType::FLOAT, m_HDRBackbufferTexture->GetWidth() * m_HDRBackbufferTexture->GetHeight() * sizeof(ei::Vec4), imageData.get());
 	if (WritePfm(imageData.get(), ei::IVec2(m_HDRBackbufferTexture->GetWidth(), m_HDRBackbufferTexture->GetHeight()), filename))
 		LOG_INFO("Wrote screenshot \"" + filename + "\"");
-}
-
-
-
-
-
-AutoReloadShaderPtr Renderer::ShadowMap::m_shaderRSMDownSample;
-
-Renderer::ShadowMap::ShadowMap(ShadowMap& old) :
-	rsmFBOs(old.rsmFBOs),
-
-	flux(old.flux),
-	normal(old.normal),
-	depthLinSq(old.depthLinSq),
-	depthBuffer(old.depthBuffer)
-{
-	old.rsmFBOs.clear();
-
-	old.flux = nullptr;
-	old.normal = nullptr;
-	old.depthLinSq = nullptr;
-	old.depthBuffer = nullptr;
-}
-Renderer::ShadowMap::ShadowMap() :
-	flux(nullptr),
-	normal(nullptr),
-	depthLinSq(nullptr),
-	depthBuffer(nullptr)
-{}
-
-void Renderer::ShadowMap::DeInit()
-{
-	for (gl::FramebufferObject* fbo : rsmFBOs)
-	{
-		SAFE_DELETE(fbo);
-	}
-	rsmFBOs.clear();
-
-	SAFE_DELETE(flux);
-	SAFE_DELETE(normal);
-	SAFE_DELETE(depthLinSq);
-	SAFE_DELETE(depthBuffer);
-}
-
-void Renderer::ShadowMap::Init(unsigned int rsmResolution)
-{
-	if (flux != nullptr && rsmResolution == flux->GetWidth())
-	{
-		return;
-	}
-
-	DeInit();
-
-	flux = new gl::Texture2D(rsmResolution, rsmResolution, gl::TextureFormat::RGB16F, 0, 0); // R11G11B10 was not sufficient for downsampling ops
-	normal = new gl::Texture2D(rsmResolution, rsmResolution, gl::TextureFormat::RG16I, 0, 0);
-	depthLinSq = new gl::Texture2D(rsmResolution, rsmResolution, gl::TextureFormat::RG16F, 0, 0);
-	depthBuffer = new gl::Texture2D(rsmResolution, rsmResolution, gl::TextureFormat::DEPTH_COMPONENT32F, 1, 0);
-
-	rsmFBOs.push_back(new gl::FramebufferObject({ gl::FramebufferObject::Attachment(flux), gl::FramebufferObject::Attachment(normal), gl::FramebufferObject::Attachment(depthLinSq) }, gl::FramebufferObject::Attachment(depthBuffer)));
-	for (int i = 1; i < log2(rsmResolution); ++i)
-	{
-		rsmFBOs.push_back(new gl::FramebufferObject({ gl::FramebufferObject::Attachment(flux, i), gl::FramebufferObject::Attachment(normal, i), gl::FramebufferObject::Attachment(depthLinSq, i) }));
-	}	
-}
-
-void Renderer::ShadowMap::PrepareRSM(const gl::ScreenAlignedTriangle& screenTri)
-{	
-	if (m_shaderRSMDownSample.get() == nullptr)
-	{
-		m_shaderRSMDownSample = new gl::ShaderObject("RSM downsample");
-		m_shaderRSMDownSample->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/screenTri.vert");
-		m_shaderRSMDownSample->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/downsamplersm.frag");
-		m_shaderRSMDownSample->CreateProgram();
-	}
-
-	gl::Disable(gl::Cap::DEPTH_TEST);
-	gl::Disable(gl::Cap::CULL_FACE);
-	gl::SetDepthWrite(false);
-	m_shaderRSMDownSample->Activate();
-
-	const auto& samplerLinearClamp = gl::SamplerObject::GetSamplerObject(gl::SamplerObject::Desc(gl::SamplerObject::Filter::LINEAR, gl::SamplerObject::Filter::LINEAR, gl::SamplerObject::Filter::LINEAR,
-		gl::SamplerObject::Border::CLAMP));
-	const auto& samplerNearestClamp = gl::SamplerObject::GetSamplerObject(gl::SamplerObject::Desc(gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST,
-		gl::SamplerObject::Border::CLAMP));
-
-
-	GetFlux().Bind(0);
-	samplerNearestClamp.BindSampler(0);
-	GetNormal().Bind(1);
-	samplerNearestClamp.BindSampler(1);
-	GetDepthLinSq().Bind(2);
-	samplerLinearClamp.BindSampler(2);
-
-	for (int i = 1; i < rsmFBOs.size(); ++i)
-	{
-		GL_CALL(glTextureParameteri, GetFlux().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, i - 1);
-		GL_CALL(glTextureParameteri, GetNormal().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, i - 1);
-		GL_CALL(glTextureParameteri, GetDepthLinSq().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, i - 1);
-
-		rsmFBOs[i]->Bind(true);
-		GL_CALL(glClear, GL_COLOR_BUFFER_BIT);
-
-		screenTri.Draw();
-	}
-}
-
-void Renderer::ShadowMap::BindFBO_RSM()
-{
-	rsmFBOs[0]->Bind(true);
 }
\ No newline at end of file
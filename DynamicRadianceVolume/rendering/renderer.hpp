@@ -3,9 +3,11 @@
 #include <memory>
 #include <vector>
 #include <ei/vector.hpp>
+#include <ei/3dtypes.hpp>
 #include "camera/camera.hpp"
 #include "../shaderreload/autoreloadshaderptr.hpp"
 
+#include <glhelper/gl.hpp>
 #include <glhelper/shaderdatametainfo.hpp>
 #include <algorithm>
 
@@ -18,12 +20,18 @@ namespace gl
 	class Texture2D;
 	class Texture3D;
 	class SamplerObject;
-	class PersistentRingBuffer;
 	class Buffer;
 }
 class Scene;
 class SceneEntity;
 class Voxelization;
+class OcclusionCulling;
+class VisibilityBuffer;
+class ClusteredShading;
+class ShadowMapAtlas;
+class MultiViewRSM;
+class SortedCacheAllocation;
+class ReadbackRing;
 class Model;
 
 typedef std::unique_ptr<gl::Texture2D> Texture2DPtr;
@@ -80,6 +88,116 @@ public:
 	void SetIndirectSpecular(bool active)	{ m_indirectSpecular = active; ReloadLightingSettingDependentCacheShader(); }
 	bool GetIndirectSpecular() const		{ return m_indirectSpecular; }
 
+	/// Activates/deactivates hierarchical z-buffer occlusion culling for the gbuffer pass.
+	void SetOcclusionCulling(bool enabled);
+	bool GetOcclusionCulling() const		{ return m_occlusionCullingEnabled; }
+	/// Activates/deactivates depth only pass before the gbuffer is filled.
+	void SetDepthPrepass(bool enabled)		{ m_depthPrepass = enabled; }
+	bool GetDepthPrepass() const			{ return m_depthPrepass; }
+	/// Number of meshes (counting all instances) that were culled by occlusion culling in the last frame.
+	unsigned int GetOcclusionCulledCount() const;
+	/// Fills the gbuffer via a visibility buffer instead of rasterizing all attributes directly.
+	///
+	/// Occlusion culling and depth prepass are not used in this mode. Needs GL_ARB_bindless_texture.
+	/// Falls back to the ordinary gbuffer pass in frames with more draws than the visibility buffer can address.
+	void SetVisibilityBuffer(bool enabled);
+	bool GetVisibilityBuffer() const		{ return m_visibilityBufferEnabled; }
+	/// Activates/deactivates compute pass that transforms and deforms all vertices once per frame (see deformedvertices.glsl).
+	///
+	/// All geometry passes read the deformed vertices instead of evaluating the deformation on their own.
+	void SetPretransformedVertices(bool enabled);
+	bool GetPretransformedVertices() const	{ return m_pretransformedVertices; }
+	/// Declares that WorldPosDeform/NormalDeform in meshdeform.glsl depend on PassedTime.
+	///
+	/// RSM caching can not see the deformation, it re-renders all RSMs every frame if this is set.
+	void SetTimeDependentMeshDeformation(bool enabled)	{ m_timeDependentMeshDeformation = enabled; }
+	bool GetTimeDependentMeshDeformation() const		{ return m_timeDependentMeshDeformation; }
+	/// Activates/deactivates clustered shading for direct lighting.
+	///
+	/// All lights are evaluated in a single full-screen pass that only considers the lights assigned to each pixel's cluster.
+	void SetClusteredShading(bool enabled)	{ m_clusteredShadingEnabled = enabled; }
+	bool GetClusteredShading() const		{ return m_clusteredShadingEnabled; }
+	/// Activates/deactivates stencil marked spot light cones instead of full-screen passes for direct lighting.
+	///
+	/// Has no effect if clustered shading is active.
+	void SetLightVolumes(bool enabled)		{ m_lightVolumes = enabled; }
+	bool GetLightVolumes() const			{ return m_lightVolumes; }
+	/// Activates/deactivates reuse of RSMs whose light and shadow casters did not change since they were last rendered.
+	///
+	/// Time dependent deformations in meshdeform.glsl need to be declared with SetTimeDependentMeshDeformation.
+	void SetRSMCaching(bool enabled);
+	bool GetRSMCaching() const				{ return m_rsmCaching; }
+	/// Number of lights whose RSM was reused in the last frame.
+	unsigned int GetNumSkippedRSMs() const	{ return m_numSkippedRSMs; }
+	/// Activates/deactivates rendering the RSMs of several lights with a single geometry submission, using GPU culling and one viewport per light.
+	///
+	/// Can not be activated if GL_ARB_shader_viewport_layer_array is not supported.
+	void SetMultiViewRSM(bool enabled);
+	bool GetMultiViewRSM() const			{ return m_multiViewRSMEnabled; }
+	/// Activates/deactivates generation of all RSM mip levels with a single compute dispatch instead of a fragment pass per level.
+	///
+	/// Can not be activated if GL_ARB_bindless_texture is not supported.
+	void SetRSMComputeDownsample(bool enabled);
+	bool GetRSMComputeDownsample() const		{ return m_rsmComputeDownsample; }
+	/// Activates/deactivates per frame choice of RSM resolution and read lods for every light.
+	///
+	/// Lights with small influence on the view or low flux compared to the brightest light get smaller RSMs and fewer VALs.
+	/// The settings of a light act as upper bound.
+	void SetAdaptiveRSMResolution(bool enabled)	{ m_adaptiveRSMResolution = enabled; }
+	bool GetAdaptiveRSMResolution() const		{ return m_adaptiveRSMResolution; }
+	/// Importance threshold for indirect lighting of light caches, relative to the most important light. Zero lights caches with every light.
+	///
+	/// Importance estimates flux, view coverage and distance to the cache volume. Lights below the threshold are read from the next coarser RSM level,
+	/// lights below a quarter of the threshold are skipped randomly and rescaled, so that their contribution is preserved on average.
+	/// Random skipping is disabled while persistent light caches are not relit every frame (see SetLightCacheRelightFraction), since it would not average out.
+	void SetIndirectLightImportanceThreshold(float threshold)	{ m_indirectLightImportanceThreshold = threshold; }
+	float GetIndirectLightImportanceThreshold() const			{ return m_indirectLightImportanceThreshold; }
+	/// Activates/deactivates lighting of light caches with all lights in a single dispatch.
+	///
+	/// Accumulates all lights in registers and writes every cache once, instead of one dispatch with read-modify-write of every cache per light.
+	void SetBatchedLightCaches(bool enabled)	{ m_batchedLightCaches = enabled; }
+	bool GetBatchedLightCaches() const			{ return m_batchedLightCaches; }
+	/// Activates/deactivates lighting of light caches via per-light trees of virtual area lights (lightcuts style, see valtree.glsl).
+	///
+	/// Every cache evaluates the coarsest tree nodes whose relative size and normal spread are below the error bound, instead of every RSM texel.
+	/// An error bound of zero gives the same result as evaluating all VALs.
+	/// Not used (with a warning) while indirect shadow or indirect specular is active.
+	void SetVALTree(bool enabled)				{ m_valTreeEnabled = enabled; ReloadLightingSettingDependentCacheShader(); }
+	bool GetVALTree() const						{ return m_valTreeEnabled; }
+	void SetVALTreeErrorBound(float errorBound)	{ m_valTreeErrorBound = errorBound; }
+	float GetVALTreeErrorBound() const			{ return m_valTreeErrorBound; }
+	/// True if VAL trees are enabled and actually used, i.e. neither indirect shadow nor indirect specular is active.
+	bool IsVALTreeActive() const				{ return m_valTreeEnabled && !m_indirectShadow && !m_indirectSpecular; }
+	/// Evaluates all VALs in addition to the VAL trees and compares the irradiance of every relit cache (see cacheLightingRSM.comp).
+	///
+	/// Mean and maximum absolute difference as well as the mean reference irradiance are reported to the FrameProfiler and arrive a few frames late.
+	/// Costs a full brute force lighting on top, for quality evaluation only. Has no effect if the VAL tree is not active or sampled VALs are used.
+	void SetVALTreeComparison(bool enabled)		{ m_valTreeComparison = enabled; ReloadLightingSettingDependentCacheShader(); }
+	bool GetVALTreeComparison() const			{ return m_valTreeComparison; }
+	float GetLastVALTreeMeanError() const		{ return m_lastVALTreeMeanError; }
+	float GetLastVALTreeMaxError() const		{ return m_lastVALTreeMaxError; }
+	/// Activates/deactivates lighting of light caches with a fixed number of importance sampled VALs per light.
+	///
+	/// VALs are drawn proportional to their flux by descending the VAL trees with a low discrepancy (R2) sequence, so the cost per cache does not depend on the RSM resolution.
+	/// Every cache is relit every frame and blended with its lighting of the last frame (exponential moving average), caches around changed lights and entities restart.
+	/// Without persistent light caches every frame restarts. Not used (with a warning) while indirect shadow or indirect specular is active.
+	void SetSampledVALs(bool enabled)					{ m_sampledVALs = enabled; ReloadLightingSettingDependentCacheShader(); }
+	bool GetSampledVALs() const							{ return m_sampledVALs; }
+	void SetVALSampleBudget(unsigned int numSamples)	{ m_valSampleBudget = numSamples; }
+	unsigned int GetVALSampleBudget() const				{ return m_valSampleBudget; }
+	/// Weight of the current frame in the exponential moving average of SetSampledVALs.
+	void SetVALSampleBlendFactor(float blendFactor)		{ m_valSampleBlendFactor = blendFactor; }
+	float GetVALSampleBlendFactor() const				{ return m_valSampleBlendFactor; }
+	/// Activates/deactivates persistent light caches.
+	///
+	/// Caches keep the lighting of their world space cell from the last frame. Only new caches, caches close to changed lights or entities
+	/// and a round-robin fraction of all others are relit. Has no effect with indirect specular, since the specular envmaps are view dependent.
+	void SetPersistentLightCaches(bool enabled)	{ m_persistentLightCaches = enabled; m_previousLightCachesValid = false; }
+	bool GetPersistentLightCaches() const		{ return m_persistentLightCaches; }
+	/// Fraction of the persistent light caches that is relit every frame regardless of changes.
+	void SetLightCacheRelightFraction(float fraction)	{ m_lightCacheRelightFraction = fraction; }
+	float GetLightCacheRelightFraction() const			{ return m_lightCacheRelightFraction; }
+
 
 	void SetVoxelVolumeResultion(unsigned int resolution);
 	unsigned int GetVoxelVolumeResultion() const;
@@ -117,7 +235,8 @@ public:
 	const std::shared_ptr<const Scene>& GetScene() const { return m_scene; }
 
 	/// Enables/Disables tracking of current light cache count.
-	/// \attention Tracking can seriously hurt the overall performance! 
+	///
+	/// Counters are read back without stalling via ReadbackRing, the reported values are therefore a few frames old.
 	void SetReadLightCacheCount(bool trackLightCacheCreationStats);
 	bool GetReadLightCacheCount() const;
 	unsigned int GetLightCacheActiveCount() const;
@@ -134,6 +253,32 @@ public:
 	void SetShowCAVCascades(bool show)							{ m_showCAVCascades = show; ReloadLightingSettingDependentCacheShader(); }
 	float GetCAVCascadeTransitionSize() const					{ return m_CAVCascadeTransitionSize; }
 	void SetCAVCascadeTransitionSize(float transitionZoneSize); ///< A value of zero transition means off.
+	/// Uses an open addressing hash map (see lightcachehashmap.glsl) instead of the dense address volume texture to find the caches of a cell.
+	///
+	/// The hash map is sized by the maximum cache count. Cells that do not fit are left without cache and are skipped during cache application.
+	bool GetLightCacheHashMap() const							{ return m_lightCacheHashMapEnabled; }
+	void SetLightCacheHashMap(bool enabled)						{ m_lightCacheHashMapEnabled = enabled; ReloadLightingSettingDependentCacheShader(); }
+	/// Reads back the light cache hash map after every allocation and checks that the CPU reference lookup (LightCacheHashMap) finds every stored key. Logs an error on mismatch.
+	/// \attention Synchronous readback, for debugging only!
+	bool GetValidateLightCacheHashMap() const					{ return m_validateLightCacheHashMap; }
+	void SetValidateLightCacheHashMap(bool validate)			{ m_validateLightCacheHashMap = validate; }
+	/// Inserts a fixed key set on the GPU (lightcachehashmaptest.comp) and with the CPU reference (LightCacheHashMap) and compares both tables slot by slot.
+	///
+	/// Insertion happens in a single invocation, so the result is deterministic and needs to match exactly. Logs the result.
+	/// \attention Synchronous readback, for debugging only!
+	/// \return
+	///		True if both tables are identical.
+	bool TestLightCacheHashMap();
+	/// Allocates caches by sorting the cells of all pixels instead of atomic operations in cacheGather.comp, see SortedCacheAllocation.
+	///
+	/// Gives a deterministic, spatially sorted cache list.
+	bool GetSortedCacheAllocation() const						{ return m_sortedCacheAllocationEnabled; }
+	void SetSortedCacheAllocation(bool enabled)					{ m_sortedCacheAllocationEnabled = enabled; }
+	/// Stores caches with an implicit position and half float SH coefficients (see lightcache.glsl), which roughly halves cache memory traffic.
+	///
+	/// Without batched light caches the lighting of all lights is accumulated in a full precision scratch buffer and packed afterwards.
+	bool GetPackedLightCaches() const							{ return m_packedLightCaches; }
+	void SetPackedLightCaches(bool enabled)						{ m_packedLightCaches = enabled; ReloadLightingSettingDependentCacheShader(); }
 
 	float GetExposure() const { return m_tonemapExposure; }
 	void SetExposure(float exposure);
@@ -141,7 +286,18 @@ public:
 	void SetTonemapLMax(float tonemapLMax);
 
 
-	void BindObjectUBO(unsigned int objectIndex);
+	/// Consecutive range in the instance index buffer. All referenced instances share the same model.
+	struct InstanceBatch
+	{
+		Model* model;
+		unsigned int firstInstance;
+		unsigned int instanceCount;
+	};
+	/// Unculled instance batches of the current frame, one per model in the scene.
+	const std::vector<InstanceBatch>& GetInstanceBatches() const { return m_instanceBatches; }
+
+	/// Binds the instance buffer of the current frame. See instancedata.glsl
+	void BindInstanceBuffer();
 
 	static const unsigned int s_maxNumCAVCascades = 4; ///< see globalubos.glsl
 
@@ -151,6 +307,8 @@ private:
 	void LoadAllShaders();
 	/// Reloads several cache related shaders that have macros depending on the current configuration.
 	void ReloadLightingSettingDependentCacheShader();
+	/// Reloads all shaders that transform scene geometry, including those of submodules.
+	void ReloadGeometryShaders();
 
 	/// Allocates cache buffer and cache specular envmap according to the current configuration.
 	///
@@ -167,8 +325,19 @@ private:
 	/// Updates ubo with Voxel/CAV data.
 	void UpdateVolumeUBO(const Camera& camera);
 
-	void UpdatePerObjectUBORingBuffer();
+	/// Writes world matrices of all entities to the instance buffer (grows on demand) and builds instance batches.
+	///
+	/// Besides the unculled batches, there is a list of batches for the camera frustum and one for every light, using the scene's BVH.
+	void UpdateInstanceBuffer(const Camera& camera);
+	/// Sorts the given entities by model, appends them to m_instanceIndices and writes the according batches.
+	void AppendInstanceBatches(std::vector<unsigned int>& entityIndices, std::vector<InstanceBatch>& outBatches);
+	/// Fills deformed vertex buffer for all entities. See SetPretransformedVertices.
+	void DeformVertices();
+	/// Chooses RSM resolution and read lods of every light. See SetAdaptiveRSMResolution.
+	void UpdateLightRSMSettings(const Camera& camera);
 	void PrepareLights();
+	/// Hash over everything that affects the RSM of the given light: Light parameters and model and transformation of every entity in its cone.
+	std::uint64_t ComputeRSMSignature(unsigned int lightIndex) const;
 
 	void PrepareSpecularEnvmaps();
 
@@ -177,14 +346,22 @@ private:
 
 	/// Fills GBuffer.
 	void DrawSceneToGBuffer();
+	/// Fills GBuffer by resolving a visibility buffer. Alternative to DrawSceneToGBuffer.
+	void DrawSceneToGBufferViaVisibilityBuffer();
 	/// Fills shadow maps.
 	void DrawShadowMaps();
+	/// Fills shadow maps of the given lights in as few geometry passes as possible. See SetMultiViewRSM.
+	void DrawShadowMapsMultiView(const std::vector<unsigned int>& lightIndices);
 
 	/// Draws GBuffer directly to the (hardware) backbuffer.
 	void DrawGBufferDebug();
 
 	/// Performs direct lighting for all lights.
 	void ApplyDirectLighting();
+	/// Direct lighting with one stencil marked cone per light.
+	void ApplyDirectLightingLightVolumes();
+	/// Direct lighting via clustered shading module.
+	void ApplyDirectLightingClustered();
 
 	void ApplyRSMsBruteForce();
 
@@ -192,6 +369,12 @@ private:
 
 	void AllocateCaches();
 	void ApplyCaches();
+	/// Reports the estimated bytes of cache data fetched by cache lighting and application to the FrameProfiler.
+	void ReportLightCacheTraffic(unsigned int numRelightCaches);
+	/// See SetValidateLightCacheHashMap.
+	void ValidateLightCacheHashMap();
+	/// Reports the irradiance differences of an earlier frame and binds a cleared VALTreeComparisonBuffer for the next cache lighting. See SetVALTreeComparison.
+	void CompareVALTree();
 
 	/// Applies direct light to caches (mainly for debug purposes)
 	//void LightCachesDirect();
@@ -209,11 +392,17 @@ private:
 		FULLOPAQUE_ONLY
 	};
 
-	/// Draws scene, mesh by mesh.
+	/// Draws scene, mesh by mesh with one instanced draw for all entities sharing a model.
 	///
-	/// Does set VAO, VBO and index buffers but nothing else. No culling!
-	/// This method is super simplistic since it is assumed that there are not many meshes!
-	void DrawScene(bool setTextures, SceneDrawSubset drawSubset = SceneDrawSubset::ALL);
+	/// Does set VAO, VBO, index and instance buffers but nothing else. Culling is up to the given batch list.
+	/// \param indirectDraw
+	///		If true, every mesh is drawn with the indirect draw command at the index of the mesh within all batches and meshes.
+	///		Neither the indirect buffer nor the instance buffers are bound in this case.
+	void DrawScene(const std::vector<InstanceBatch>& batches, bool setTextures, SceneDrawSubset drawSubset = SceneDrawSubset::ALL, bool indirectDraw = false);
+	/// Draws depth only, using position only vertex streams for all meshes that are not alpha tested.
+	///
+	/// Sets depth prepass shaders. Otherwise same behavior as DrawScene.
+	void DrawSceneDepthPrepass(const std::vector<InstanceBatch>& batches, bool indirectDraw = false);
 
 
 	// ------------------------------------------------------------
@@ -222,6 +411,7 @@ private:
 	unsigned int m_maxNumLightCaches;
 	bool m_readLightCacheCount;
 	unsigned int m_lastNumLightCaches;
+	std::unique_ptr<ReadbackRing> m_lightCacheCounterReadback; ///< Only if m_readLightCacheCount is set.
 
 	/// For simplicity all cascades are in one texture. Its depth/height gives the resolution, its width divided by depth/height is the number of cascades.
 	std::unique_ptr<gl::Texture3D> m_CAVAtlas;
@@ -229,8 +419,37 @@ private:
 	bool m_showCAVCascades;
 	float m_CAVCascadeTransitionSize;
 
-	BufferPtr m_lightCacheBuffer;
+	/// Alternative to m_CAVAtlas, see SetLightCacheHashMap.
+	bool m_lightCacheHashMapEnabled;
+	bool m_validateLightCacheHashMap;
+	BufferPtr m_lightCacheHashMap;
+	BufferPtr m_lightCacheHashMapPrevious;
+
+	std::unique_ptr<SortedCacheAllocation> m_sortedCacheAllocation;
+	bool m_sortedCacheAllocationEnabled;
+
+	BufferPtr m_lightCacheBuffer;							///< Irradiance stream, see lightcache.glsl
+	BufferPtr m_lightCachePositionBuffer;					///< Position stream, see lightcache.glsl
 	BufferPtr m_lightCacheCounter;
+	bool m_packedLightCaches;
+	BufferPtr m_lightCacheScratchBuffer;					///< Full precision lighting of the relit caches, see SetPackedLightCaches.
+
+	// Persistent light caches, see SetPersistentLightCaches.
+	BufferPtr m_lightCacheBufferPrevious;					///< Caches of the last allocation.
+	std::unique_ptr<gl::Texture3D> m_CAVAtlasPrevious;		///< Address volume of the last allocation.
+	std::vector<ei::Vec3> m_CAVCascadeMin;					///< Cascade min of the last UpdateVolumeUBO.
+	std::vector<ei::Vec3> m_CAVCascadeMinPrevious;			///< Cascade min of m_CAVAtlasPrevious.
+	BufferPtr m_relightCacheBuffer;							///< Indices of all caches that are lit this frame.
+	bool m_persistentLightCaches;
+	float m_lightCacheRelightFraction;
+	unsigned int m_lightCacheRelightPhase;
+	bool m_previousLightCachesValid;						///< False if the previous caches can not be reused, e.g. after settings changes.
+	std::vector<bool> m_lightsChangedSinceCacheAllocation;	///< Lights with a changed RSM, collected until the next AllocateCaches.
+	std::vector<ei::Box> m_entityBoundingBoxesAtCacheAllocation;
+	/// Needs to match cacheallocation.glsl. More spheres are merged into larger ones.
+	static const unsigned int s_maxNumLightCacheForceRelightSpheres = 16;
+	/// Caches within this multiple of the bounding sphere of changed lights and entities are relit.
+	static const float s_lightCacheForceRelightSphereScale;
 
 	bool m_indirectSpecular;
 	Texture2DPtr m_specularEnvmap;
@@ -246,8 +465,13 @@ private:
 	AutoReloadShaderPtr m_shaderCacheGather;
 	AutoReloadShaderPtr m_shaderCacheApply;
 	AutoReloadShaderPtr m_shaderLightCachePrepare;
+	AutoReloadShaderPtr m_shaderLightCachePrepareVALs;
+	AutoReloadShaderPtr m_shaderLightCacheBuildVALTree;
 	//	AutoReloadShaderPtr m_shaderLightCachesDirect;
 	AutoReloadShaderPtr m_shaderLightCachesRSM;
+	AutoReloadShaderPtr m_shaderLightCachesRSMBatched;
+	AutoReloadShaderPtr m_shaderLightCacheResolveLighting;
+	AutoReloadShaderPtr m_shaderLightCacheHashMapTest;
 
 	AutoReloadShaderPtr m_shaderSpecularEnvmapMipMap;
 	AutoReloadShaderPtr m_shaderSpecularEnvmapFillHoles;
@@ -272,12 +496,63 @@ private:
 
 	AutoReloadShaderPtr m_shaderDebugGBuffer;
 	AutoReloadShaderPtr m_shaderFillGBuffer[2];
+	AutoReloadShaderPtr m_shaderDepthPrepass[2];
+	AutoReloadShaderPtr m_shaderDeformVertices;
 	AutoReloadShaderPtr m_shaderFillRSM[2];
 
 	AutoReloadShaderPtr m_shaderDeferredDirectLighting_Spot;
-
-	gl::UniformBufferMetaInfo m_uboInfoSpotLight;
-	std::unique_ptr<gl::PersistentRingBuffer> m_uboRing_SpotLight;
+	AutoReloadShaderPtr m_shaderDeferredDirectLighting_SpotVolume;
+	AutoReloadShaderPtr m_shaderLightVolumeStencil;
+	/// Empty vertex array for light volumes.
+	GLuint m_lightVolumeVAO;
+	/// Needs to match lightvolume.vert
+	static const unsigned int s_numLightVolumeVertices = 16 * 6;
+
+	/// Needs to match SpotLight in globalubos.glsl
+	struct SpotLightData
+	{
+		ei::Vec3 intensity;
+		float shadowNormalOffset;
+		ei::Vec3 position;
+		float shadowBias;
+		ei::Vec3 direction;
+		float cosHalfAngle;
+		ei::Mat4x4 viewProjection;
+		ei::Mat4x4 inverseViewProjection;
+		std::int32_t rsmRenderResolution;
+		std::int32_t rsmReadResolution;
+		std::int32_t rsmReadLod;
+		float rsmAtlasScale;
+		ei::Vec2 rsmAtlasOffset;
+		float valAreaFactor;
+		float indirectShadowComputationLod;
+		float indirectShadowComputationBlockSize;
+		std::int32_t indirectShadowComputationSampleInterval;
+		float indirectShadowComputationSuperValWidth;
+		float indirectShadowSamplingOffset;
+		float range;
+		float indirectScale;
+		std::int32_t valOffset;
+		std::int32_t valTreeOffset;
+	};
+	std::vector<SpotLightData> m_lightData; ///< Last content of m_lightBuffer, buffer is only written if this changes.
+	std::unique_ptr<gl::Buffer> m_lightBuffer;
+	/// Virtual area lights of all lights with indirect lighting, see cachePrepareVALs.comp
+	std::unique_ptr<gl::Buffer> m_valBuffer;
+	unsigned int m_numVALs;
+	unsigned int m_maxNumVALsPerLight;
+	/// VAL trees of all lights with indirect lighting, see SetVALTree.
+	std::unique_ptr<gl::Buffer> m_valTreeBuffer;
+	unsigned int m_numVALTreeNodes;
+	unsigned int m_maxVALTreeDepth;							///< Depth of the VALs of the light with the highest RSM read resolution.
+	/// Irradiance differences of SetVALTreeComparison, see VALTreeComparisonBuffer in cacheLightingRSM.comp
+	std::unique_ptr<gl::Buffer> m_valTreeComparisonBuffer;
+	std::unique_ptr<ReadbackRing> m_valTreeComparisonReadback;
+	bool m_valTreeComparisonWritten;
+	float m_lastVALTreeMeanError;
+	float m_lastVALTreeMaxError;
+	/// Location of the LightIndex uniform in globalubos.glsl. Selects the light of per-light passes.
+	static const GLint s_lightIndexUniformLocation = 31;
 
 
 	Texture2DPtr m_GBuffer_diffuse;
@@ -288,40 +563,7 @@ private:
 	float m_tonemapExposure;
 	float m_tonemapLMax;
 
-	struct ShadowMap
-	{
-		ShadowMap(ShadowMap& old);
-		ShadowMap();
-		~ShadowMap() { DeInit(); }
-
-		/// Initializes all textures and the fbo with the given resolution (square)
-		/// Will recreate if already initialized with different settings, otherwise do nothing.
-		void Init(unsigned int rsmResolution);
-
-		/// Resolves MSAA and creates MipMaps for RSM.
-		void PrepareRSM(const gl::ScreenAlignedTriangle& screenTri);
-
-		/// Binds FBO for filling the RSM.
-		void BindFBO_RSM();
-
-		gl::Texture2D& GetFlux() 			{ return *flux; }
-		gl::Texture2D& GetNormal()			{ return *normal; }
-		gl::Texture2D& GetDepthLinSq()		{ return *depthLinSq; }
-		gl::Texture2D& GetHighResDepth()	{ return *depthBuffer; }
-
-	private:
-		std::vector<gl::FramebufferObject*> rsmFBOs;
-
-		gl::Texture2D* flux;
-		gl::Texture2D* normal;
-		gl::Texture2D* depthLinSq;
-		gl::Texture2D* depthBuffer;
-
-		static AutoReloadShaderPtr m_shaderRSMDownSample;
-
-		void DeInit();
-	};
-	std::vector<ShadowMap> m_shadowMaps; ///< A shadowmap for every light.
+	std::unique_ptr<ShadowMapAtlas> m_shadowMapAtlas; ///< RSMs and shadow maps of all lights.
 
 
 	Texture2DPtr m_HDRBackbufferTexture;
@@ -341,6 +583,46 @@ private:
 	std::unique_ptr<gl::ScreenAlignedTriangle> m_screenTriangle;
 
 	std::unique_ptr<Voxelization> m_voxelization;
+	std::unique_ptr<OcclusionCulling> m_occlusionCulling;
+	bool m_occlusionCullingEnabled;
+	bool m_depthPrepass;
+	std::unique_ptr<VisibilityBuffer> m_visibilityBuffer;
+	bool m_visibilityBufferEnabled;
+	bool m_pretransformedVertices;
+	bool m_timeDependentMeshDeformation;
+	std::unique_ptr<ClusteredShading> m_clusteredShading;
+	bool m_clusteredShadingEnabled;
+	bool m_lightVolumes;
+	bool m_rsmCaching;
+	unsigned int m_numSkippedRSMs;
+	std::unique_ptr<MultiViewRSM> m_multiViewRSM;
+	bool m_multiViewRSMEnabled;
+	bool m_rsmComputeDownsample;
+	bool m_adaptiveRSMResolution;
+	float m_indirectLightImportanceThreshold;
+	bool m_batchedLightCaches;
+	bool m_valTreeEnabled;
+	float m_valTreeErrorBound;
+	bool m_valTreeComparison;
+	bool m_sampledVALs;
+	unsigned int m_valSampleBudget;
+	float m_valSampleBlendFactor;
+	unsigned int m_valSampleFrame; ///< Offsets the VAL sample sequence every frame.
+	unsigned int m_lightSelectionFrame; ///< Drives the random skipping of unimportant lights.
+
+	/// RSM settings that are actually used for a light, see UpdateLightRSMSettings.
+	struct LightRSMSettings
+	{
+		unsigned int resolution;
+		unsigned int readLod;
+		unsigned int indirectShadowComputationLod;
+		unsigned int downscale; ///< Number of times the light's RSM resolution was halved.
+		float indirectScale; ///< Scale of the light's VALs for light caches. Zero if skipped this frame.
+	};
+	std::vector<LightRSMSettings> m_lightRSMSettings;
+	/// Limits for adaptive RSM resolution.
+	static const unsigned int s_maxRSMDownscale = 3;
+	static const unsigned int s_minAdaptiveRSMResolution = 64;
 
 	gl::UniformBufferMetaInfo m_uboInfoConstant;
 	BufferPtr m_uboConstant;
@@ -348,10 +630,18 @@ private:
 	BufferPtr m_uboPerFrame;
 	gl::UniformBufferMetaInfo m_uboInfoVolumeInfo;
 	BufferPtr m_uboVolumeInfo;
-	gl::UniformBufferMetaInfo m_uboInfoPerObject;
-	std::unique_ptr<gl::PersistentRingBuffer> m_uboRing_PerObject;
+
+	BufferPtr m_instanceBuffer; ///< World matrices of all entities, indexed by entity index.
+	BufferPtr m_instanceIndexBuffer; ///< Entity indices referenced by all instance batches.
+	BufferPtr m_deformedVertexBuffer; ///< Deformed world space vertices of all entities. See deformedvertices.glsl
+	BufferPtr m_deformedVertexOffsetBuffer; ///< First deformed vertex per entity index.
+	std::vector<std::uint32_t> m_instanceIndices;
+	std::vector<InstanceBatch> m_instanceBatches;
+	std::vector<InstanceBatch> m_instanceBatchesCamera;
+	std::vector<std::vector<InstanceBatch>> m_instanceBatchesLights;
 
 	float m_passedTime;
+	ei::Mat4x4 m_viewProjection; ///< Camera view projection of the current frame.
 
 	const gl::SamplerObject& m_samplerLinearRepeat;
 	const gl::SamplerObject& m_samplerLinearClamp;
@@ -0,0 +1,284 @@
+#include "shadowmapatlas.hpp"
+
+#include "../utilities/logger.hpp"
+#include "../utilities/assert.hpp"
+
+#include <glhelper/samplerobject.hpp>
+#include <glhelper/shaderobject.hpp>
+#include <glhelper/texture2d.hpp>
+#include <glhelper/buffer.hpp>
+#include <glhelper/framebufferobject.hpp>
+#include <glhelper/screenalignedtriangle.hpp>
+#include <glhelper/statemanagement.hpp>
+
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+
+namespace
+{
+	/// Unpacks 2 16-bit coordinates from a 32-bit Morton code. Same as Morton_2D_Decode_16bit in cacheLightingRSM.comp
+	ei::UVec2 MortonDecode2D(std::uint32_t morton)
+	{
+		std::uint32_t coord[2] = { morton, morton >> 1 };
+		for (std::uint32_t& c : coord)
+		{
+			c &= 0x55555555;
+			c |= (c >> 1);
+			c &= 0x33333333;
+			c |= (c >> 2);
+			c &= 0x0f0f0f0f;
+			c |= (c >> 4);
+			c &= 0x00ff00ff;
+			c |= (c >> 8);
+			c &= 0x0000ffff;
+		}
+		return ei::UVec2(coord[0], coord[1]);
+	}
+}
+
+ShadowMapAtlas::ShadowMapAtlas() :
+	m_computeDownsampleSupported(false),
+	m_resolution(0)
+{
+	GLint numExtensions = 0;
+	GL_CALL(glGetIntegerv, GL_NUM_EXTENSIONS, &numExtensions);
+	for (GLint i = 0; i < numExtensions && !m_computeDownsampleSupported; ++i)
+		m_computeDownsampleSupported = strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_bindless_texture") == 0;
+	if (!m_computeDownsampleSupported)
+		LOG_WARNING("GL_ARB_bindless_texture is not supported. RSM mipmaps are generated with a fragment pass per level.");
+
+	m_shaderRSMDownSample = new gl::ShaderObject("RSM downsample");
+	m_shaderRSMDownSample->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/screenTri.vert");
+	m_shaderRSMDownSample->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/downsamplersm.frag");
+	m_shaderRSMDownSample->CreateProgram();
+
+	// Does not compile without the extension.
+	if (m_computeDownsampleSupported)
+	{
+		m_shaderRSMDownSampleCompute = new gl::ShaderObject("RSM downsample compute");
+		m_shaderRSMDownSampleCompute->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/downsamplersm.comp");
+		m_shaderRSMDownSampleCompute->CreateProgram();
+	}
+
+	Init(std::vector<unsigned int>());
+}
+
+ShadowMapAtlas::~ShadowMapAtlas()
+{
+	ReleaseMipImageHandles();
+}
+
+void ShadowMapAtlas::Init(const std::vector<unsigned int>& rsmResolutions)
+{
+	std::vector<unsigned int> resolutions(rsmResolutions.size());
+	for (size_t i = 0; i < rsmResolutions.size(); ++i)
+		resolutions[i] = 1u << static_cast<int>(ceil(log2(ei::max(1u, rsmResolutions[i]))));
+
+	// Largest regions first. All regions before a given one have a multiple of its area, so it will be always aligned to its own size.
+	std::vector<unsigned int> order(resolutions.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&resolutions](unsigned int a, unsigned int b) { return resolutions[a] > resolutions[b]; });
+
+	std::uint64_t totalArea = 0;
+	for (unsigned int resolution : resolutions)
+		totalArea += static_cast<std::uint64_t>(resolution) * resolution;
+	unsigned int atlasResolution = 1;
+	while (static_cast<std::uint64_t>(atlasResolution) * atlasResolution < totalArea)
+		atlasResolution *= 2;
+
+	std::vector<Region> regions(resolutions.size());
+	std::uint64_t allocatedArea = 0;
+	for (unsigned int regionIndex : order)
+	{
+		Region& region = regions[regionIndex];
+		region.resolution = resolutions[regionIndex];
+		Assert(region.resolution <= s_maxComputeDownsampleResolution, "RSM resolution is too large for compute downsampling!");
+		std::uint64_t regionArea = static_cast<std::uint64_t>(region.resolution) * region.resolution;
+		region.offset = MortonDecode2D(static_cast<std::uint32_t>(allocatedArea / regionArea)) * region.resolution;
+		region.contentSignature = 0;
+		allocatedArea += regionArea;
+	}
+
+	if (atlasResolution > m_resolution)
+	{
+		m_resolution = atlasResolution;
+		CreateTextures();
+		LOG_INFO("Resized shadow map atlas to " << m_resolution << "x" << m_resolution << " for " << regions.size() << " lights.");
+	}
+	else
+	{
+		// Keep content of regions that did not move.
+		for (size_t i = 0; i < ei::min(regions.size(), m_regions.size()); ++i)
+		{
+			if (regions[i].offset.x == m_regions[i].offset.x && regions[i].offset.y == m_regions[i].offset.y && regions[i].resolution == m_regions[i].resolution)
+				regions[i].contentSignature = m_regions[i].contentSignature;
+		}
+	}
+	m_regions = std::move(regions);
+}
+
+void ShadowMapAtlas::CreateTextures()
+{
+	m_rsmFBOs.clear();
+	ReleaseMipImageHandles();
+
+	// R11G11B10 was not sufficient for downsampling ops. Alpha is unused, but RGB16F can not be bound as image.
+	m_flux = std::make_unique<gl::Texture2D>(m_resolution, m_resolution, gl::TextureFormat::RGBA16F, 0, 0);
+	m_normal = std::make_unique<gl::Texture2D>(m_resolution, m_resolution, gl::TextureFormat::RG16I, 0, 0);
+	m_depthLinSq = std::make_unique<gl::Texture2D>(m_resolution, m_resolution, gl::TextureFormat::RG16F, 0, 0);
+	m_depthBuffer = std::make_unique<gl::Texture2D>(m_resolution, m_resolution, gl::TextureFormat::DEPTH_COMPONENT32F, 1, 0);
+
+	m_rsmFBOs.emplace_back(new gl::FramebufferObject({ gl::FramebufferObject::Attachment(m_flux.get()), gl::FramebufferObject::Attachment(m_normal.get()), gl::FramebufferObject::Attachment(m_depthLinSq.get()) },
+														gl::FramebufferObject::Attachment(m_depthBuffer.get())));
+	for (int i = 1; i < log2(m_resolution); ++i)
+	{
+		m_rsmFBOs.emplace_back(new gl::FramebufferObject({ gl::FramebufferObject::Attachment(m_flux.get(), i), gl::FramebufferObject::Attachment(m_normal.get(), i), gl::FramebufferObject::Attachment(m_depthLinSq.get(), i) }));
+	}
+
+	if (!m_computeDownsampleSupported)
+		return;
+
+	// Image handles for all levels that are written by downsamplersm.comp, ordered by level and then flux, normal, depth.
+	for (GLint level = 0; level < static_cast<GLint>(m_rsmFBOs.size()); ++level)
+	{
+		m_mipImageHandles.push_back(glGetImageHandleARB(m_flux->GetInternHandle(), level, GL_FALSE, 0, GL_RGBA16F));
+		m_mipImageHandles.push_back(glGetImageHandleARB(m_normal->GetInternHandle(), level, GL_FALSE, 0, GL_RG16I));
+		m_mipImageHandles.push_back(glGetImageHandleARB(m_depthLinSq->GetInternHandle(), level, GL_FALSE, 0, GL_RG16F));
+	}
+	for (std::uint64_t handle : m_mipImageHandles)
+		GL_CALL(glMakeImageHandleResidentARB, handle, GL_WRITE_ONLY);
+	m_mipImageHandleBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint64_t) * m_mipImageHandles.size()), gl::Buffer::IMMUTABLE, m_mipImageHandles.data());
+}
+
+void ShadowMapAtlas::ReleaseMipImageHandles()
+{
+	for (std::uint64_t handle : m_mipImageHandles)
+		GL_CALL(glMakeImageHandleNonResidentARB, handle);
+	m_mipImageHandles.clear();
+}
+
+void ShadowMapAtlas::BindFBO_RSM()
+{
+	m_rsmFBOs[0]->Bind(false);
+}
+
+void ShadowMapAtlas::BeginRegion(unsigned int regionIndex)
+{
+	const Region& region = m_regions[regionIndex];
+	GL_CALL(glViewport, region.offset.x, region.offset.y, region.resolution, region.resolution);
+
+	// Other regions may hold valid content.
+	gl::Enable(gl::Cap::SCISSOR_TEST);
+	GL_CALL(glScissor, region.offset.x, region.offset.y, region.resolution, region.resolution);
+	GL_CALL(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	gl::Disable(gl::Cap::SCISSOR_TEST);
+}
+
+void ShadowMapAtlas::PrepareRSMs(const std::vector<unsigned int>& regionIndices, const gl::ScreenAlignedTriangle& screenTri)
+{
+	if (regionIndices.empty())
+		return;
+
+	gl::Disable(gl::Cap::DEPTH_TEST);
+	gl::Disable(gl::Cap::CULL_FACE);
+	gl::SetDepthWrite(false);
+	m_shaderRSMDownSample->Activate();
+
+	const auto& samplerLinearClamp = gl::SamplerObject::GetSamplerObject(gl::SamplerObject::Desc(gl::SamplerObject::Filter::LINEAR, gl::SamplerObject::Filter::LINEAR, gl::SamplerObject::Filter::LINEAR,
+		gl::SamplerObject::Border::CLAMP));
+	const auto& samplerNearestClamp = gl::SamplerObject::GetSamplerObject(gl::SamplerObject::Desc(gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST,
+		gl::SamplerObject::Border::CLAMP));
+
+	GetFlux().Bind(0);
+	samplerNearestClamp.BindSampler(0);
+	GetNormal().Bind(1);
+	samplerNearestClamp.BindSampler(1);
+	GetDepthLinSq().Bind(2);
+	samplerLinearClamp.BindSampler(2);
+
+	for (unsigned int i = 1; i < m_rsmFBOs.size(); ++i)
+	{
+		GL_CALL(glTextureParameteri, GetFlux().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, i - 1);
+		GL_CALL(glTextureParameteri, GetNormal().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, i - 1);
+		GL_CALL(glTextureParameteri, GetDepthLinSq().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, i - 1);
+
+		m_rsmFBOs[i]->Bind(false);
+		for (unsigned int regionIndex : regionIndices)
+		{
+			// Mip chain of a single region goes down to 2x2.
+			const Region& region = m_regions[regionIndex];
+			unsigned int levelResolution = region.resolution >> i;
+			if (levelResolution < 2)
+				continue;
+
+			GL_CALL(glViewport, region.offset.x >> i, region.offset.y >> i, levelResolution, levelResolution);
+			screenTri.Draw();
+		}
+	}
+
+	GL_CALL(glTextureParameteri, GetFlux().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, 0);
+	GL_CALL(glTextureParameteri, GetNormal().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, 0);
+	GL_CALL(glTextureParameteri, GetDepthLinSq().GetInternHandle(), GL_TEXTURE_BASE_LEVEL, 0);
+}
+
+void ShadowMapAtlas::PrepareRSMsCompute(const std::vector<unsigned int>& regionIndices)
+{
+	Assert(m_computeDownsampleSupported, "Compute RSM downsampling is not supported on this device!");
+	if (regionIndices.empty())
+		return;
+
+	// Mip chain of a single region goes down to 2x2, see PrepareRSMs.
+	std::vector<DownsampleRegion> downsampleRegions;
+	unsigned int maxResolution = 0;
+	for (unsigned int regionIndex : regionIndices)
+	{
+		const Region& region = m_regions[regionIndex];
+		std::uint32_t numLevels = static_cast<std::uint32_t>(ei::max(0, static_cast<int>(log2(region.resolution)) - 1));
+		if (numLevels == 0)
+			continue;
+
+		downsampleRegions.push_back(DownsampleRegion{ region.offset, region.resolution, numLevels });
+		maxResolution = ei::max(maxResolution, region.resolution);
+	}
+	if (downsampleRegions.empty())
+		return;
+
+	size_t regionBufferSize = sizeof(DownsampleRegion) * downsampleRegions.size();
+	if (!m_downsampleRegionBuffer || static_cast<size_t>(m_downsampleRegionBuffer->GetSize()) < regionBufferSize)
+	{
+		size_t newCapacity = static_cast<size_t>(1) << static_cast<int>(ceil(log2(downsampleRegions.size())));
+		m_downsampleRegionBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(DownsampleRegion) * newCapacity), gl::Buffer::MAP_WRITE);
+		m_workgroupCounterBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * newCapacity), gl::Buffer::IMMUTABLE);
+	}
+	void* regionData = m_downsampleRegionBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER);
+	memcpy(regionData, downsampleRegions.data(), regionBufferSize);
+	m_downsampleRegionBuffer->Unmap();
+	m_workgroupCounterBuffer->ClearToZero();
+
+	m_downsampleRegionBuffer->BindShaderStorageBuffer(0);
+	m_workgroupCounterBuffer->BindShaderStorageBuffer(1);
+	m_mipImageHandleBuffer->BindShaderStorageBuffer(2);
+
+	const auto& samplerNearestClamp = gl::SamplerObject::GetSamplerObject(gl::SamplerObject::Desc(gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST,
+		gl::SamplerObject::Border::CLAMP));
+	GetFlux().Bind(0);
+	samplerNearestClamp.BindSampler(0);
+	GetNormal().Bind(1);
+	samplerNearestClamp.BindSampler(1);
+	GetDepthLinSq().Bind(2);
+	samplerNearestClamp.BindSampler(2);
+
+	// Level 6 is read back within the dispatch and needs coherent image bindings.
+	if (m_rsmFBOs.size() > 6)
+	{
+		GetFlux().BindImage(0, gl::Texture::ImageAccess::READ_WRITE, 6);
+		GetNormal().BindImage(1, gl::Texture::ImageAccess::READ_WRITE, 6);
+		GetDepthLinSq().BindImage(2, gl::Texture::ImageAccess::READ_WRITE, 6);
+	}
+
+	m_shaderRSMDownSampleCompute->Activate();
+	GLuint numTilesPerSide = (maxResolution + 63) / 64;
+	GL_CALL(glDispatchCompute, numTilesPerSide, numTilesPerSide, static_cast<GLuint>(downsampleRegions.size()));
+	GL_CALL(glMemoryBarrier, GL_TEXTURE_FETCH_BARRIER_BIT);
+}
\ No newline at end of file
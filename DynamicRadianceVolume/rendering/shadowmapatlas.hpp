@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <ei/vector.hpp>
+#include "../shaderreload/autoreloadshaderptr.hpp"
+
+namespace gl
+{
+	class ShaderObject;
+	class Texture2D;
+	class FramebufferObject;
+	class ScreenAlignedTriangle;
+	class Buffer;
+}
+
+/// Reflective shadow maps and shadow maps of all lights in a single set of textures.
+///
+/// Every light gets a square power of two region. Regions are sorted by size and packed along a z-order curve, which is equivalent to a quadtree allocation.
+/// Thus every region stays aligned on all mip levels and each mip level of the atlas contains the according mip level of all regions.
+/// Not exactly self-contained! Submodule for renderer!
+class ShadowMapAtlas
+{
+public:
+	struct Region
+	{
+		ei::UVec2 offset; ///< Texel offset on mip level 0.
+		unsigned int resolution;
+
+		/// RSM signature (see Renderer::ComputeRSMSignature) of the current content. 0 if there is no valid content.
+		std::uint64_t contentSignature;
+	};
+
+	ShadowMapAtlas();
+	~ShadowMapAtlas();
+
+	/// Allocates a region for every given resolution (rounded up to the next power of two).
+	///
+	/// The atlas only grows, so changing resolutions of single lights (see Renderer::SetAdaptiveRSMResolution) reuse the existing textures.
+	/// Recreates all textures if the atlas needs to grow. Otherwise regions that keep their place keep their content.
+	void Init(const std::vector<unsigned int>& rsmResolutions);
+
+	unsigned int GetResolution() const							{ return m_resolution; }
+	unsigned int GetNumRegions() const							{ return static_cast<unsigned int>(m_regions.size()); }
+	Region& GetRegion(unsigned int regionIndex)					{ return m_regions[regionIndex]; }
+	const Region& GetRegion(unsigned int regionIndex) const		{ return m_regions[regionIndex]; }
+
+	/// Binds FBO for filling the RSMs. Use BeginRegion before filling a light's RSM.
+	void BindFBO_RSM();
+	/// Sets viewport to the given region and clears it.
+	void BeginRegion(unsigned int regionIndex);
+
+	/// Creates MipMaps for the given regions.
+	void PrepareRSMs(const std::vector<unsigned int>& regionIndices, const gl::ScreenAlignedTriangle& screenTri);
+	/// False if GL_ARB_bindless_texture is not available. PrepareRSMsCompute can not be used then.
+	bool IsComputeDownsampleSupported() const	{ return m_computeDownsampleSupported; }
+	/// Creates MipMaps for the given regions with a single compute dispatch (see downsamplersm.comp). Same results as PrepareRSMs.
+	///
+	/// Needs GL_ARB_bindless_texture, see IsComputeDownsampleSupported.
+	void PrepareRSMsCompute(const std::vector<unsigned int>& regionIndices);
+
+	gl::Texture2D& GetFlux()			{ return *m_flux; }
+	gl::Texture2D& GetNormal()			{ return *m_normal; }
+	gl::Texture2D& GetDepthLinSq()		{ return *m_depthLinSq; }
+	gl::Texture2D& GetHighResDepth()	{ return *m_depthBuffer; }
+
+	/// Largest region size the compute downsampling can handle.
+	static const unsigned int s_maxComputeDownsampleResolution = 4096;
+
+private:
+	/// Needs to match DownsampleRegion in downsamplersm.comp
+	struct DownsampleRegion
+	{
+		ei::UVec2 offset;
+		std::uint32_t resolution;
+		std::uint32_t numLevels;
+	};
+
+	void CreateTextures();
+	/// Makes all bindless image handles non resident.
+	void ReleaseMipImageHandles();
+
+	AutoReloadShaderPtr m_shaderRSMDownSample;
+	AutoReloadShaderPtr m_shaderRSMDownSampleCompute;
+
+	bool m_computeDownsampleSupported;
+
+	unsigned int m_resolution;
+	std::vector<Region> m_regions;
+
+	std::unique_ptr<gl::Texture2D> m_flux;
+	std::unique_ptr<gl::Texture2D> m_normal;
+	std::unique_ptr<gl::Texture2D> m_depthLinSq;
+	std::unique_ptr<gl::Texture2D> m_depthBuffer;
+
+	/// One FBO per mip level, only the first one has a depth buffer.
+	std::vector<std::unique_ptr<gl::FramebufferObject>> m_rsmFBOs;
+
+	/// Bindless write only image handles for flux, normal and depth of every mip level. Empty if compute downsampling is not supported.
+	std::vector<std::uint64_t> m_mipImageHandles;
+	std::unique_ptr<gl::Buffer> m_mipImageHandleBuffer;
+	std::unique_ptr<gl::Buffer> m_downsampleRegionBuffer;
+	std::unique_ptr<gl::Buffer> m_workgroupCounterBuffer;
+};
\ No newline at end of file
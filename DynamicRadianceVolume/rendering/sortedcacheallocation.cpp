@@ -0,0 +1,195 @@
+#include "sortedcacheallocation.hpp"
+
+#include "readbackring.hpp"
+#include "../utilities/assert.hpp"
+#include "../utilities/logger.hpp"
+#include "../frameprofiler.hpp"
+
+#include <glhelper/shaderobject.hpp>
+#include <glhelper/buffer.hpp>
+
+#include <algorithm>
+
+SortedCacheAllocation::SortedCacheAllocation() :
+	m_numTiles(0),
+	m_maxNumOverflowCells(0),
+	m_numKeys(0),
+	m_sortedKeyBufferIndex(0),
+	m_overflowCounterWritten(false),
+	m_lastNumDroppedCells(0)
+{
+	m_shaderRadixSortCount = new gl::ShaderObject("sorted cache allocation - radix sort count");
+	m_shaderRadixSortCount->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/sortedcacheallocation/radixsortcount.comp");
+	m_shaderRadixSortCount->CreateProgram();
+
+	m_shaderRadixSortScatter = new gl::ShaderObject("sorted cache allocation - radix sort scatter");
+	m_shaderRadixSortScatter->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/sortedcacheallocation/radixsortscatter.comp");
+	m_shaderRadixSortScatter->CreateProgram();
+
+	m_shaderPrefixSumScanBlocks = new gl::ShaderObject("sorted cache allocation - prefix sum scan blocks");
+	m_shaderPrefixSumScanBlocks->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/sortedcacheallocation/prefixsum.comp", "#define PREFIXSUM_SCAN_BLOCKS\n");
+	m_shaderPrefixSumScanBlocks->CreateProgram();
+
+	m_shaderPrefixSumScanBlockSums = new gl::ShaderObject("sorted cache allocation - prefix sum scan block sums");
+	m_shaderPrefixSumScanBlockSums->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/sortedcacheallocation/prefixsum.comp", "#define PREFIXSUM_SCAN_BLOCKSUMS\n");
+	m_shaderPrefixSumScanBlockSums->CreateProgram();
+
+	m_shaderPrefixSumAddBlockSums = new gl::ShaderObject("sorted cache allocation - prefix sum add block sums");
+	m_shaderPrefixSumAddBlockSums->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/sortedcacheallocation/prefixsum.comp", "#define PREFIXSUM_ADD_BLOCKSUMS\n");
+	m_shaderPrefixSumAddBlockSums->CreateProgram();
+
+	m_overflowCounterBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * 2), gl::Buffer::IMMUTABLE, nullptr);
+	m_overflowCounterReadback = std::make_unique<ReadbackRing>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * 2));
+}
+
+SortedCacheAllocation::~SortedCacheAllocation()
+{
+}
+
+void SortedCacheAllocation::ReloadShaders(const std::string& settings)
+{
+	// Key encoding depends on the address structure.
+	m_shaderEmitCellKeys = new gl::ShaderObject("sorted cache allocation - emit cell keys");
+	m_shaderEmitCellKeys->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/sortedcacheallocation/emitcellkeys.comp", settings);
+	m_shaderEmitCellKeys->CreateProgram();
+
+	m_shaderMarkUniqueKeys = new gl::ShaderObject("sorted cache allocation - mark unique keys");
+	m_shaderMarkUniqueKeys->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/sortedcacheallocation/markuniquekeys.comp", settings);
+	m_shaderMarkUniqueKeys->CreateProgram();
+
+	m_shaderAllocateCaches = new gl::ShaderObject("sorted cache allocation - allocate caches");
+	m_shaderAllocateCaches->AddShaderFromFile(gl::ShaderObject::ShaderType::COMPUTE, "shader/sortedcacheallocation/allocatecaches.comp", settings);
+	m_shaderAllocateCaches->CreateProgram();
+}
+
+void SortedCacheAllocation::OnScreenResize(const ei::UVec2& newResolution)
+{
+	m_numTiles = (newResolution + ei::UVec2(s_tileSize - 1)) / s_tileSize;
+	m_maxNumOverflowCells = m_numTiles.x * m_numTiles.y * s_numOverflowCellsPerTile;
+	m_numKeys = m_numTiles.x * m_numTiles.y * s_tileSize * s_tileSize + m_maxNumOverflowCells * 8;
+
+	std::uint32_t numRadixBlocks = (m_numKeys + s_radixBlockSize - 1) / s_radixBlockSize;
+	std::uint32_t numBlockDigitOffsets = numRadixBlocks << s_radixBits;
+	std::uint32_t maxNumPrefixSumValues = std::max(m_numKeys, numBlockDigitOffsets);
+
+	for (auto& buffer : m_cellKeyBuffer)
+		buffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * m_numKeys), gl::Buffer::IMMUTABLE);
+	m_blockDigitOffsetBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * numBlockDigitOffsets), gl::Buffer::IMMUTABLE);
+	m_cacheIndexBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * m_numKeys), gl::Buffer::IMMUTABLE);
+	m_prefixSumBlockSumBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * ((maxNumPrefixSumValues + s_prefixSumBlockSize - 1) / s_prefixSumBlockSize)), gl::Buffer::IMMUTABLE);
+}
+
+void SortedCacheAllocation::PrefixSum(gl::Buffer& buffer, std::uint32_t numValues)
+{
+	std::uint32_t numBlocks = (numValues + s_prefixSumBlockSize - 1) / s_prefixSumBlockSize;
+
+	buffer.BindShaderStorageBuffer(0);
+	m_prefixSumBlockSumBuffer->BindShaderStorageBuffer(1);
+
+	m_shaderPrefixSumScanBlocks->Activate();
+	GL_CALL(glUniform1ui, 0, numValues);
+	GL_CALL(glDispatchCompute, numBlocks, 1, 1);
+	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+
+	m_shaderPrefixSumScanBlockSums->Activate();
+	GL_CALL(glUniform1ui, 0, numValues);
+	GL_CALL(glDispatchCompute, 1, 1, 1);
+	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+
+	m_shaderPrefixSumAddBlockSums->Activate();
+	GL_CALL(glUniform1ui, 0, numValues);
+	GL_CALL(glDispatchCompute, numBlocks, 1, 1);
+	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void SortedCacheAllocation::SortCellKeys(std::uint32_t numCellKeyValues)
+{
+	Assert(m_numKeys > 0, "OnScreenResize was not called!");
+
+	// Read overflow counter of an earlier frame, queue the last frame's counter.
+	const std::uint32_t* overflowCounterData = static_cast<const std::uint32_t*>(m_overflowCounterReadback->TryRead());
+	if (overflowCounterData)
+	{
+		if (overflowCounterData[1] > 0 && m_lastNumDroppedCells == 0)
+			LOG_WARNING(overflowCounterData[0] << " cells did not fit into the keys of their tile, " << overflowCounterData[1] << " of them did not fit into the overflow list. These cells get no light cache!");
+		m_lastNumDroppedCells = overflowCounterData[1];
+		FrameProfiler::GetInstance().ReportValue("CacheAllocationOverflowCells", static_cast<float>(overflowCounterData[0]));
+		FrameProfiler::GetInstance().ReportValue("CacheAllocationDroppedCells", static_cast<float>(m_lastNumDroppedCells));
+	}
+	if (m_overflowCounterWritten)
+	{
+		GL_CALL(glMemoryBarrier, GL_BUFFER_UPDATE_BARRIER_BIT);
+		m_overflowCounterReadback->Copy(*m_overflowCounterBuffer, 0, sizeof(std::uint32_t) * 2);
+	}
+	m_overflowCounterBuffer->ClearToZero();
+
+	// Unused entries of the overflow list need to stay behind all valid keys.
+	const std::uint32_t invalidCellKey = 0xFFFFFFFF;
+	std::uint32_t overflowKeyOffset = m_numTiles.x * m_numTiles.y * s_tileSize * s_tileSize;
+	GL_CALL(glClearNamedBufferSubData, m_cellKeyBuffer[0]->GetInternHandle(), GL_R32UI, sizeof(std::uint32_t) * overflowKeyOffset, sizeof(std::uint32_t) * m_maxNumOverflowCells * 8,
+				GL_RED_INTEGER, GL_UNSIGNED_INT, &invalidCellKey);
+
+	// Emit keys, one per thread of every tile and 8 per overflow cell.
+	m_cellKeyBuffer[0]->BindShaderStorageBuffer(0);
+	m_overflowCounterBuffer->BindShaderStorageBuffer(1);
+	m_shaderEmitCellKeys->Activate();
+	GL_CALL(glUniform1ui, 0, m_maxNumOverflowCells);
+	GL_CALL(glDispatchCompute, m_numTiles.x, m_numTiles.y, 1);
+	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+	m_overflowCounterWritten = true;
+
+	// Radix sort only the bits that are used by valid keys.
+	// The invalid key has all bits set and stays behind all valid keys, since numCellKeyValues - 1 < 2^numKeyBits - 1.
+	unsigned int numKeyBits = 1;
+	while ((static_cast<std::uint64_t>(1) << numKeyBits) <= numCellKeyValues)
+		++numKeyBits;
+	unsigned int numPasses = (numKeyBits + s_radixBits - 1) / s_radixBits;
+	std::uint32_t numRadixBlocks = (m_numKeys + s_radixBlockSize - 1) / s_radixBlockSize;
+
+	m_sortedKeyBufferIndex = 0;
+	for (unsigned int pass = 0; pass < numPasses; ++pass)
+	{
+		m_cellKeyBuffer[m_sortedKeyBufferIndex]->BindShaderStorageBuffer(0);
+		m_cellKeyBuffer[1 - m_sortedKeyBufferIndex]->BindShaderStorageBuffer(1);
+		m_blockDigitOffsetBuffer->BindShaderStorageBuffer(2);
+
+		m_shaderRadixSortCount->Activate();
+		GL_CALL(glUniform1ui, 0, m_numKeys);
+		GL_CALL(glUniform1ui, 1, pass * s_radixBits);
+		GL_CALL(glDispatchCompute, numRadixBlocks, 1, 1);
+		GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+
+		PrefixSum(*m_blockDigitOffsetBuffer, numRadixBlocks << s_radixBits);
+
+		m_cellKeyBuffer[m_sortedKeyBufferIndex]->BindShaderStorageBuffer(0);
+		m_cellKeyBuffer[1 - m_sortedKeyBufferIndex]->BindShaderStorageBuffer(1);
+		m_blockDigitOffsetBuffer->BindShaderStorageBuffer(2);
+
+		m_shaderRadixSortScatter->Activate();
+		GL_CALL(glUniform1ui, 0, m_numKeys);
+		GL_CALL(glUniform1ui, 1, pass * s_radixBits);
+		GL_CALL(glDispatchCompute, numRadixBlocks, 1, 1);
+		GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+
+		m_sortedKeyBufferIndex = 1 - m_sortedKeyBufferIndex;
+	}
+
+	// Enumerate unique keys.
+	m_cellKeyBuffer[m_sortedKeyBufferIndex]->BindShaderStorageBuffer(0);
+	m_cacheIndexBuffer->BindShaderStorageBuffer(1);
+	m_shaderMarkUniqueKeys->Activate();
+	GL_CALL(glUniform1ui, 0, m_numKeys);
+	GL_CALL(glDispatchCompute, (m_numKeys + 255) / 256, 1, 1);
+	GL_CALL(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+
+	PrefixSum(*m_cacheIndexBuffer, m_numKeys);
+}
+
+void SortedCacheAllocation::AllocateCaches()
+{
+	m_cellKeyBuffer[m_sortedKeyBufferIndex]->BindShaderStorageBuffer(18);
+	m_cacheIndexBuffer->BindShaderStorageBuffer(19);
+
+	GL_CALL(glUniform1ui, 24, m_numKeys);
+	GL_CALL(glDispatchCompute, (m_numKeys + 63) / 64, 1, 1);
+}
\ No newline at end of file
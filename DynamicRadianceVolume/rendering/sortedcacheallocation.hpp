@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <ei/vector.hpp>
+#include "../shaderreload/autoreloadshaderptr.hpp"
+
+namespace gl
+{
+	class ShaderObject;
+	class Buffer;
+}
+class ReadbackRing;
+
+/// Deterministic light cache allocation via sorting, alternative to the atomic allocation in cacheGather.comp.
+///
+/// Every gbuffer tile emits the keys of the cells it needs caches for. All keys are radix sorted on the GPU and a prefix sum over the first occurrence
+/// of every key enumerates the caches. The resulting cache list is ordered by key and thus spatially sorted, independent of thread scheduling and free of
+/// contention on the cache counter. Cells that are not needed by any pixel get no cache, same as with cacheGather.comp.
+/// Tiles that need more cells than their share of keys append them to an overflow list. Cells that do not fit there either get no cache and are reported.
+/// Does not perform any GPU profiling itself, since profiling queries can not be nested.
+/// Not exactly self-contained! Submodule for renderer!
+class SortedCacheAllocation
+{
+public:
+	SortedCacheAllocation();
+	~SortedCacheAllocation();
+
+	/// Reloads the allocation shader with the given cache settings. See Renderer::ReloadLightingSettingDependentCacheShader.
+	void ReloadShaders(const std::string& settings);
+
+	/// Should be called on screen resize.
+	void OnScreenResize(const ei::UVec2& newResolution);
+
+	/// Emits cell keys for all gbuffer pixels, sorts them and enumerates all unique keys.
+	///
+	/// Expects gbuffer and UBOs to be bound.
+	/// \param numCellKeyValues
+	///		All valid cell keys are smaller than this value, see sortedcacheallocation.glsl
+	void SortCellKeys(std::uint32_t numCellKeyValues);
+
+	/// Allocation shader, has the same uniforms and buffer/image bindings as cacheGather.comp. See cacheallocation.glsl
+	gl::ShaderObject& GetAllocationShader() { return *m_shaderAllocateCaches; }
+	/// Number of cells that got no cache because the overflow list was full. Arrives a few frames late.
+	std::uint32_t GetLastNumDroppedCells() const { return m_lastNumDroppedCells; }
+
+	/// Allocates a cache for every unique key of the last SortCellKeys call.
+	///
+	/// Expects allocation shader to be active and all its buffers and images to be bound.
+	void AllocateCaches();
+
+	// Needs to match sortedcacheallocation.glsl and radixsort.glsl
+	static const unsigned int s_tileSize = 16;
+	static const unsigned int s_radixBits = 4;
+	static const unsigned int s_radixBlockSize = 1024;
+	static const unsigned int s_prefixSumBlockSize = 1024;
+	/// Average number of overflow cells per tile. The overflow list is shared by all tiles.
+	static const unsigned int s_numOverflowCellsPerTile = 8;
+
+private:
+	/// Exclusive prefix sum of the first numValues values in the given buffer.
+	void PrefixSum(gl::Buffer& buffer, std::uint32_t numValues);
+
+	AutoReloadShaderPtr m_shaderEmitCellKeys;
+	AutoReloadShaderPtr m_shaderRadixSortCount;
+	AutoReloadShaderPtr m_shaderRadixSortScatter;
+	AutoReloadShaderPtr m_shaderPrefixSumScanBlocks;
+	AutoReloadShaderPtr m_shaderPrefixSumScanBlockSums;
+	AutoReloadShaderPtr m_shaderPrefixSumAddBlockSums;
+	AutoReloadShaderPtr m_shaderMarkUniqueKeys;
+	AutoReloadShaderPtr m_shaderAllocateCaches;
+
+	ei::UVec2 m_numTiles;
+	std::uint32_t m_maxNumOverflowCells;
+	std::uint32_t m_numKeys;							///< Keys of all tiles followed by the keys of the overflow list.
+	unsigned int m_sortedKeyBufferIndex;
+
+	std::unique_ptr<gl::Buffer> m_cellKeyBuffer[2];			///< Ping pong buffers for radix sort passes.
+	std::unique_ptr<gl::Buffer> m_blockDigitOffsetBuffer;	///< Digit count/offset per radix sort block.
+	std::unique_ptr<gl::Buffer> m_cacheIndexBuffer;			///< Cache index for every sorted key.
+	std::unique_ptr<gl::Buffer> m_prefixSumBlockSumBuffer;
+
+	std::unique_ptr<gl::Buffer> m_overflowCounterBuffer;	///< Number of overflow cells and number of dropped cells.
+	std::unique_ptr<ReadbackRing> m_overflowCounterReadback;
+	bool m_overflowCounterWritten;
+	std::uint32_t m_lastNumDroppedCells;
+};
\ No newline at end of file
@@ -0,0 +1,265 @@
+#include "visibilitybuffer.hpp"
+
+#include "../scene/model.hpp"
+#include "../utilities/logger.hpp"
+
+#include <glhelper/samplerobject.hpp>
+#include <glhelper/shaderobject.hpp>
+#include <glhelper/texture2d.hpp>
+#include <glhelper/buffer.hpp>
+#include <glhelper/framebufferobject.hpp>
+#include <glhelper/screenalignedtriangle.hpp>
+#include <glhelper/statemanagement.hpp>
+#include <cstring>
+
+VisibilityBuffer::VisibilityBuffer() :
+	m_supported(false),
+	m_samplerNearest(gl::SamplerObject::GetSamplerObject(gl::SamplerObject::Desc(gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST, gl::SamplerObject::Filter::NEAREST,
+																				gl::SamplerObject::Border::CLAMP))),
+	m_triangleBits(1),
+	m_tooManyDraws(false)
+{
+	GLint numExtensions = 0;
+	GL_CALL(glGetIntegerv, GL_NUM_EXTENSIONS, &numExtensions);
+	for (GLint i = 0; i < numExtensions && !m_supported; ++i)
+		m_supported = strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_bindless_texture") == 0;
+	if (!m_supported)
+		LOG_WARNING("GL_ARB_bindless_texture is not supported. Visibility buffer rendering is not available.");
+
+	ReloadGeometryShaders("");
+
+	// Same filtering as the renderer's linear repeat sampler that is used for the ordinary gbuffer pass.
+	GL_CALL(glCreateSamplers, 1, &m_bindlessSampler);
+	GL_CALL(glSamplerParameteri, m_bindlessSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	GL_CALL(glSamplerParameteri, m_bindlessSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	GL_CALL(glSamplerParameteri, m_bindlessSampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	GL_CALL(glSamplerParameteri, m_bindlessSampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+}
+
+VisibilityBuffer::~VisibilityBuffer()
+{
+	ReleaseBindlessHandles();
+	GL_CALL(glDeleteSamplers, 1, &m_bindlessSampler);
+}
+
+void VisibilityBuffer::ReloadGeometryShaders(const std::string& settings)
+{
+	// Resolve shader does not compile without the extension.
+	if (!m_supported)
+		return;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		std::string postfix = i == 0 ? " - no alphatest" : " - alphatest";
+		std::string define = i == 0 ? settings : settings + "#define ALPHATESTING 0.1";
+
+		m_shaderFill[i] = new gl::ShaderObject("fill visibility buffer" + postfix);
+		m_shaderFill[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/visibilitybuffer/fillvisibilitybuffer.vert", define);
+		m_shaderFill[i]->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/visibilitybuffer/fillvisibilitybuffer.frag", define);
+		m_shaderFill[i]->CreateProgram();
+	}
+
+	m_shaderResolve = new gl::ShaderObject("resolve visibility buffer");
+	m_shaderResolve->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/screenTri.vert");
+	m_shaderResolve->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/visibilitybuffer/resolvevisibilitybuffer.frag", settings);
+	m_shaderResolve->CreateProgram();
+}
+
+void VisibilityBuffer::OnScreenResize(const ei::UVec2& newResolution, gl::Texture2D& depthBuffer)
+{
+	m_visibilityTexture = std::make_unique<gl::Texture2D>(newResolution.x, newResolution.y, gl::TextureFormat::R32UI, 1, 0);
+	m_visibilityFBO.reset(new gl::FramebufferObject(gl::FramebufferObject::Attachment(m_visibilityTexture.get()), gl::FramebufferObject::Attachment(&depthBuffer)));
+}
+
+bool VisibilityBuffer::PrepareDraws(const std::vector<Renderer::InstanceBatch>& allBatches, const std::vector<Renderer::InstanceBatch>& batches, const std::vector<std::uint32_t>& instanceIndices)
+{
+	// Unculled batches contain every model exactly once.
+	std::vector<const Model*> models;
+	models.reserve(allBatches.size());
+	for (const Renderer::InstanceBatch& batch : allBatches)
+		models.push_back(batch.model);
+	if (models != m_sceneModels)
+		BuildSceneGeometry(models);
+
+	// One draw info per instance and mesh, ordered by batch, mesh and instance. Draw ids are contiguous within a single draw call.
+	m_drawInfos.clear();
+	for (const Renderer::InstanceBatch& batch : batches)
+	{
+		const GeometryOffset& geometryOffset = m_sceneGeometryOffsets[batch.model];
+		for (const Model::Mesh& mesh : batch.model->GetMeshes())
+		{
+			DrawInfo drawInfo;
+			drawInfo.baseVertex = geometryOffset.baseVertex;
+			drawInfo.firstIndex = geometryOffset.baseIndex + mesh.startIndex;
+			drawInfo._padding0 = 0;
+			drawInfo.diffuseHandle = GetBindlessHandle(mesh.diffuse);
+			drawInfo.normalmapHandle = GetBindlessHandle(mesh.normalmap);
+			drawInfo.roughnessMetallicHandle = GetBindlessHandle(mesh.roughnessMetallic);
+			drawInfo._padding1 = 0;
+
+			for (unsigned int instance = batch.firstInstance; instance < batch.firstInstance + batch.instanceCount; ++instance)
+			{
+				drawInfo.entityIndex = instanceIndices[instance];
+				m_drawInfos.push_back(drawInfo);
+			}
+		}
+	}
+	if (m_drawInfos.empty())
+		return true;
+
+	// All bits set marks empty pixels.
+	bool tooManyDraws = m_drawInfos.size() >= (static_cast<size_t>(1) << (32 - m_triangleBits)) - 1;
+	if (tooManyDraws && !m_tooManyDraws)
+		LOG_WARNING("Too many draws (" << m_drawInfos.size() << ") for visibility buffer with " << m_triangleBits << " triangle bits! Falling back to the ordinary gbuffer pass.");
+	m_tooManyDraws = tooManyDraws;
+	if (tooManyDraws)
+		return false;
+
+	size_t drawInfoBufferSize = sizeof(DrawInfo) * m_drawInfos.size();
+	if (!m_drawInfoBuffer || static_cast<size_t>(m_drawInfoBuffer->GetSize()) < drawInfoBufferSize)
+	{
+		size_t newSize = static_cast<size_t>(1) << static_cast<int>(ceil(log2(drawInfoBufferSize)));
+		m_drawInfoBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(newSize), gl::Buffer::MAP_WRITE);
+	}
+	void* drawInfoData = m_drawInfoBuffer->Map(gl::Buffer::MapType::WRITE, gl::Buffer::MapWriteFlag::INVALIDATE_BUFFER);
+	memcpy(drawInfoData, m_drawInfos.data(), drawInfoBufferSize);
+	m_drawInfoBuffer->Unmap();
+
+	return true;
+}
+
+void VisibilityBuffer::BuildSceneGeometry(const std::vector<const Model*>& models)
+{
+	m_sceneModels = models;
+	m_sceneGeometryOffsets.clear();
+	// Textures of the old scene are not needed anymore.
+	ReleaseBindlessHandles();
+
+	std::uint32_t numVertices = 0;
+	std::uint32_t numIndices = 0;
+	unsigned int maxNumTrianglesPerMesh = 1;
+	for (const Model* model : models)
+	{
+		m_sceneGeometryOffsets[model] = GeometryOffset{ numVertices, numIndices };
+		numVertices += model->GetNumVertices();
+		numIndices += model->GetNumTriangles() * 3;
+
+		for (const Model::Mesh& mesh : model->GetMeshes())
+			maxNumTrianglesPerMesh = ei::max(maxNumTrianglesPerMesh, mesh.numIndices / 3);
+	}
+	m_triangleBits = ei::max(1, static_cast<int>(ceil(log2(maxNumTrianglesPerMesh))));
+
+	if (numVertices == 0)
+	{
+		m_sceneVertexBuffer.reset();
+		m_sceneIndexBuffer.reset();
+		return;
+	}
+
+	m_sceneVertexBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(Model::Vertex) * numVertices), gl::Buffer::IMMUTABLE);
+	m_sceneIndexBuffer = std::make_unique<gl::Buffer>(static_cast<std::uint32_t>(sizeof(std::uint32_t) * numIndices), gl::Buffer::IMMUTABLE);
+	for (const Model* model : models)
+	{
+		const GeometryOffset& geometryOffset = m_sceneGeometryOffsets[model];
+		GL_CALL(glCopyNamedBufferSubData, model->GetVertexBuffer().GetInternHandle(), m_sceneVertexBuffer->GetInternHandle(),
+					0, sizeof(Model::Vertex) * geometryOffset.baseVertex, sizeof(Model::Vertex) * model->GetNumVertices());
+		GL_CALL(glCopyNamedBufferSubData, model->GetIndexBuffer().GetInternHandle(), m_sceneIndexBuffer->GetInternHandle(),
+					0, sizeof(std::uint32_t) * geometryOffset.baseIndex, sizeof(std::uint32_t) * model->GetNumTriangles() * 3);
+	}
+
+	LOG_INFO("Built visibility buffer scene geometry with " << numVertices << " vertices and " << numIndices / 3 << " triangles. Using " << m_triangleBits << " bits for triangle ids.");
+}
+
+std::uint64_t VisibilityBuffer::GetBindlessHandle(const std::shared_ptr<gl::Texture2D>& texture)
+{
+	auto it = m_bindlessHandles.find(texture.get());
+	if (it != m_bindlessHandles.end())
+		return it->second.handle;
+
+	// Handles are unique per texture/sampler pair, so it may be resident already.
+	GLuint64 handle = glGetTextureSamplerHandleARB(texture->GetInternHandle(), m_bindlessSampler);
+	if (!glIsTextureHandleResidentARB(handle))
+		GL_CALL(glMakeTextureHandleResidentARB, handle);
+
+	m_bindlessHandles.emplace(texture.get(), BindlessHandle{ texture, handle });
+	return handle;
+}
+
+void VisibilityBuffer::ReleaseBindlessHandles()
+{
+	for (const auto& bindlessHandle : m_bindlessHandles)
+		GL_CALL(glMakeTextureHandleNonResidentARB, bindlessHandle.second.handle);
+	m_bindlessHandles.clear();
+}
+
+void VisibilityBuffer::Draw(const std::vector<Renderer::InstanceBatch>& batches)
+{
+	m_visibilityFBO->Bind(false);
+	const GLuint emptyValue = 0xFFFFFFFF;
+	GL_CALL(glClearBufferuiv, GL_COLOR, 0, &emptyValue);
+	GL_CALL(glClear, GL_DEPTH_BUFFER_BIT);
+
+	if (m_drawInfos.empty())
+		return;
+
+	// Opaque meshes via position only stream first, then alpha tested meshes.
+	for (int alphaTesting = 0; alphaTesting < 2; ++alphaTesting)
+	{
+		m_shaderFill[alphaTesting]->Activate();
+		GL_CALL(glUniform1ui, 1, m_triangleBits);
+		if (alphaTesting)
+			Model::BindVAO();
+		else
+			Model::BindPositionOnlyVAO();
+
+		unsigned int drawBase = 0;
+		for (const Renderer::InstanceBatch& batch : batches)
+		{
+			if (alphaTesting)
+				batch.model->BindBuffers();
+			else
+				batch.model->BindPositionOnlyBuffers();
+
+			for (const Model::Mesh& mesh : batch.model->GetMeshes())
+			{
+				unsigned int meshDrawBase = drawBase;
+				drawBase += batch.instanceCount;
+				if (mesh.alphaTesting != (alphaTesting != 0))
+					continue;
+
+				if (mesh.doubleSided)
+					gl::Disable(gl::Cap::CULL_FACE);
+				else
+					gl::Enable(gl::Cap::CULL_FACE);
+				if (alphaTesting)
+					mesh.diffuse->Bind(0);
+
+				GL_CALL(glUniform1ui, 0, meshDrawBase);
+				GL_CALL(glDrawElementsInstancedBaseInstance, GL_TRIANGLES, mesh.numIndices, GL_UNSIGNED_INT, reinterpret_cast<const void*>(sizeof(std::uint32_t) * mesh.startIndex),
+							batch.instanceCount, batch.firstInstance);
+			}
+		}
+	}
+}
+
+void VisibilityBuffer::Resolve(gl::ScreenAlignedTriangle& screenTriangle)
+{
+	if (m_drawInfos.empty())
+		return;
+
+	m_visibilityTexture->Bind(0);
+	m_samplerNearest.BindSampler(0);
+	m_drawInfoBuffer->BindShaderStorageBuffer(7);
+	m_sceneVertexBuffer->BindShaderStorageBuffer(8);
+	m_sceneIndexBuffer->BindShaderStorageBuffer(9);
+
+	m_shaderResolve->Activate();
+	GL_CALL(glUniform1ui, 0, m_triangleBits);
+
+	// Depth is already written by the visibility pass.
+	gl::Disable(gl::Cap::DEPTH_TEST);
+	gl::SetDepthWrite(false);
+	screenTriangle.Draw();
+	gl::Enable(gl::Cap::DEPTH_TEST);
+	gl::SetDepthWrite(true);
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <ei/vector.hpp>
+#include <glhelper/gl.hpp>
+#include "renderer.hpp"
+#include "../shaderreload/autoreloadshaderptr.hpp"
+
+namespace gl
+{
+	class ShaderObject;
+	class Texture2D;
+	class Buffer;
+	class FramebufferObject;
+	class ScreenAlignedTriangle;
+	class SamplerObject;
+}
+
+/// Alternative way to fill the gbuffer using a visibility buffer.
+///
+/// The scene is rasterized into a single R32UI target that stores a draw id (one per instance and mesh) and the triangle id within the draw.
+/// A full-screen resolve pass reconstructs all vertex attributes and fetches the material, writing the very same targets as fillgbuffer.frag.
+/// The resolve is a fragment pass, since the SRGB8 diffuse target of the gbuffer can not be written with image stores.
+/// All vertices and indices of the scene are copied into a single buffer, textures are accessed via bindless handles (GL_ARB_bindless_texture).
+/// Not exactly self-contained! Submodule for renderer!
+class VisibilityBuffer
+{
+public:
+	VisibilityBuffer();
+	~VisibilityBuffer();
+
+	/// False if GL_ARB_bindless_texture is not available.
+	bool IsSupported() const				{ return m_supported; }
+
+	/// Reloads all shaders with the given geometry settings. See Renderer::ReloadGeometryShaders.
+	void ReloadGeometryShaders(const std::string& settings);
+
+	/// Should be called on screen resize.
+	///
+	/// \param depthBuffer
+	///		Depth buffer that is shared with the gbuffer.
+	void OnScreenResize(const ei::UVec2& newResolution, gl::Texture2D& depthBuffer);
+
+	/// Rebuilds scene geometry if necessary and writes draw infos for the given batches.
+	///
+	/// \param allBatches
+	///		Unculled batches of all entities. Used to detect changes of the set of models.
+	/// \param instanceIndices
+	///		Entity indices the batches refer to.
+	/// \return
+	///		False if there are too many draws to store draw and triangle id in the visibility buffer. Draw and Resolve can not be used then.
+	bool PrepareDraws(const std::vector<Renderer::InstanceBatch>& allBatches, const std::vector<Renderer::InstanceBatch>& batches, const std::vector<std::uint32_t>& instanceIndices);
+
+	/// Clears visibility buffer and depth and draws the batches that were given to PrepareDraws.
+	///
+	/// Expects the instance buffer to be bound and the linear sampler at binding 0 (for alpha testing).
+	void Draw(const std::vector<Renderer::InstanceBatch>& batches);
+
+	/// Writes all gbuffer targets from the visibility buffer. The given gbuffer needs to be bound already.
+	///
+	/// Expects the instance buffer to be bound.
+	void Resolve(gl::ScreenAlignedTriangle& screenTriangle);
+
+private:
+	/// Per instance and mesh. Needs to match VisibilityDraw in visibilitybuffer.glsl
+	struct DrawInfo
+	{
+		std::uint32_t entityIndex;
+		std::uint32_t baseVertex;
+		std::uint32_t firstIndex;
+		std::uint32_t _padding0;
+
+		std::uint64_t diffuseHandle;
+		std::uint64_t normalmapHandle;
+		std::uint64_t roughnessMetallicHandle;
+		std::uint64_t _padding1;
+	};
+
+	/// Copies all vertices and indices of the given models into the scene geometry buffers.
+	void BuildSceneGeometry(const std::vector<const Model*>& models);
+	/// Returns resident bindless handle for the given texture.
+	std::uint64_t GetBindlessHandle(const std::shared_ptr<gl::Texture2D>& texture);
+	/// Makes all bindless handles non resident.
+	void ReleaseBindlessHandles();
+
+	bool m_supported;
+
+	AutoReloadShaderPtr m_shaderFill[2];
+	AutoReloadShaderPtr m_shaderResolve;
+
+	const gl::SamplerObject& m_samplerNearest;
+	/// Sampler object that is baked into all bindless texture handles.
+	GLuint m_bindlessSampler;
+
+	std::unique_ptr<gl::Texture2D> m_visibilityTexture;
+	std::unique_ptr<gl::FramebufferObject> m_visibilityFBO;
+
+	/// Models in the scene geometry buffers in order of the batches.
+	std::vector<const Model*> m_sceneModels;
+	/// Position of a model's vertices/indices in the scene geometry buffers.
+	struct GeometryOffset
+	{
+		std::uint32_t baseVertex;
+		std::uint32_t baseIndex;
+	};
+	std::unordered_map<const Model*, GeometryOffset> m_sceneGeometryOffsets;
+	std::unique_ptr<gl::Buffer> m_sceneVertexBuffer;
+	std::unique_ptr<gl::Buffer> m_sceneIndexBuffer;
+
+	/// Holds a reference to the texture, so that its handle stays valid until it is made non resident.
+	struct BindlessHandle
+	{
+		std::shared_ptr<gl::Texture2D> texture;
+		std::uint64_t handle;
+	};
+	std::unordered_map<const gl::Texture2D*, BindlessHandle> m_bindlessHandles;
+
+	std::vector<DrawInfo> m_drawInfos;
+	std::unique_ptr<gl::Buffer> m_drawInfoBuffer;
+	/// Number of lower bits of a visibility buffer value that store the triangle id.
+	unsigned int m_triangleBits;
+	/// Whether the last PrepareDraws call had too many draws. Avoids repeating the warning every frame.
+	bool m_tooManyDraws;
+};
\ No newline at end of file
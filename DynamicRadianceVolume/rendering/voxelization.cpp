@@ -26,11 +26,7 @@ Voxelization::Voxelization(unsigned int resolution) :
 {
 	m_screenTriangle = std::make_unique<gl::ScreenAlignedTriangle>();
 
-	m_shaderVoxelize = new gl::ShaderObject("voxelization");
-	m_shaderVoxelize->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/voxelize.vert");
-	m_shaderVoxelize->AddShaderFromFile(gl::ShaderObject::ShaderType::GEOMETRY, "shader/voxelize.geom");
-	m_shaderVoxelize->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/voxelize.frag");
-	m_shaderVoxelize->CreateProgram();
+	ReloadGeometryShaders("");
 
 	m_shaderVoxelDebug = new gl::ShaderObject("voxel debug");
 	m_shaderVoxelDebug->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/screenTri.vert");
@@ -52,6 +48,15 @@ Voxelization::~Voxelization()
 {
 }
 
+void Voxelization::ReloadGeometryShaders(const std::string& settings)
+{
+	m_shaderVoxelize = new gl::ShaderObject("voxelization");
+	m_shaderVoxelize->AddShaderFromFile(gl::ShaderObject::ShaderType::VERTEX, "shader/voxelize.vert", settings);
+	m_shaderVoxelize->AddShaderFromFile(gl::ShaderObject::ShaderType::GEOMETRY, "shader/voxelize.geom");
+	m_shaderVoxelize->AddShaderFromFile(gl::ShaderObject::ShaderType::FRAGMENT, "shader/voxelize.frag");
+	m_shaderVoxelize->CreateProgram();
+}
+
 
 void Voxelization::SetResolution(unsigned int resolution)
 {
@@ -122,16 +127,12 @@ void Voxelization::VoxelizeScene(Renderer& renderer)
 			m_voxelSceneTextureTarget->BindImage(0, gl::Texture::ImageAccess::READ_WRITE);
 			m_shaderVoxelize->Activate();
 			Model::BindVAO();
+			renderer.BindInstanceBuffer();
 
-			for (unsigned int entityIndex = 0; entityIndex < renderer.GetScene()->GetEntities().size(); ++entityIndex)
+			for (const Renderer::InstanceBatch& batch : renderer.GetInstanceBatches())
 			{
-				const SceneEntity& entity = renderer.GetScene()->GetEntities()[entityIndex];
-				if (!entity.GetModel())
-					continue;
-
-				renderer.BindObjectUBO(entityIndex);
-				entity.GetModel()->BindBuffers();
-				GL_CALL(glDrawElements, GL_TRIANGLES, entity.GetModel()->GetNumTriangles() * 3, GL_UNSIGNED_INT, nullptr);
+				batch.model->BindBuffers();
+				GL_CALL(glDrawElementsInstancedBaseInstance, GL_TRIANGLES, batch.model->GetNumTriangles() * 3, GL_UNSIGNED_INT, nullptr, batch.instanceCount, batch.firstInstance);
 			}
 
 			// Reset to default (convention)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <ei/vector.hpp>
 #include "camera/camera.hpp"
 #include "../shaderreload/autoreloadshaderptr.hpp"
@@ -30,6 +31,9 @@ public:
 	void SetAdaptionRate(float adaptionRate)	{ m_adaptionRate = adaptionRate; }
 	float GetAdaptionRate() const				{ return m_adaptionRate; }
 
+	/// Reloads voxelization shader with the given geometry settings. See Renderer::ReloadGeometryShaders.
+	void ReloadGeometryShaders(const std::string& settings);
+
 	/// Voxel debug output.
 	void DrawVoxelRepresentation();
 
@@ -0,0 +1,409 @@
+#include "dynamicaabbtree.hpp"
+#include "../utilities/assert.hpp"
+
+#include <limits>
+#include <cmath>
+
+namespace
+{
+	bool IsBoxEqual(const ei::Box& a, const ei::Box& b)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (a.min[i] != b.min[i] || a.max[i] != b.max[i])
+				return false;
+		}
+		return true;
+	}
+
+	bool IsBoxOverlapping(const ei::Box& a, const ei::Box& b)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (a.min[i] > b.max[i] || a.max[i] < b.min[i])
+				return false;
+		}
+		return true;
+	}
+}
+
+DynamicAABBTree::DynamicAABBTree() :
+	m_root(s_invalidNode),
+	m_freeList(s_invalidNode)
+{
+}
+
+DynamicAABBTree::~DynamicAABBTree()
+{
+}
+
+float DynamicAABBTree::SurfaceArea(const ei::Box& box)
+{
+	// Half surface area is sufficient for all comparisons.
+	ei::Vec3 extent = box.max - box.min;
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+int DynamicAABBTree::AllocateNode()
+{
+	int node;
+	if (m_freeList != s_invalidNode)
+	{
+		node = m_freeList;
+		m_freeList = m_nodes[node].parent;
+	}
+	else
+	{
+		node = static_cast<int>(m_nodes.size());
+		m_nodes.emplace_back();
+	}
+
+	m_nodes[node].parent = s_invalidNode;
+	m_nodes[node].children[0] = s_invalidNode;
+	m_nodes[node].children[1] = s_invalidNode;
+	m_nodes[node].userData = 0;
+	return node;
+}
+
+void DynamicAABBTree::FreeNode(int node)
+{
+	m_nodes[node].parent = m_freeList;
+	m_freeList = node;
+}
+
+void DynamicAABBTree::Clear()
+{
+	m_nodes.clear();
+	m_root = s_invalidNode;
+	m_freeList = s_invalidNode;
+}
+
+int DynamicAABBTree::Insert(const ei::Box& box, unsigned int userData)
+{
+	int leaf = AllocateNode();
+	m_nodes[leaf].box = box;
+	m_nodes[leaf].userData = userData;
+
+	if (m_root == s_invalidNode)
+	{
+		m_root = leaf;
+		return leaf;
+	}
+
+	int sibling = FindBestSibling(box);
+	int oldParent = m_nodes[sibling].parent;
+
+	// Careful: Allocation may invalidate references to nodes.
+	int newParent = AllocateNode();
+	m_nodes[newParent].parent = oldParent;
+	m_nodes[newParent].children[0] = sibling;
+	m_nodes[newParent].children[1] = leaf;
+	m_nodes[newParent].box = ei::Box(m_nodes[sibling].box, box);
+	m_nodes[sibling].parent = newParent;
+	m_nodes[leaf].parent = newParent;
+
+	if (oldParent != s_invalidNode)
+	{
+		int childSlot = m_nodes[oldParent].children[0] == sibling ? 0 : 1;
+		m_nodes[oldParent].children[childSlot] = newParent;
+	}
+	else
+		m_root = newParent;
+
+	RefitAndRotate(newParent);
+
+	return leaf;
+}
+
+void DynamicAABBTree::Remove(int leaf)
+{
+	Assert(leaf >= 0 && leaf < static_cast<int>(m_nodes.size()) && m_nodes[leaf].IsLeaf(), "Invalid leaf handle!");
+
+	if (leaf == m_root)
+	{
+		m_root = s_invalidNode;
+		FreeNode(leaf);
+		return;
+	}
+
+	int parent = m_nodes[leaf].parent;
+	int grandParent = m_nodes[parent].parent;
+	int sibling = m_nodes[parent].children[0] == leaf ? m_nodes[parent].children[1] : m_nodes[parent].children[0];
+
+	if (grandParent != s_invalidNode)
+	{
+		int childSlot = m_nodes[grandParent].children[0] == parent ? 0 : 1;
+		m_nodes[grandParent].children[childSlot] = sibling;
+		m_nodes[sibling].parent = grandParent;
+		RefitAndRotate(grandParent);
+	}
+	else
+	{
+		m_root = sibling;
+		m_nodes[sibling].parent = s_invalidNode;
+	}
+
+	FreeNode(parent);
+	FreeNode(leaf);
+}
+
+void DynamicAABBTree::Update(int leaf, const ei::Box& box)
+{
+	Assert(leaf >= 0 && leaf < static_cast<int>(m_nodes.size()) && m_nodes[leaf].IsLeaf(), "Invalid leaf handle!");
+
+	if (IsBoxEqual(m_nodes[leaf].box, box))
+		return;
+
+	m_nodes[leaf].box = box;
+	RefitAndRotate(m_nodes[leaf].parent);
+}
+
+int DynamicAABBTree::FindBestSibling(const ei::Box& box) const
+{
+	// Greedy descent, see Box2D's b2DynamicTree.
+	int node = m_root;
+	while (!m_nodes[node].IsLeaf())
+	{
+		float area = SurfaceArea(m_nodes[node].box);
+		float combinedArea = SurfaceArea(ei::Box(m_nodes[node].box, box));
+
+		// Cost of creating a new parent for this node and the new leaf.
+		float cost = combinedArea;
+		// Minimum cost of pushing the leaf further down the tree.
+		float inheritanceCost = combinedArea - area;
+
+		float childCosts[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			const Node& child = m_nodes[m_nodes[node].children[i]];
+			float childCombinedArea = SurfaceArea(ei::Box(child.box, box));
+			if (child.IsLeaf())
+				childCosts[i] = childCombinedArea + inheritanceCost;
+			else
+				childCosts[i] = childCombinedArea - SurfaceArea(child.box) + inheritanceCost;
+		}
+
+		if (cost < childCosts[0] && cost < childCosts[1])
+			break;
+
+		node = m_nodes[node].children[childCosts[0] < childCosts[1] ? 0 : 1];
+	}
+
+	return node;
+}
+
+void DynamicAABBTree::RefitAndRotate(int node)
+{
+	while (node != s_invalidNode)
+	{
+		Node& current = m_nodes[node];
+		current.box = ei::Box(m_nodes[current.children[0]].box, m_nodes[current.children[1]].box);
+		Rotate(node);
+		node = current.parent;
+	}
+}
+
+void DynamicAABBTree::Rotate(int node)
+{
+	// Possible rotations: Swap a child with a grandchild from the other side.
+	// The box of node itself does not change, only the box of the child that receives the swapped node.
+	int bestChild = s_invalidNode;
+	int bestGrandChildSlot = 0;
+	float bestAreaDiff = 0.0f;
+
+	for (int childSlot = 0; childSlot < 2; ++childSlot)
+	{
+		int swapNode = m_nodes[node].children[childSlot];
+		int otherChild = m_nodes[node].children[1 - childSlot];
+		if (m_nodes[otherChild].IsLeaf())
+			continue;
+
+		float otherChildArea = SurfaceArea(m_nodes[otherChild].box);
+		for (int grandChildSlot = 0; grandChildSlot < 2; ++grandChildSlot)
+		{
+			// After swapping, otherChild contains swapNode and the remaining grandchild.
+			int remainingGrandChild = m_nodes[otherChild].children[1 - grandChildSlot];
+			float areaDiff = SurfaceArea(ei::Box(m_nodes[swapNode].box, m_nodes[remainingGrandChild].box)) - otherChildArea;
+			if (areaDiff < bestAreaDiff)
+			{
+				bestAreaDiff = areaDiff;
+				bestChild = childSlot;
+				bestGrandChildSlot = grandChildSlot;
+			}
+		}
+	}
+
+	if (bestChild == s_invalidNode)
+		return;
+
+	int swapNode = m_nodes[node].children[bestChild];
+	int otherChild = m_nodes[node].children[1 - bestChild];
+	int grandChild = m_nodes[otherChild].children[bestGrandChildSlot];
+
+	m_nodes[node].children[bestChild] = grandChild;
+	m_nodes[grandChild].parent = node;
+	m_nodes[otherChild].children[bestGrandChildSlot] = swapNode;
+	m_nodes[swapNode].parent = otherChild;
+	m_nodes[otherChild].box = ei::Box(m_nodes[m_nodes[otherChild].children[0]].box, m_nodes[m_nodes[otherChild].children[1]].box);
+}
+
+void DynamicAABBTree::ReportSubtree(int node, const QueryCallback& callback) const
+{
+	std::vector<int> stack;
+	stack.push_back(node);
+	while (!stack.empty())
+	{
+		const Node& current = m_nodes[stack.back()];
+		stack.pop_back();
+
+		if (current.IsLeaf())
+			callback(current.userData);
+		else
+		{
+			stack.push_back(current.children[0]);
+			stack.push_back(current.children[1]);
+		}
+	}
+}
+
+DynamicAABBTree::Frustum DynamicAABBTree::ExtractFrustum(const ei::Mat4x4& viewProjection)
+{
+	// Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix"
+	ei::Vec4 rows[4];
+	for (int r = 0; r < 4; ++r)
+		rows[r] = ei::Vec4(viewProjection(r, 0), viewProjection(r, 1), viewProjection(r, 2), viewProjection(r, 3));
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; // left
+	frustum.planes[1] = rows[3] - rows[0]; // right
+	frustum.planes[2] = rows[3] + rows[1]; // bottom
+	frustum.planes[3] = rows[3] - rows[1]; // top
+	frustum.planes[4] = rows[2];		   // z >= 0
+	frustum.planes[5] = rows[3] - rows[2]; // z <= w
+
+	for (ei::Vec4& plane : frustum.planes)
+		plane /= ei::len(ei::Vec3(plane.x, plane.y, plane.z));
+
+	return frustum;
+}
+
+void DynamicAABBTree::QueryBox(const ei::Box& box, const QueryCallback& callback) const
+{
+	if (m_root == s_invalidNode)
+		return;
+
+	std::vector<int> stack;
+	stack.push_back(m_root);
+	while (!stack.empty())
+	{
+		const Node& current = m_nodes[stack.back()];
+		stack.pop_back();
+
+		if (!IsBoxOverlapping(current.box, box))
+			continue;
+
+		if (current.IsLeaf())
+			callback(current.userData);
+		else
+		{
+			stack.push_back(current.children[0]);
+			stack.push_back(current.children[1]);
+		}
+	}
+}
+
+void DynamicAABBTree::QueryFrustum(const Frustum& frustum, const QueryCallback& callback) const
+{
+	if (m_root == s_invalidNode)
+		return;
+
+	// Every node carries a mask of planes it still needs to be tested against. Planes are dropped once a box is entirely inside.
+	const unsigned int allPlanes = (1 << 6) - 1;
+	std::vector<std::pair<int, unsigned int>> stack;
+	stack.push_back(std::make_pair(m_root, allPlanes));
+	while (!stack.empty())
+	{
+		int node = stack.back().first;
+		unsigned int planeMask = stack.back().second;
+		stack.pop_back();
+
+		const Node& current = m_nodes[node];
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; ++p)
+		{
+			if ((planeMask & (1 << p)) == 0)
+				continue;
+
+			const ei::Vec4& plane = frustum.planes[p];
+			ei::Vec3 positiveVertex, negativeVertex;
+			for (int i = 0; i < 3; ++i)
+			{
+				positiveVertex[i] = plane[i] >= 0.0f ? current.box.max[i] : current.box.min[i];
+				negativeVertex[i] = plane[i] >= 0.0f ? current.box.min[i] : current.box.max[i];
+			}
+
+			if (ei::dot(ei::Vec3(plane.x, plane.y, plane.z), positiveVertex) + plane.w < 0.0f)
+				outside = true;
+			else if (ei::dot(ei::Vec3(plane.x, plane.y, plane.z), negativeVertex) + plane.w >= 0.0f)
+				planeMask &= ~(1 << p);
+		}
+
+		if (outside)
+			continue;
+
+		if (planeMask == 0)
+			ReportSubtree(node, callback);
+		else if (current.IsLeaf())
+			callback(current.userData);
+		else
+		{
+			stack.push_back(std::make_pair(current.children[0], planeMask));
+			stack.push_back(std::make_pair(current.children[1], planeMask));
+		}
+	}
+}
+
+void DynamicAABBTree::QueryCone(const ei::Vec3& apex, const ei::Vec3& direction, float halfAngle, float range, const QueryCallback& callback) const
+{
+	if (m_root == s_invalidNode)
+		return;
+
+	std::vector<int> stack;
+	stack.push_back(m_root);
+	while (!stack.empty())
+	{
+		const Node& current = m_nodes[stack.back()];
+		stack.pop_back();
+
+		// Test bounding sphere of the box against the cone.
+		ei::Vec3 toCenter = (current.box.min + current.box.max) * 0.5f - apex;
+		float radius = ei::len(current.box.max - current.box.min) * 0.5f;
+		float distance = ei::len(toCenter);
+
+		bool intersects = true;
+		if (distance > radius)
+		{
+			// Sphere is entirely behind range?
+			if (distance - radius > range)
+				intersects = false;
+			else
+			{
+				// The sphere covers asin(radius / distance) around its center as seen from the apex.
+				float maxAngle = halfAngle + asinf(radius / distance);
+				if (maxAngle < ei::PI)
+					intersects = ei::dot(toCenter, direction) >= cosf(maxAngle) * distance;
+			}
+		}
+
+		if (!intersects)
+			continue;
+
+		if (current.IsLeaf())
+			callback(current.userData);
+		else
+		{
+			stack.push_back(current.children[0]);
+			stack.push_back(current.children[1]);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <ei/vector.hpp>
+#include <ei/3dtypes.hpp>
+
+/// Dynamic bounding volume hierarchy of axis aligned boxes.
+///
+/// Leaves are inserted incrementally using the surface area heuristic. Updating a leaf refits all its ancestors and applies
+/// local tree rotations on the way up, so that the tree quality does not degrade with moving objects.
+/// See Kopta et al. 2012, "Fast, Effective BVH Updates for Animated Scenes".
+/// Internal nodes are always tight, so the root box is the exact bounding box of all leaves.
+class DynamicAABBTree
+{
+public:
+	static const int s_invalidNode = -1;
+
+	DynamicAABBTree();
+	~DynamicAABBTree();
+
+	/// Inserts a new leaf and returns its node handle.
+	int Insert(const ei::Box& box, unsigned int userData);
+	/// Removes a leaf that was previously returned by Insert.
+	void Remove(int leaf);
+	/// Sets new box of a leaf. Does nothing if the box did not change.
+	void Update(int leaf, const ei::Box& box);
+	/// Removes all nodes.
+	void Clear();
+
+	bool IsEmpty() const						{ return m_root == s_invalidNode; }
+	/// Box of all leaves. Not valid if the tree is empty!
+	const ei::Box& GetRootBox() const			{ return m_nodes[m_root].box; }
+	const ei::Box& GetBox(int node) const		{ return m_nodes[node].box; }
+	unsigned int GetUserData(int leaf) const	{ return m_nodes[leaf].userData; }
+
+
+	/// Six planes with normals pointing inwards: dot(plane.xyz, p) + plane.w >= 0 for all points p inside.
+	struct Frustum
+	{
+		ei::Vec4 planes[6];
+	};
+	/// Extracts frustum from a DirectX style view projection matrix (clip space z from 0 to w, either depth direction).
+	static Frustum ExtractFrustum(const ei::Mat4x4& viewProjection);
+
+	typedef std::function<void(unsigned int userData)> QueryCallback;
+
+	// All queries are conservative and call the callback once for every leaf whose box might intersect the query volume.
+
+	void QueryBox(const ei::Box& box, const QueryCallback& callback) const;
+	void QueryFrustum(const Frustum& frustum, const QueryCallback& callback) const;
+	/// Cone given by its apex, normalized direction and half angle. Everything further than range from the apex is ignored.
+	void QueryCone(const ei::Vec3& apex, const ei::Vec3& direction, float halfAngle, float range, const QueryCallback& callback) const;
+
+private:
+	struct Node
+	{
+		ei::Box box;
+		int parent;			///< Next free node if the node is unused.
+		int children[2];	///< s_invalidNode for leaves.
+		unsigned int userData;
+
+		bool IsLeaf() const { return children[0] == s_invalidNode; }
+	};
+
+	int AllocateNode();
+	void FreeNode(int node);
+
+	/// Finds best sibling for a new leaf using the surface area heuristic.
+	int FindBestSibling(const ei::Box& box) const;
+
+	/// Refits all nodes from the given one up to the root and tries to improve the tree via rotations along the way.
+	void RefitAndRotate(int node);
+	/// Tries all four possible rotations between children and grandchildren of node and applies the one with the largest surface area reduction.
+	void Rotate(int node);
+
+	/// Calls callback for all leaves below the given node.
+	void ReportSubtree(int node, const QueryCallback& callback) const;
+
+	static float SurfaceArea(const ei::Box& box);
+
+	std::vector<Node> m_nodes;
+	int m_root;
+	int m_freeList;
+};
\ No newline at end of file
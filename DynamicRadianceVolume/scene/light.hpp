@@ -8,7 +8,7 @@ class ezTime;
 struct Light
 {
 public:
-	Light() : type(Type::SPOT), intensity(10.0f), position(0.0f), direction(0.0f, 0.0f, 1.0f), halfAngle(0.5f),
+	Light() : type(Type::SPOT), intensity(10.0f), position(0.0f), direction(0.0f, 0.0f, 1.0f), halfAngle(0.5f), range(100.0f),
 		rsmResolution(1024), rsmReadLod(4),
 		normalOffsetShadowBias(0.01f), shadowBias(0.0001f),
 		indirectShadowComputationLod(2),
@@ -31,6 +31,9 @@ public:
 	ei::Vec3 direction;
 
 	float halfAngle;
+	/// Distance at which the light's contribution fades out completely. Bounds light volumes and clustered light culling.
+	/// Only light volumes and clustered shading fade out the light, all other paths ignore the range.
+	float range;
 
 	unsigned int rsmResolution; // Only Pow2 resolutions are allowed
 	unsigned int rsmReadLod;
@@ -14,6 +14,7 @@
 #include <assimp/postprocess.h>
 
 std::unique_ptr<gl::VertexArrayObject> Model::m_vertexArrayObject;
+std::unique_ptr<gl::VertexArrayObject> Model::m_positionOnlyVertexArrayObject;
 const unsigned int Model::m_rawModelVersion = 2;
 
 Model::Model(const std::string& originFilename) :
@@ -213,17 +214,40 @@ std::shared_ptr<Model> Model::LoadFromRaw(const std::string& filename, const std
 	std::unique_ptr<char[]> vertexData(new char[numBytes]);
 	rawbufferFile.read(vertexData.get(), numBytes);
 	outModel->m_vertexBuffer.reset(new gl::Buffer(numBytes, gl::Buffer::UsageFlag::IMMUTABLE, vertexData.get()));
-	vertexData.reset();
 
 	numBytes = outModel->GetNumTriangles() * sizeof(std::uint32_t) * 3;
 	std::unique_ptr<char[]> indexData(new char[numBytes]);
 	rawbufferFile.read(indexData.get(), numBytes);
 	outModel->m_indexBuffer.reset(new gl::Buffer(numBytes, gl::Buffer::UsageFlag::IMMUTABLE, indexData.get()));
-	indexData.reset();
+
+	outModel->ComputeMeshBoundingBoxes(reinterpret_cast<const Vertex*>(vertexData.get()), reinterpret_cast<const std::uint32_t*>(indexData.get()));
+	outModel->CreatePositionBuffer(reinterpret_cast<const Vertex*>(vertexData.get()));
 
 	return outModel;
 }
 
+void Model::ComputeMeshBoundingBoxes(const Vertex* vertices, const std::uint32_t* indices)
+{
+	for (Mesh& mesh : m_meshes)
+	{
+		mesh.boundingBox.min = ei::Vec3(std::numeric_limits<float>::max());
+		mesh.boundingBox.max = ei::Vec3(-std::numeric_limits<float>::max());
+		for (unsigned int i = mesh.startIndex; i < mesh.startIndex + mesh.numIndices; ++i)
+		{
+			mesh.boundingBox.min = ei::min(mesh.boundingBox.min, vertices[indices[i]].position);
+			mesh.boundingBox.max = ei::max(mesh.boundingBox.max, vertices[indices[i]].position);
+		}
+	}
+}
+
+void Model::CreatePositionBuffer(const Vertex* vertices)
+{
+	std::unique_ptr<ei::Vec3[]> positions(new ei::Vec3[m_numVertices]);
+	for (unsigned int v = 0; v < m_numVertices; ++v)
+		positions[v] = vertices[v].position;
+	m_positionBuffer.reset(new gl::Buffer(sizeof(ei::Vec3) * m_numVertices, gl::Buffer::UsageFlag::IMMUTABLE, positions.get()));
+}
+
 std::shared_ptr<Model> Model::LoadViaAssimp(const std::string& filename, const std::string& directory, 
 											std::unique_ptr<Vertex[]>& outVertices, std::unique_ptr<std::uint32_t[]>& outIndices)
 {
@@ -374,6 +398,9 @@ std::shared_ptr<Model> Model::LoadViaAssimp(const std::string& filename, const s
 	}
 	output->m_indexBuffer.reset(new gl::Buffer(sizeof(std::uint32_t) * output->m_numTriangles * 3, gl::Buffer::UsageFlag::IMMUTABLE, outIndices.get()));
 
+	output->ComputeMeshBoundingBoxes(outVertices.get(), outIndices.get());
+	output->CreatePositionBuffer(outVertices.get());
+
 	// Load textures / material properties
 	if (scene->HasMaterials())
 	{
@@ -494,11 +521,16 @@ void Model::CreateVAO()
 		Attribute(Attribute::Type::FLOAT, 1),
 		Attribute(Attribute::Type::FLOAT, 2),
 	}));
+
+	m_positionOnlyVertexArrayObject.reset(new gl::VertexArrayObject({
+		Attribute(Attribute::Type::FLOAT, 3),
+	}));
 }
 
 void Model::DestroyVAO()
 {
 	m_vertexArrayObject.reset();
+	m_positionOnlyVertexArrayObject.reset();
 }
 
 void Model::BindVAO()
@@ -506,8 +538,19 @@ void Model::BindVAO()
 	m_vertexArrayObject->Bind();
 }
 
+void Model::BindPositionOnlyVAO()
+{
+	m_positionOnlyVertexArrayObject->Bind();
+}
+
 void Model::BindBuffers()
 {
 	m_vertexBuffer->BindVertexBuffer(0, 0, static_cast<GLsizei>(sizeof(Vertex)));
 	m_indexBuffer->BindIndexBuffer();
+}
+
+void Model::BindPositionOnlyBuffers()
+{
+	m_positionBuffer->BindVertexBuffer(0, 0, static_cast<GLsizei>(sizeof(ei::Vec3)));
+	m_indexBuffer->BindIndexBuffer();
 }
\ No newline at end of file
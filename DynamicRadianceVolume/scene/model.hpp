@@ -45,6 +45,9 @@ public:
 		unsigned int startIndex;
 		unsigned int numIndices;
 
+		/// Object space bounding box of all vertices referenced by this mesh.
+		ei::Box boundingBox;
+
 		std::shared_ptr<gl::Texture2D> diffuse;
 		std::shared_ptr<gl::Texture2D> normalmap;	// Tangent space normals RGB -> XZY*2.0 - 1.0
 		std::shared_ptr<gl::Texture2D> roughnessMetallic; // Combined texture of roughness (R) and metallic values (G)
@@ -75,9 +78,18 @@ public:
 	static void CreateVAO();
 	static void DestroyVAO();
 	static void BindVAO();
+	/// Binds vertex array object with only a single position attribute.
+	static void BindPositionOnlyVAO();
 
 	/// Binds vertex and index buffer.
 	void BindBuffers();
+	/// Binds position only vertex buffer and index buffer. See BindPositionOnlyVAO.
+	void BindPositionOnlyBuffers();
+
+	/// Vertex buffer with tightly packed Vertex structs.
+	const gl::Buffer& GetVertexBuffer() const { return *m_vertexBuffer; }
+	/// Index buffer with 32bit indices, relative to the model's first vertex.
+	const gl::Buffer& GetIndexBuffer() const { return *m_indexBuffer; }
 
 private:
 	Model(const std::string& originFilename);
@@ -96,7 +108,13 @@ private:
 	static std::shared_ptr<Model> LoadViaAssimp(const std::string& filename, const std::string& directory, 
 												std::unique_ptr<Vertex[]>& outVertices, std::unique_ptr<std::uint32_t[]>& outIndices);
 
+	/// Computes bounding boxes of all meshes from the given vertex and index data.
+	void ComputeMeshBoundingBoxes(const Vertex* vertices, const std::uint32_t* indices);
+	/// Creates the position only vertex buffer from the given vertex data.
+	void CreatePositionBuffer(const Vertex* vertices);
+
 	static std::unique_ptr<gl::VertexArrayObject> m_vertexArrayObject;
+	static std::unique_ptr<gl::VertexArrayObject> m_positionOnlyVertexArrayObject;
 
 	const std::string m_originFilename;
 
@@ -106,6 +124,7 @@ private:
 	unsigned int m_numVertices;
 
 	std::unique_ptr<gl::Buffer> m_vertexBuffer;
+	std::unique_ptr<gl::Buffer> m_positionBuffer; ///< Positions only, for depth only passes.
 	std::unique_ptr<gl::Buffer> m_indexBuffer;
 
 	ei::Box m_boundingBox;
@@ -31,20 +31,42 @@ void Scene::Update(ezTime timeSinceLastUpdate)
 		it.Update(timeSinceLastUpdate);
 	}
 
-	UpdateBoundingbox();
+	UpdateBVH();
 }
 
-void Scene::UpdateBoundingbox()
+void Scene::UpdateBVH()
 {
-	m_boundingBox.min = ei::Vec3(std::numeric_limits<float>::max());
-	m_boundingBox.max = ei::Vec3(-std::numeric_limits<float>::max());
+	// Entities may have been removed since last update.
+	for (size_t i = m_entities.size(); i < m_entityBVHLeaves.size(); ++i)
+	{
+		if (m_entityBVHLeaves[i] != DynamicAABBTree::s_invalidNode)
+			m_bvh.Remove(m_entityBVHLeaves[i]);
+	}
+	m_entityBVHLeaves.resize(m_entities.size(), DynamicAABBTree::s_invalidNode);
 
-	for (auto& it : m_entities)
+	for (size_t i = 0; i < m_entities.size(); ++i)
 	{
-		if (it.GetModel())
+		int& leaf = m_entityBVHLeaves[i];
+		if (m_entities[i].GetModel())
 		{
-			m_boundingBox = ei::Box(m_boundingBox, ei::Box(it.GetModel()->GetBoundingBox().min * it.GetScale() + it.GetPosition(), 
-															it.GetModel()->GetBoundingBox().max * it.GetScale() + it.GetPosition()));
+			ei::Box worldBox = m_entities[i].ComputeWorldBoundingBox();
+			if (leaf == DynamicAABBTree::s_invalidNode)
+				leaf = m_bvh.Insert(worldBox, static_cast<unsigned int>(i));
+			else
+				m_bvh.Update(leaf, worldBox);
 		}
+		else if (leaf != DynamicAABBTree::s_invalidNode)
+		{
+			m_bvh.Remove(leaf);
+			leaf = DynamicAABBTree::s_invalidNode;
+		}
+	}
+
+	if (m_bvh.IsEmpty())
+	{
+		m_boundingBox.min = ei::Vec3(std::numeric_limits<float>::max());
+		m_boundingBox.max = ei::Vec3(-std::numeric_limits<float>::max());
 	}
+	else
+		m_boundingBox = m_bvh.GetRootBox();
 }
\ No newline at end of file
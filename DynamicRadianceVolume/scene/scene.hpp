@@ -8,6 +8,7 @@
 
 #include "light.hpp"
 #include "sceneentity.hpp"
+#include "dynamicaabbtree.hpp"
 
 #include "Time/Time.h"
 
@@ -36,11 +37,19 @@ public:
 
 	const ei::Box& GetBoundingBox() const { return m_boundingBox; }
 
+	/// Bounding volume hierarchy over all entities with a model. User data of each leaf is the entity index.
+	const DynamicAABBTree& GetBVH() const { return m_bvh; }
+
 private:
-	void UpdateBoundingbox();
+	/// Inserts, moves and removes BVH leaves to match the current entity list and updates the scene bounding box.
+	void UpdateBVH();
 
 	std::vector<SceneEntity> m_entities;
 	std::vector<Light> m_lights;
 	ei::Box m_boundingBox;
+
+	DynamicAABBTree m_bvh;
+	/// BVH leaf for every entity, DynamicAABBTree::s_invalidNode for entities without model.
+	std::vector<int> m_entityBVHLeaves;
 };
 
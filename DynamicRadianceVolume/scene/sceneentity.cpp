@@ -31,4 +31,23 @@ void SceneEntity::Update(ezTime timeSinceLastUpdate)
 ei::Mat4x4 SceneEntity::ComputeWorldMatrix() const
 {
 	return ei::translation(m_position) * ei::rotationH(m_orientation) * ei::scalingH(m_scale);
+}
+
+ei::Box SceneEntity::ComputeWorldBoundingBox() const
+{
+	// Transform box center and project the transformed half extents back onto the world axes.
+	ei::Mat4x4 world = ComputeWorldMatrix();
+	const ei::Box& localBox = m_model->GetBoundingBox();
+	ei::Vec3 localCenter = (localBox.min + localBox.max) * 0.5f;
+	ei::Vec3 localHalfExtent = (localBox.max - localBox.min) * 0.5f;
+
+	ei::Vec3 center = ei::transform(localCenter, world);
+	ei::Vec3 halfExtent(0.0f);
+	for (int r = 0; r < 3; ++r)
+	{
+		for (int c = 0; c < 3; ++c)
+			halfExtent[r] += fabsf(world(r, c)) * localHalfExtent[c];
+	}
+
+	return ei::Box(center - halfExtent, center + halfExtent);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <string>
 #include <memory>
 #include <ei/vector.hpp>
+#include <ei/3dtypes.hpp>
 
 #include "Time/Time.h"
 
@@ -16,6 +17,8 @@ public:
 
 	void Update(ezTime timeSinceLastUpdate);
 	ei::Mat4x4 ComputeWorldMatrix() const;
+	/// Computes world space bounding box of the (rotated and scaled) model box. Invalid if there is no model.
+	ei::Box ComputeWorldBoundingBox() const;
 
 	/// Returns true if successful
 	bool LoadModel(const std::string& modelFilename);
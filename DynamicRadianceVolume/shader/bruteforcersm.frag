@@ -42,15 +42,18 @@ void main()
 	OutputColor = vec3(0.0);
 
 	ivec2 rsmSamplePos = ivec2(0);
-	for(; rsmSamplePos.x<RSMReadResolution; ++rsmSamplePos.x)
+	for(; rsmSamplePos.x<SpotLights[LightIndex].RSMReadResolution; ++rsmSamplePos.x)
 	{
 		rsmSamplePos.y = 0;
-		for(; rsmSamplePos.y<RSMReadResolution; ++rsmSamplePos.y)
+		for(; rsmSamplePos.y<SpotLights[LightIndex].RSMReadResolution; ++rsmSamplePos.y)
 		{
 			
-			float lightDepth = texelFetch(RSM_DepthLinSq, rsmSamplePos, 0).r;
-			vec4 rsmClipSpace = vec4((rsmSamplePos + vec2(0.5)) / RSMReadResolution * 2.0 - vec2(1.0), 0.0, 1.0) * InverseLightViewProjection;
-			vec3 valPosition = LightPosition + normalize(rsmClipSpace.xyz / rsmClipSpace.w - LightPosition) * lightDepth;
+			vec2 rsmTexcoord = (rsmSamplePos + vec2(0.5)) / SpotLights[LightIndex].RSMReadResolution;
+			vec2 rsmAtlasTexcoord = GetRSMAtlasTexcoord(rsmTexcoord);
+
+			float lightDepth = textureLod(RSM_DepthLinSq, rsmAtlasTexcoord, SpotLights[LightIndex].RSMReadLod).r;
+			vec4 rsmClipSpace = vec4(rsmTexcoord * 2.0 - vec2(1.0), 0.0, 1.0) * SpotLights[LightIndex].InverseViewProjection;
+			vec3 valPosition = SpotLights[LightIndex].Position + normalize(rsmClipSpace.xyz / rsmClipSpace.w - SpotLights[LightIndex].Position) * lightDepth;
 
 
 			// Direction and distance to light.
@@ -62,15 +65,15 @@ void main()
 			float cosTheta = saturate(dot(toVal, worldNormal));
 
 			// Light intensity
-			vec3 valTotalExitantFlux = texelFetch(RSM_Flux, rsmSamplePos, 0).rgb; // Actually this is flux divided with PI!
-			vec3 valNormal = UnpackNormal16I(texelFetch(RSM_Normal, rsmSamplePos, 0).xy);
+			vec3 valTotalExitantFlux = textureLod(RSM_Flux, rsmAtlasTexcoord, SpotLights[LightIndex].RSMReadLod).rgb; // Actually this is flux divided with PI!
+			vec3 valNormal = UnpackNormal16I(textureLod(RSM_Normal, rsmAtlasTexcoord, SpotLights[LightIndex].RSMReadLod).xy);
 
 
 			
 			// Handle light as disc with area. This can be computed analytically for the diffuse term.
-			vec3 valToLight = valPosition.xyz - LightPosition;
+			vec3 valToLight = valPosition.xyz - SpotLights[LightIndex].Position;
 			float valToLightDistSq = dot(valToLight, valToLight); // todo: Compute directly from lightDepth
-			float valArea = valToLightDistSq * ValAreaFactor;
+			float valArea = valToLightDistSq * SpotLights[LightIndex].ValAreaFactor;
 			float fluxToIntensity = saturate(dot(valNormal, -toVal));
 			float fluxToIrradiance = fluxToIntensity * cosTheta / (lightDistanceSq + valArea);
 		//	float fluxToIrradiance = fluxToIntensity * cosTheta / (lightDistanceSq); // VPL instead of VAL
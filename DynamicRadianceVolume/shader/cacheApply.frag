@@ -12,7 +12,11 @@
 #define LIGHTCACHEMODE LIGHTCACHEMODE_APPLY
 #include "lightcache.glsl"
 
+#ifdef LIGHTCACHE_HASHMAP
+#include "lightcachehashmap.glsl"
+#else
 layout(binding=4) uniform usampler3D VoxelAddressVolume;
+#endif
 layout(binding=6) uniform sampler2D CacheSpecularEnvmap;
 
 in vec2 Texcoord;
@@ -74,6 +78,7 @@ vec3 ComputeLightingFromCaches(vec3 worldPosition, vec3 worldNormal, int address
 
 	vec3 interpolatedIrradiance = vec3(0);
 	vec3 interpolatedSpecular = vec3(0);
+	float missingWeight = 0.0; // Cells without cache due to hash map or allocation overflow.
 
 	#ifdef INDDIFFUSE_VIA_H
 		const float factor0 = 1.0 / (2.0 * PI);
@@ -85,10 +90,20 @@ vec3 ComputeLightingFromCaches(vec3 worldPosition, vec3 worldNormal, int address
 
 	for(int i=0; i<8; ++i)
 	{
+	#ifdef LIGHTCACHE_HASHMAP
+		uint cacheAddress = LightCacheHashMapLookup(ComputeLightCacheHashMapKey(addressCoord00 + offsets[i], addressVolumeCascade));
+	#else
 		ivec3 cacheSamplePos = addressCoord00 + offsets[i]; //, ivec3(0), ivec3(AddressVolumeResolution-1));
 		cacheSamplePos.x += AddressVolumeResolution * addressVolumeCascade;		
 
 		uint cacheAddress = texelFetch(VoxelAddressVolume, cacheSamplePos, 0).r;
+	#endif
+		// Zero means "no cache" - either the hash map was full or the cell was dropped by the allocation.
+		if(cacheAddress == 0)
+		{
+			missingWeight += weights[i];
+			continue;
+		}
 
 		// Check if address is valid. (debug code!)
 		/*if(cacheAddress == 0 || cacheAddress == 0xFFFFFFFF || 
@@ -110,6 +125,10 @@ vec3 ComputeLightingFromCaches(vec3 worldPosition, vec3 worldNormal, int address
 		interpolatedIrradiance += irradiance * weights[i];
 	}
 
+	float renormalization = 1.0 / max(1.0 - missingWeight, 0.0001);
+	interpolatedIrradiance *= renormalization;
+	interpolatedSpecular *= renormalization;
+
 #ifndef INDIRECT_SPECULAR
 	return interpolatedIrradiance * diffuseColor / PI;
 #else
@@ -0,0 +1,164 @@
+// Cache initialization shared by cacheGather.comp and the sorted cache allocation (see sortedcacheallocation/allocatecaches.comp).
+// Expects globalubos.glsl and lightcache.glsl with LIGHTCACHEMODE_CREATE to be included before.
+
+#ifdef LIGHTCACHE_HASHMAP
+#include "lightcachehashmap.glsl"
+
+layout(std430, binding = 17) restrict readonly buffer PreviousLightCacheHashMapBuffer
+{
+	LightCacheHashMapEntry PreviousLightCacheHashMapEntries[];
+};
+#else
+layout(binding = 0, r32ui) restrict coherent uniform uimage3D VoxelAddressVolume;
+#endif
+
+// Caches are persistent per world space cell: A newly allocated cache takes the lighting of the last frame's cache in the same cell and cascade.
+// Only caches that are new, due for their periodic relight or close to a changed light or entity are added to the relight list.
+// With SAMPLED_VALS every cache is relit and the previous lighting is the history of the temporal accumulation instead (see cacheResolveLighting.comp).
+#ifndef LIGHTCACHE_HASHMAP
+layout(binding = 1, r32ui) restrict readonly uniform uimage3D PreviousVoxelAddressVolume;
+#endif
+layout(std430, binding = 2) restrict readonly buffer PreviousLightCacheBuffer
+{
+	LightCacheEntry[] PreviousLightCacheEntries;
+};
+
+#define MAX_NUM_FORCE_RELIGHT_SPHERES 16
+
+layout(location = 0) uniform bool ReusePreviousCaches;
+layout(location = 1) uniform uint RelightPeriod;	// Every reused cache is relit at least every RelightPeriod frames.
+layout(location = 2) uniform uint RelightPhase;		// Frame counter for round-robin relighting.
+layout(location = 3) uniform uint NumForceRelightSpheres;
+layout(location = 4) uniform vec3 PreviousAddressVolumeMin[MAX_NUM_ADDRESS_VOLUME_CASCADES];	// Cascade min of the previous address volume.
+layout(location = 8) uniform vec4 ForceRelightSpheres[MAX_NUM_FORCE_RELIGHT_SPHERES];		// Center and radius around changed lights and entities.
+
+// Returns index + 1 of the previous frame's cache at the given cell or zero if there was none.
+uint GetPreviousCache(vec3 cachePosition, int addressVolumeCascade)
+{
+	ivec3 previousAddressCoord = ivec3(round((cachePosition - PreviousAddressVolumeMin[addressVolumeCascade]) / AddressVolumeCascades[addressVolumeCascade].WorldVoxelSize));
+#ifdef LIGHTCACHE_HASHMAP
+	// Keys cover cells up to one cell outside of the cascade, see ComputeLightCacheHashMapKey.
+	if(any(lessThan(previousAddressCoord, ivec3(0))) || any(greaterThan(previousAddressCoord, ivec3(AddressVolumeResolution))))
+		return 0;
+
+	// Same probing as LightCacheHashMapLookup.
+	uint key = ComputeLightCacheHashMapKey(previousAddressCoord, addressVolumeCascade);
+	uint slot = LightCacheHashMapHash(key) & (LightCacheHashMapSize - 1);
+	for(int probe=0; probe<LIGHTCACHE_HASHMAP_MAX_PROBES; ++probe)
+	{
+		uint slotKey = PreviousLightCacheHashMapEntries[slot].Key;
+		if(slotKey == key)
+			return PreviousLightCacheHashMapEntries[slot].Value;
+		if(slotKey == LIGHTCACHE_HASHMAP_EMPTY_KEY)
+			return 0;
+		slot = (slot + 1) & (LightCacheHashMapSize - 1);
+	}
+	return 0;
+#else
+	if(any(lessThan(previousAddressCoord, ivec3(0))) || any(greaterThanEqual(previousAddressCoord, ivec3(AddressVolumeResolution))))
+		return 0;
+
+	previousAddressCoord.x += addressVolumeCascade * AddressVolumeResolution;
+	return imageLoad(PreviousVoxelAddressVolume, previousAddressCoord).r;
+#endif
+}
+
+bool IsInForceRelightSphere(vec3 cachePosition)
+{
+	for(uint i=0; i<NumForceRelightSpheres; ++i)
+	{
+		vec3 toSphere = ForceRelightSpheres[i].xyz - cachePosition;
+		if(dot(toSphere, toSphere) < ForceRelightSpheres[i].w * ForceRelightSpheres[i].w)
+			return true;
+	}
+	return false;
+}
+
+bool NeedsRelight(vec3 cachePosition, int addressVolumeCascade)
+{
+	// Round-robin by world cell, so that every frame relights a different subset.
+	ivec3 worldCell = ivec3(round(cachePosition / AddressVolumeCascades[addressVolumeCascade].WorldVoxelSize));
+	uint cellHash = uint(worldCell.x * 73856093) ^ uint(worldCell.y * 19349663) ^ uint(worldCell.z * 83492791) ^ uint(addressVolumeCascade);
+	if((cellHash + RelightPhase) % RelightPeriod == 0)
+		return true;
+
+	return IsInForceRelightSphere(cachePosition);
+}
+
+void CopyPreviousLightCache(uint lightCacheIndex, uint previousCache)
+{
+#ifdef PACKED_LIGHTCACHES
+	// Same layout, no need to unpack.
+	for(int i=0; i<PACKED_LIGHTCACHE_NUM_SH_UINTS; ++i)
+		LightCacheEntries[lightCacheIndex].SH[i] = PreviousLightCacheEntries[previousCache].SH[i];
+#elif defined(INDDIFFUSE_VIA_SH1) || defined(INDDIFFUSE_VIA_SH2)
+	LightCacheEntries[lightCacheIndex].SH1neg1 = PreviousLightCacheEntries[previousCache].SH1neg1;
+	LightCacheEntries[lightCacheIndex].SH00_r = PreviousLightCacheEntries[previousCache].SH00_r;
+	LightCacheEntries[lightCacheIndex].SH10 = PreviousLightCacheEntries[previousCache].SH10;
+	LightCacheEntries[lightCacheIndex].SH00_g = PreviousLightCacheEntries[previousCache].SH00_g;
+	LightCacheEntries[lightCacheIndex].SH1pos1 = PreviousLightCacheEntries[previousCache].SH1pos1;
+	LightCacheEntries[lightCacheIndex].SH00_b = PreviousLightCacheEntries[previousCache].SH00_b;
+
+	#ifdef INDDIFFUSE_VIA_SH2
+	LightCacheEntries[lightCacheIndex].SH2neg2 = PreviousLightCacheEntries[previousCache].SH2neg2;
+	LightCacheEntries[lightCacheIndex].SH20_r = PreviousLightCacheEntries[previousCache].SH20_r;
+	LightCacheEntries[lightCacheIndex].SH2neg1 = PreviousLightCacheEntries[previousCache].SH2neg1;
+	LightCacheEntries[lightCacheIndex].SH20_g = PreviousLightCacheEntries[previousCache].SH20_g;
+	LightCacheEntries[lightCacheIndex].SH2pos1 = PreviousLightCacheEntries[previousCache].SH2pos1;
+	LightCacheEntries[lightCacheIndex].SH20_b = PreviousLightCacheEntries[previousCache].SH20_b;
+	LightCacheEntries[lightCacheIndex].SH2pos2 = PreviousLightCacheEntries[previousCache].SH2pos2;
+	#endif
+#endif
+}
+
+// Writes position and lighting of a newly allocated cache. Takes over the lighting of the previous frame or adds the cache to the relight list.
+void InitializeLightCache(uint lightCacheIndex, ivec3 addressCoord_CascadeLocal, int addressVolumeCascade)
+{
+	vec3 cachePosition = addressCoord_CascadeLocal * AddressVolumeCascades[addressVolumeCascade].WorldVoxelSize + AddressVolumeCascades[addressVolumeCascade].Min;
+#ifdef PACKED_LIGHTCACHES
+	LightCachePackedCells[lightCacheIndex] = PackLightCacheCell(addressCoord_CascadeLocal, addressVolumeCascade);
+#else
+	LightCachePositions[lightCacheIndex] = vec4(cachePosition, 0.0);
+#endif
+
+	uint previousCache = ReusePreviousCaches ? GetPreviousCache(cachePosition, addressVolumeCascade) : 0;
+#ifdef SAMPLED_VALS
+	// Caches without history (new or close to a change) take the first estimate as is.
+	if(previousCache != 0 && !IsInForceRelightSphere(cachePosition))
+	{
+		CopyPreviousLightCache(lightCacheIndex, previousCache - 1);
+		RelightCacheIndices[atomicAdd(NumRelightCaches, 1)] = lightCacheIndex;
+	}
+	else
+		RelightCacheIndices[atomicAdd(NumRelightCaches, 1)] = lightCacheIndex | RELIGHT_CACHE_NO_HISTORY_FLAG;
+#else
+	if(previousCache != 0 && !NeedsRelight(cachePosition, addressVolumeCascade))
+	{
+		CopyPreviousLightCache(lightCacheIndex, previousCache - 1);
+	}
+	else
+	{
+		// Packed caches are written by the lighting pass without accumulating in the cache itself.
+	#ifndef PACKED_LIGHTCACHES
+		LightCacheEntries[lightCacheIndex].SH1neg1 = vec3(0);
+		LightCacheEntries[lightCacheIndex].SH00_r = 0;
+		LightCacheEntries[lightCacheIndex].SH10 = vec3(0);
+		LightCacheEntries[lightCacheIndex].SH00_g = 0;
+		LightCacheEntries[lightCacheIndex].SH1pos1 = vec3(0);
+		LightCacheEntries[lightCacheIndex].SH00_b = 0;
+
+		#ifdef INDDIFFUSE_VIA_SH2
+		LightCacheEntries[lightCacheIndex].SH2neg2 = vec3(0);
+		LightCacheEntries[lightCacheIndex].SH20_r = 0;
+		LightCacheEntries[lightCacheIndex].SH2neg1 = vec3(0);
+		LightCacheEntries[lightCacheIndex].SH20_g = 0;
+		LightCacheEntries[lightCacheIndex].SH2pos1 = vec3(0);
+		LightCacheEntries[lightCacheIndex].SH20_b = 0;
+		LightCacheEntries[lightCacheIndex].SH2pos2 = vec3(0);
+		#endif
+	#endif
+
+		RelightCacheIndices[atomicAdd(NumRelightCaches, 1)] = lightCacheIndex;
+	}
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+// Clustered light assignment: The screen is divided into tiles, each tile into exponentially distributed depth slices.
+// Every cluster stores a list of all lights that might affect it. See ClusteredShading.
+// Needs globalubos.glsl
+
+// Needs to match ClusteredShading::s_tileSize and friends.
+#define CLUSTER_TILE_SIZE 64
+#define CLUSTER_NUM_DEPTH_SLICES 16
+#define CLUSTER_MAX_NUM_LIGHTS 128
+
+struct ClusterLight
+{
+	vec3 Position;
+	float CosHalfAngle;
+	vec3 Direction;
+	float Range;
+	vec3 Intensity;
+	float ShadowNormalOffset;
+	float ShadowBias;
+	float ShadowMapAtlasScale;
+	vec2 ShadowMapAtlasOffset;
+	mat4 LightViewProjection;
+};
+
+layout(std430, binding = 12) restrict readonly buffer ClusterLightBuffer
+{
+	ClusterLight ClusterLights[];
+};
+
+ivec2 GetClusterTileCount()
+{
+	return (BackbufferResolution + ivec2(CLUSTER_TILE_SIZE - 1)) / CLUSTER_TILE_SIZE;
+}
+
+// View space depth at the start of the given slice.
+float GetClusterSliceDepth(float slice)
+{
+	return CameraNearPlane * pow(CameraFarPlane / CameraNearPlane, slice / CLUSTER_NUM_DEPTH_SLICES);
+}
+
+uint GetClusterIndex(ivec2 pixel, float viewDepth)
+{
+	ivec2 tileCount = GetClusterTileCount();
+	ivec2 tile = pixel / CLUSTER_TILE_SIZE;
+	int slice = clamp(int(log(viewDepth / CameraNearPlane) / log(CameraFarPlane / CameraNearPlane) * CLUSTER_NUM_DEPTH_SLICES), 0, CLUSTER_NUM_DEPTH_SLICES - 1);
+	return uint((slice * tileCount.y + tile.y) * tileCount.x + tile.x);
+}
\ No newline at end of file
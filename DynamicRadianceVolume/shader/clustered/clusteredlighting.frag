@@ -0,0 +1,72 @@
+#version 450 core
+
+#include "../gbuffer.glsl"
+#include "../utils.glsl"
+#include "../globalubos.glsl"
+#include "../lightingfunctions.glsl"
+#include "../directlighting.glsl"
+#include "clustered.glsl"
+
+// Direct lighting of all lights in a single pass, evaluating only the lights of the pixel's cluster.
+// Same as directdeferredlighting.frag otherwise.
+
+layout(binding=4) uniform sampler2DShadow ShadowMapAtlas;
+
+layout(std430, binding = 13) restrict readonly buffer ClusterLightCountBuffer
+{
+	uint ClusterLightCounts[];
+};
+layout(std430, binding = 14) restrict readonly buffer ClusterLightIndexBuffer
+{
+	uint ClusterLightIndices[];
+};
+
+in vec2 Texcoord;
+out vec3 OutputColor;
+
+void main()
+{
+	float depth = textureLod(GBuffer_Depth, Texcoord, 0).r;
+	if(depth == 0.0)
+		discard;
+
+	// Get world position and normal.
+	vec4 worldPosition4D = vec4(Texcoord * 2.0 - vec2(1.0), depth, 1.0f) * InverseViewProjection;
+	vec3 worldPosition = worldPosition4D.xyz / worldPosition4D.w;
+	vec3 worldNormal = UnpackNormal16I(texture(GBuffer_Normal, Texcoord).rg);
+
+	// Direction to camera.
+	vec3 toCamera = CameraPosition - worldPosition;
+	float viewDepth = dot(-toCamera, CameraDirection);
+	toCamera = normalize(toCamera);
+
+	// BRDF parameters from GBuffer.
+	vec3 baseColor = textureLod(GBuffer_Diffuse, Texcoord, 0).rgb;
+	vec2 roughnessMetalic = textureLod(GBuffer_RoughnessMetalic, Texcoord, 0).rg;
+
+	uint clusterIndex = GetClusterIndex(ivec2(gl_FragCoord.xy), viewDepth);
+	uint numClusterLights = ClusterLightCounts[clusterIndex];
+
+	OutputColor = vec3(0.0);
+	for(uint i = 0; i < numClusterLights; ++i)
+	{
+		ClusterLight light = ClusterLights[ClusterLightIndices[clusterIndex * CLUSTER_MAX_NUM_LIGHTS + i]];
+
+		// Direction and distance to light.
+		vec3 toLight = light.Position - worldPosition;
+		float lightDistanceSq = dot(toLight, toLight);
+		toLight *= inversesqrt(lightDistanceSq);
+		float cosTheta = saturate(dot(toLight, worldNormal));
+
+		float spotFalloff = ComputeSpotFalloff(dot(-toLight, light.Direction), light.CosHalfAngle) * ComputeRangeFalloff(lightDistanceSq, light.Range);
+		if(spotFalloff == 0.0 || cosTheta == 0.0)
+			continue;
+
+		float shadowing = ComputeSpotShadowing(ShadowMapAtlas, light.LightViewProjection, light.ShadowMapAtlasOffset, light.ShadowMapAtlasScale, light.ShadowNormalOffset, light.ShadowBias,
+												worldPosition, worldNormal, cosTheta);
+		if(shadowing == 0.0)
+			continue;
+
+		OutputColor += ComputeSpotLighting(toLight, lightDistanceSq, cosTheta, shadowing, spotFalloff, light.Intensity, toCamera, worldNormal, baseColor, roughnessMetalic);
+	}
+}
\ No newline at end of file
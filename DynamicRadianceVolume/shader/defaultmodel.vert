@@ -1,7 +1,10 @@
 #version 450 core
+#extension GL_ARB_shader_draw_parameters : require
 
 #include "globalubos.glsl"
 #include "meshdeform.glsl"
+#include "instancedata.glsl"
+#include "deformedvertices.glsl"
 
 // Vertex input.
 layout(location = 0) in vec3 inPosition;
@@ -16,14 +19,18 @@ out vec3 Tangent;
 out float BitangentHandedness;
 out vec2 Texcoord;
 
+// Needs to produce exactly the same depth as depthprepass.vert
+invariant gl_Position;
+
 void main(void)
 {
-	vec3 worldPosition = (vec4(inPosition, 1.0) * World).xyz;
-	gl_Position = vec4(WorldPosDeform(worldPosition), 1.0) * ViewProjection;
+	vec3 worldPosition, worldNormal;
+	GetDeformedWorldVertex(inPosition, inNormal, worldPosition, worldNormal);
+	gl_Position = vec4(worldPosition, 1.0) * ViewProjection;
 
 	// Simple pass through
-	Normal = NormalDeform((vec4(inNormal, 0.0) * World).xyz, worldPosition);
-	Tangent = (vec4(inTangent, 0.0) * World).xyz;
+	Normal = worldNormal;
+	Tangent = (vec4(inTangent, 0.0) * GetInstanceWorldMatrix()).xyz;
 	BitangentHandedness = inBitangentHandedness;
 	Texcoord = inTexcoord;
 }
\ No newline at end of file
@@ -1,7 +1,17 @@
 #version 450 core
+#extension GL_ARB_shader_draw_parameters : require
+#ifdef MULTI_VIEW
+	#extension GL_ARB_shader_viewport_layer_array : require
+	#define INSTANCEDATA_VIEW_INDEX
+#endif
 
 #include "globalubos.glsl"
 #include "meshdeform.glsl"
+#include "instancedata.glsl"
+#include "deformedvertices.glsl"
+#ifdef MULTI_VIEW
+	#include "multiviewrsm/multiviewrsm.glsl"
+#endif
 
 // Vertex input.
 layout(location = 0) in vec3 inPosition;
@@ -16,16 +26,23 @@ out vec3 Normal;
 out vec3 Tangent;
 out float BitangentHandedness;
 out vec2 Texcoord;
+#ifdef MULTI_VIEW
+flat out uint ViewIndex;
+#endif
 
 void main(void)
 {
-	vec3 worldPosition = (vec4(inPosition, 1.0) * World).xyz;
-	Position = WorldPosDeform(worldPosition);
-	gl_Position = vec4(Position, 1.0) * LightViewProjection;
+	GetDeformedWorldVertex(inPosition, inNormal, Position, Normal);
+#ifdef MULTI_VIEW
+	ViewIndex = GetInstanceViewIndex();
+	gl_ViewportIndex = int(ViewIndex);
+	gl_Position = vec4(Position, 1.0) * RSMViews[ViewIndex].ViewProjection;
+#else
+	gl_Position = vec4(Position, 1.0) * SpotLights[LightIndex].ViewProjection;
+#endif
 
 	// Simple pass through
-	Normal = NormalDeform((vec4(inNormal, 0.0) * World).xyz, worldPosition);
-	Tangent = (vec4(inTangent, 0.0) * World).xyz;
+	Tangent = (vec4(inTangent, 0.0) * GetInstanceWorldMatrix()).xyz;
 	BitangentHandedness = inBitangentHandedness;
 	Texcoord = inTexcoord;
 }
\ No newline at end of file
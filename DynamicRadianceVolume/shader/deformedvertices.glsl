@@ -0,0 +1,56 @@
+// Deformed world space vertices. Needs to be included after meshdeform.glsl and instancedata.glsl.
+//
+// With PRETRANSFORMED_VERTICES defined, world transformation and WorldPosDeform/NormalDeform are evaluated only once per vertex and frame by deformvertices.comp.
+// All geometry passes read the results via gl_VertexID, which is the model-local vertex index.
+// Otherwise every pass transforms and deforms its vertices on its own.
+
+#ifdef PRETRANSFORMED_VERTICES
+struct DeformedVertex
+{
+	vec3 Position;
+	float _padding0;
+	vec3 Normal;
+	float _padding1;
+};
+layout(std430, binding = 10) restrict readonly buffer DeformedVertexBuffer
+{
+	DeformedVertex DeformedVertices[];
+};
+// First deformed vertex of every entity.
+layout(std430, binding = 11) restrict readonly buffer DeformedVertexOffsetBuffer
+{
+	uint DeformedVertexOffsets[];
+};
+
+DeformedVertex LoadDeformedVertex(uint entityIndex, uint vertex)
+{
+	return DeformedVertices[DeformedVertexOffsets[entityIndex] + vertex];
+}
+#endif
+
+#ifndef INSTANCEDATA_BUFFERS_ONLY
+// Returns the deformed world position of the current vertex. Usable in vertex shaders only!
+vec3 GetDeformedWorldPosition(vec3 objectPosition)
+{
+#ifdef PRETRANSFORMED_VERTICES
+	return LoadDeformedVertex(GetInstanceEntityIndex(), gl_VertexID).Position;
+#else
+	return WorldPosDeform((vec4(objectPosition, 1.0) * GetInstanceWorldMatrix()).xyz);
+#endif
+}
+
+// Returns the deformed world position and normal of the current vertex. Usable in vertex shaders only!
+void GetDeformedWorldVertex(vec3 objectPosition, vec3 objectNormal, out vec3 worldPosition, out vec3 worldNormal)
+{
+#ifdef PRETRANSFORMED_VERTICES
+	DeformedVertex deformedVertex = LoadDeformedVertex(GetInstanceEntityIndex(), gl_VertexID);
+	worldPosition = deformedVertex.Position;
+	worldNormal = deformedVertex.Normal;
+#else
+	mat4 World = GetInstanceWorldMatrix();
+	vec3 undeformedWorldPosition = (vec4(objectPosition, 1.0) * World).xyz;
+	worldPosition = WorldPosDeform(undeformedWorldPosition);
+	worldNormal = NormalDeform((vec4(objectNormal, 0.0) * World).xyz, undeformedWorldPosition);
+#endif
+}
+#endif
\ No newline at end of file
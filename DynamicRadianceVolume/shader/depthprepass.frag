@@ -0,0 +1,18 @@
+#version 450 core
+
+// Options:
+//#define ALPHATESTING <DesiredAlphaThreshhold>
+
+#ifdef ALPHATESTING
+in vec2 Texcoord;
+
+layout(binding = 0) uniform sampler2D BaseColorTexture;
+#endif
+
+void main()
+{
+#ifdef ALPHATESTING
+	if(texture(BaseColorTexture, Texcoord).a < 0.1)
+		discard;
+#endif
+}
\ No newline at end of file
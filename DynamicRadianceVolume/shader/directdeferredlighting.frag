@@ -4,39 +4,52 @@
 #include "utils.glsl"
 #include "globalubos.glsl"
 #include "lightingfunctions.glsl"
+#include "directlighting.glsl"
 
-layout(binding=4) uniform sampler2DShadow ShadowMap;
+layout(binding=4) uniform sampler2DShadow ShadowMapAtlas;
 
-in vec2 Texcoord;
 out vec3 OutputColor;
 
+#ifdef LIGHT_VOLUME
+	// Every fragment of a light volume needs to pass to reset the stencil buffer, so no discards here.
+	#define EARLY_OUT { OutputColor = vec3(0.0); return; }
+#else
+	in vec2 Texcoord;
+	#define EARLY_OUT discard
+#endif
+
 void main()
 {
+#ifdef LIGHT_VOLUME
+	vec2 Texcoord = gl_FragCoord.xy / vec2(BackbufferResolution);
+#endif
+
 	// Get world position and normal.
 	vec4 worldPosition4D = vec4(Texcoord * 2.0 - vec2(1.0), textureLod(GBuffer_Depth, Texcoord, 0).r, 1.0f) * InverseViewProjection;
 	vec3 worldPosition = worldPosition4D.xyz / worldPosition4D.w;
 	vec3 worldNormal = UnpackNormal16I(texture(GBuffer_Normal, Texcoord).rg);
 
 	// Direction and distance to light.
-	vec3 toLight = LightPosition - worldPosition;
+	vec3 toLight = SpotLights[LightIndex].Position - worldPosition;
 //	if(dot(toLight, worldNormal) > 0) // Early out if facing away from the light. 
 //		discard;
 	float lightDistanceSq = dot(toLight, toLight);
 	toLight *= inversesqrt(lightDistanceSq);
 	float cosTheta = saturate(dot(toLight, worldNormal));
 
-	// Check if shadowed - Using normal offset shadow bias http://www.dissidentlogic.com/old/#Normal%20Offset%20Shadows
-	//float shadowMapTexelSize = 1.0 / RSMRenderResolution; // Could be scaled with distance. Recheck if there are problems with distant objects.
-	float normalOffsetScale = ShadowNormalOffset * (1.0 - cosTheta);// * shadowMapTexelSize;
-	vec4 shadowProjection;
-	shadowProjection.xy = (vec4(worldPosition + normalOffsetScale * worldNormal, 1.0) * LightViewProjection).xy;
-	shadowProjection.zw = (vec4(worldPosition, 1.0) * LightViewProjection).zw;
-	shadowProjection.xy = shadowProjection.xy * 0.5 + vec2(0.5 * shadowProjection.w);
-	shadowProjection.z += ShadowBias;
-	float shadowing = textureProjLod(ShadowMap, shadowProjection, 0);
+	float spotFalloff = ComputeSpotFalloff(toLight);
+#ifdef LIGHT_VOLUME
+	// The light volume ends at the light's range, so the light needs to fade out before.
+	spotFalloff *= ComputeRangeFalloff(lightDistanceSq);
+#endif
+	if(spotFalloff == 0.0)
+		EARLY_OUT;
+
+	// Check if shadowed.
+	float shadowing = ComputeSpotShadowing(ShadowMapAtlas, SpotLights[LightIndex].ViewProjection, SpotLights[LightIndex].RSMAtlasOffset, SpotLights[LightIndex].RSMAtlasScale, SpotLights[LightIndex].ShadowNormalOffset, SpotLights[LightIndex].ShadowBias, worldPosition, worldNormal, cosTheta);
 
 	if(shadowing == 0.0)
-		discard;
+		EARLY_OUT;
 
 
 	// Direction to camera.
@@ -47,6 +60,5 @@ void main()
 	vec2 roughnessMetalic = textureLod(GBuffer_RoughnessMetalic, Texcoord, 0).rg;
 	
 	// Evaluate direct light.
-	vec3 irradiance = LightIntensity * (shadowing * ComputeSpotFalloff(toLight) * cosTheta / lightDistanceSq);
-	OutputColor = BRDF(toLight, toCamera, worldNormal, baseColor, roughnessMetalic) * irradiance;
+	OutputColor = ComputeSpotLighting(toLight, lightDistanceSq, cosTheta, shadowing, spotFalloff, SpotLights[LightIndex].Intensity, toCamera, worldNormal, baseColor, roughnessMetalic);
 }
\ No newline at end of file
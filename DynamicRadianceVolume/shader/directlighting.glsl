@@ -0,0 +1,27 @@
+// Direct lighting of a single spot light.
+// Shared by the per light deferred pass (directdeferredlighting.frag) and clustered shading (clustered/clusteredlighting.frag).
+// Needs utils.glsl and lightingfunctions.glsl.
+
+// Shadow map lookup using normal offset shadow bias http://www.dissidentlogic.com/old/#Normal%20Offset%20Shadows
+// atlasOffset/atlasScale give the light's region in the shadow map atlas.
+float ComputeSpotShadowing(sampler2DShadow shadowMapAtlas, mat4 lightViewProjection, vec2 atlasOffset, float atlasScale, float shadowNormalOffset, float shadowBias,
+							vec3 worldPosition, vec3 worldNormal, float cosTheta)
+{
+	//float shadowMapTexelSize = 1.0 / RSMRenderResolution; // Could be scaled with distance. Recheck if there are problems with distant objects.
+	float normalOffsetScale = shadowNormalOffset * (1.0 - cosTheta);// * shadowMapTexelSize;
+	vec4 shadowProjection;
+	shadowProjection.xy = (vec4(worldPosition + normalOffsetScale * worldNormal, 1.0) * lightViewProjection).xy;
+	shadowProjection.zw = (vec4(worldPosition, 1.0) * lightViewProjection).zw;
+	shadowProjection.xy = shadowProjection.xy * 0.5 + vec2(0.5 * shadowProjection.w);
+	shadowProjection.xy = shadowProjection.xy * atlasScale + atlasOffset * shadowProjection.w;
+	shadowProjection.z += shadowBias;
+	return textureProjLod(shadowMapAtlas, shadowProjection, 0);
+}
+
+// Radiance towards the camera. toLight needs to be normalized.
+vec3 ComputeSpotLighting(vec3 toLight, float lightDistanceSq, float cosTheta, float shadowing, float spotFalloff, vec3 lightIntensity,
+						vec3 toCamera, vec3 worldNormal, vec3 baseColor, vec2 roughnessMetalic)
+{
+	vec3 irradiance = lightIntensity * (shadowing * spotFalloff * cosTheta / lightDistanceSq);
+	return BRDF(toLight, toCamera, worldNormal, baseColor, roughnessMetalic) * irradiance;
+}
\ No newline at end of file
@@ -2,8 +2,6 @@
 
 #include "utils.glsl"
 
-in vec2 Texcoord;
-
 layout(location = 0) out vec3 OutFlux;
 layout(location = 1) out ivec2 OutPackedNormal;
 layout(location = 2) out vec2 OutDepthLinSq;
@@ -14,6 +12,10 @@ layout(binding = 2) uniform sampler2D DepthLinSq;
 
 void main()
 {
+	// The viewport covers only a single light's region of the atlas.
+	// Target texel center times two is the shared corner of the four source texels on the base level.
+	vec2 Texcoord = gl_FragCoord.xy * 2.0 / textureSize(Flux, 0);
+
 	vec4 gatherFlux = textureGather(Flux, Texcoord, 0);
 	OutFlux.r = gatherFlux.r + gatherFlux.g + gatherFlux.b + gatherFlux.a;
 	gatherFlux = textureGather(Flux, Texcoord, 1);
@@ -2,16 +2,23 @@
 
 // Options:
 //#define ALPHATESTING <DesiredAlphaThreshhold>
+//#define MULTI_VIEW	// Light parameters are read from the view selected by the vertex shader instead of the spot light buffer.
 
 #include "utils.glsl"
 #include "globalubos.glsl"
 #include "lightingfunctions.glsl"
+#ifdef MULTI_VIEW
+	#include "multiviewrsm/multiviewrsm.glsl"
+#endif
 
 in vec3 Position;
 in vec3 Normal;
 in vec3 Tangent;
 in float BitangentHandedness;
 in vec2 Texcoord;
+#ifdef MULTI_VIEW
+flat in uint ViewIndex;
+#endif
 
 layout(location = 0) out vec3 OutFlux;
 layout(location = 1) out ivec2 OutPackedNormal;
@@ -29,22 +36,37 @@ void main()
 		discard;
 #endif
 
-	vec3 toLight = LightPosition - Position;
+#ifdef MULTI_VIEW
+	RSMView view = RSMViews[ViewIndex];
+	vec3 lightPosition = view.Position;
+	vec3 lightDirection = view.Direction;
+	vec3 lightIntensity = view.Intensity;
+	float lightCosHalfAngle = view.CosHalfAngle;
+	float renderResolution = view.RenderResolution;
+#else
+	vec3 lightPosition = SpotLights[LightIndex].Position;
+	vec3 lightDirection = SpotLights[LightIndex].Direction;
+	vec3 lightIntensity = SpotLights[LightIndex].Intensity;
+	float lightCosHalfAngle = SpotLights[LightIndex].CosHalfAngle;
+	float renderResolution = SpotLights[LightIndex].RSMRenderResolution;
+#endif
+
+	vec3 toLight = lightPosition - Position;
 	float distToLight = length(toLight);
 	toLight /= distToLight;
 
-	float cosToLight = saturate(dot(-toLight, LightDirection));
+	float cosToLight = saturate(dot(-toLight, lightDirection));
 
-	float totalSpotSteradian = PI_2 * (1.0 - LightCosHalfAngle); // https://en.wikipedia.org/wiki/Steradian#Other_properties
-	float pixelSteradian = totalSpotSteradian * cosToLight / RSMRenderResolution / RSMRenderResolution; // cos(alpha) / pixel area
-	float spotFalloff = ComputeSpotFalloff(cosToLight); 
+	float totalSpotSteradian = PI_2 * (1.0 - lightCosHalfAngle); // https://en.wikipedia.org/wiki/Steradian#Other_properties
+	float pixelSteradian = totalSpotSteradian * cosToLight / renderResolution / renderResolution; // cos(alpha) / pixel area
+	float spotFalloff = ComputeSpotFalloff(cosToLight, lightCosHalfAngle);
 
 	// Actual intensity for given Direction = spotFallOff * LightIntensity
 	// Remember: Intensity = Flux per Steradian
 	// -> total incoming flux = Intensity * PixelSteradian
 	// -> total outgoing flux = Incoming Flux * "reflectivity"
 
-	OutFlux = baseColor.rgb * LightIntensity * (spotFalloff * pixelSteradian / PI); // /PI is preponed for later intensity calculation
+	OutFlux = baseColor.rgb * lightIntensity * (spotFalloff * pixelSteradian / PI); // /PI is preponed for later intensity calculation
 	OutDepthLinSq = vec2(distToLight, distToLight * distToLight);
 
 
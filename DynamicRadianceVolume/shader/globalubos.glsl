@@ -21,6 +21,7 @@ layout(binding = 0, shared) uniform Constant
 	int AddressVolumeResolution;	// Resolution of light cache address volume - it is cubic and the same for all cascades!
 	int NumAddressVolumeCascades;
 	uint MaxNumLightCaches;
+	uint LightCacheHashMapSize;		// Number of slots in the light cache hash map, power of two. See lightcachehashmap.glsl
 
 	// Specular envmap is quadratic. Sizes denominate width/height.
 	int SpecularEnvmapTotalSize; 				// Total size of the specular envmap texture in texel.
@@ -40,6 +41,8 @@ layout(binding = 1, shared) uniform PerFrame
 	vec3 CameraPosition;
 	vec3 CameraDirection;
 	float PassedTime;
+	float CameraNearPlane;
+	float CameraFarPlane;
 };
 
 
@@ -78,29 +81,26 @@ layout(binding = 2, shared) uniform VolumeInfo
 	CAVCascade AddressVolumeCascades[MAX_NUM_ADDRESS_VOLUME_CASCADES];
 };
 
-// UBO for values that change with each object
-layout(binding = 3, shared) uniform PerObject
+// Parameters of a single spot light. Needs to match Renderer::SpotLightData
+struct SpotLight
 {
-	mat4 World;
-};
-
-// UBO for a single spot light. Likely to be changed in something more general.
-layout(binding = 4, shared) uniform SpotLight
-{
-	vec3 LightIntensity;
+	vec3 Intensity;
 	float ShadowNormalOffset;
 
+	vec3 Position;
 	float ShadowBias;
-	vec3 LightPosition;
 	
-	vec3 LightDirection;
-	float LightCosHalfAngle;
+	vec3 Direction;
+	float CosHalfAngle;
 
-	mat4 LightViewProjection;
-	mat4 InverseLightViewProjection;
+	mat4 ViewProjection;
+	mat4 InverseViewProjection;
 
 	int RSMRenderResolution;
 	int RSMReadResolution;
+	int RSMReadLod;			// Mip level of the atlas that has RSMReadResolution for this light.
+	float RSMAtlasScale;	// Size of the light's region relative to the RSM/shadow map atlas.
+	vec2 RSMAtlasOffset;	// Texcoord offset of the light's region in the RSM/shadow map atlas.
 	float ValAreaFactor; // NearClipWidth * NearClipHeight / (NearClipPlaneDepth² * RSMReadResolution * RSMReadResolution)
 
 	float IndirectShadowComputationLod; 			// SHADOW_COMPUTATION_LOD 2
@@ -109,4 +109,18 @@ layout(binding = 4, shared) uniform SpotLight
 	int IndirectShadowComputationSampleInterval;  	// IndirectShadowComputationBlockSize * IndirectShadowComputationBlockSize
 	float IndirectShadowComputationSuperValWidth;	// sqrt(ValAreaFactor) * SHADOW_COMPUTATION_INTERVAL_BLOCK -- The scaling factor of the "superval" used for cone tracing (scales with distance!)
 	float IndirectShadowSamplingOffset; 			// = vec2(0.5 + sqrt(2.0) * IndirectShadowComputationBlockSize / 2.0);
-};
\ No newline at end of file
+
+	float Range;	// Distance at which the light's contribution fades out completely.
+	float IndirectScale;	// Scale of the light's VAL flux for light caches, compensates randomly skipped lights.
+	int ValOffset;			// First VAL of the light in the VirtualAreaLightBuffer (see virtualarealights.glsl), -1 without indirect lighting.
+	int ValTreeOffset;		// Root of the light's VAL tree in the VALTreeBuffer (see valtree.glsl), -1 without indirect lighting.
+};
+
+// All spot lights of the scene. Updated only if any light changed.
+layout(std430, binding = 16) restrict readonly buffer SpotLightBuffer
+{
+	SpotLight SpotLights[];
+};
+
+// Light processed by the current draw/dispatch of a per-light pass.
+layout(location = 31) uniform uint LightIndex;
\ No newline at end of file
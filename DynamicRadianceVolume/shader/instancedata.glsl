@@ -0,0 +1,42 @@
+// Per instance data of all scene entities, written once per frame by the renderer.
+// World matrices are stored per entity. Each draw call reads its instances from a (culled) list of entity indices,
+// sorted by model, so that all visible entities with the same model can be drawn with a single instanced draw call.
+//
+// Requires GL_ARB_shader_draw_parameters since gl_InstanceID does not include the base instance of the draw call.
+// Needs to be enabled right after the #version directive.
+// Define INSTANCEDATA_BUFFERS_ONLY to use the buffers outside of vertex shaders.
+
+layout(std430, binding = 5) restrict readonly buffer InstanceBuffer
+{
+	mat4 InstanceWorldMatrices[];
+};
+layout(std430, binding = 6) restrict readonly buffer InstanceIndexBuffer
+{
+	uint InstanceIndices[];
+};
+
+#ifndef INSTANCEDATA_BUFFERS_ONLY
+#ifdef INSTANCEDATA_VIEW_INDEX
+// Instance indices hold a view index in their upper bits (see multiviewrsm/multiviewrsm.glsl).
+uint GetInstanceEntityIndex()
+{
+	return InstanceIndices[gl_BaseInstanceARB + gl_InstanceID] & 0x0FFFFFFFu;
+}
+uint GetInstanceViewIndex()
+{
+	return InstanceIndices[gl_BaseInstanceARB + gl_InstanceID] >> 28;
+}
+#else
+// Returns the entity index of the instance that is currently drawn. Usable in vertex shaders only!
+uint GetInstanceEntityIndex()
+{
+	return InstanceIndices[gl_BaseInstanceARB + gl_InstanceID];
+}
+#endif
+
+// Returns the world matrix of the instance that is currently drawn. Usable in vertex shaders only!
+mat4 GetInstanceWorldMatrix()
+{
+	return InstanceWorldMatrices[GetInstanceEntityIndex()];
+}
+#endif
\ No newline at end of file
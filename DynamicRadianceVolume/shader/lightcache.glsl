@@ -18,27 +18,50 @@
 
 #if LIGHTCACHEMODE == LIGHTCACHEMODE_CREATE
 	#define LIGHTCACHE_BUFFER_MODIFIER restrict writeonly
+	#define LIGHTCACHE_POSITION_MODIFIER restrict writeonly
 	#define LIGHTCACHE_COUNTER_MODIFIER restrict coherent
 #elif LIGHTCACHEMODE == LIGHTCACHEMODE_LIGHT
 	#define LIGHTCACHE_BUFFER_MODIFIER restrict
+	#define LIGHTCACHE_POSITION_MODIFIER restrict readonly
 	#define LIGHTCACHE_COUNTER_MODIFIER restrict readonly
 #elif LIGHTCACHEMODE == LIGHTCACHEMODE_APPLY
 	#define LIGHTCACHE_BUFFER_MODIFIER restrict readonly
+	#define LIGHTCACHE_POSITION_MODIFIER restrict readonly
 	#define LIGHTCACHE_COUNTER_MODIFIER restrict readonly
 #else
 	#error "Please specify LIGHTCACHEMODE!"
 #endif
 
 
+#if defined(INDDIFFUSE_VIA_SH2)
+	#define LIGHTCACHE_NUM_SH_COEFFICIENTS 9
+#else
+	#define LIGHTCACHE_NUM_SH_COEFFICIENTS 4
+#endif
+
+// Caches are stored as structure of arrays, split by access pattern:
+// * LightCachePositionBuffer: Written by the allocation, read by the lighting.
+// * LightCacheBuffer: Irradiance, written by the lighting and the only stream read by cacheApply.frag.
+// Specular lighting lives in the specular envmap (see SPECULARENVMAP_PERCACHESIZE), the cell bookkeeping in the address volume or hash map.
+
+#ifdef PACKED_LIGHTCACHES
+// Packed layout, about half the size of the float layout below.
+// The position is implicit from the cascade local cell. SH coefficients are half floats - band 1 and 2 are signed, so there is no shared exponent format.
+#define PACKED_LIGHTCACHE_NUM_SH_UINTS ((LIGHTCACHE_NUM_SH_COEFFICIENTS * 3 + 1) / 2)
+
 struct LightCacheEntry
 {
-	vec3 Position; // Consider storing packed identifier!
-	float _padding0;
+	// Coefficients in the order SH00, SH1neg1, SH10, SH1pos1, SH2neg2, SH2neg1, SH20, SH2pos1, SH2pos2. See StoreLightCacheSH.
+	uint SH[PACKED_LIGHTCACHE_NUM_SH_UINTS];
+};
 
+#else
 
+struct LightCacheEntry
+{
 #if defined(INDDIFFUSE_VIA_SH1) || defined(INDDIFFUSE_VIA_SH2)
 	// Irradiance via SH (band, coefficient)
-	// Consider packing!
+	// See PACKED_LIGHTCACHES for a packed version.
 	vec3 SH1neg1;
 	float SH00_r;
 	vec3 SH10;
@@ -71,24 +94,67 @@ struct LightCacheEntry
 	vec3 irradianceH6;
 	float _padding2;
 	#endif*/
+#else
+	vec4 _padding0; // Structs can not be empty. Shaders that do not know the diffuse mode only access counter and positions.
 #endif
 
 };
+#endif
 
 layout(std430, binding = 0) LIGHTCACHE_BUFFER_MODIFIER buffer LightCacheBuffer
 {
 	LightCacheEntry[] LightCacheEntries;
 };
 
+layout(std430, binding = 20) LIGHTCACHE_POSITION_MODIFIER buffer LightCachePositionBuffer
+{
+#ifdef PACKED_LIGHTCACHES
+	uint LightCachePackedCells[]; // Cascade local cell with 10 bits per axis, cascade in the upper 2 bits. See PackLightCacheCell.
+#else
+	vec4 LightCachePositions[]; // w unused.
+#endif
+};
+
 layout(std430, binding = 1) LIGHTCACHE_COUNTER_MODIFIER buffer LightCacheCounter
 {
-	uint NumCacheLightingThreadGroupsX; // Should be (TotalLightCacheCount + LIGHTING_THREADS_PER_GROUP - 1) / LIGHTING_THREADS_PER_GROUP
+	uint NumCacheLightingThreadGroupsX; // Should be (NumRelightCaches + LIGHTING_THREADS_PER_GROUP - 1) / LIGHTING_THREADS_PER_GROUP
     uint NumCacheLightingThreadGroupsY; // Should be 1
     uint NumCacheLightingThreadGroupsZ; // Should be 1
 
     int TotalLightCacheCount;
+    int NumRelightCaches; // Caches that are (re)lit this frame, see RelightCacheIndices.
+    int NumLightCacheHashMapOverflows; // Cells that did not get a cache since the hash map was too full, see lightcachehashmap.glsl.
 };
 
+#if LIGHTCACHEMODE != LIGHTCACHEMODE_APPLY
+// Caches that need to be lit this frame. All other caches kept the lighting of their world cell from the last frame (see cacheGather.comp).
+layout(std430, binding = 3) LIGHTCACHE_BUFFER_MODIFIER buffer RelightCacheBuffer
+{
+	uint RelightCacheIndices[];
+};
+#endif
+
+// Set in RelightCacheIndices for caches without lighting history, see SAMPLED_VALS.
+#define RELIGHT_CACHE_NO_HISTORY_FLAG 0x80000000u
+
+// Lighting is accumulated in the scratch buffer and resolved after the last light by cacheResolveLighting.comp:
+// Needed for packed caches that are lit with one dispatch per light and for the temporal accumulation of SAMPLED_VALS.
+#if defined(SAMPLED_VALS) || (defined(PACKED_LIGHTCACHES) && !defined(BATCHED_LIGHTS))
+	#define LIGHTCACHE_RESOLVE_LIGHTING
+#endif
+
+#if (defined(PACKED_LIGHTCACHES) || defined(SAMPLED_VALS)) && LIGHTCACHEMODE == LIGHTCACHEMODE_LIGHT
+// Full precision lighting of the relit caches, indexed like RelightCacheIndices. Cleared again by cacheResolveLighting.comp.
+struct LightCacheScratchEntry
+{
+	vec4 SH[LIGHTCACHE_NUM_SH_COEFFICIENTS];
+};
+layout(std430, binding = 2) restrict buffer LightCacheScratchBuffer
+{
+	LightCacheScratchEntry LightCacheScratchEntries[];
+};
+#endif
+
 
 
 
@@ -121,6 +187,92 @@ int ComputeAddressVolumeCascade(vec3 worldPosition)
 	return addressVolumeCascade;
 }
 
+#ifdef PACKED_LIGHTCACHES
+uint PackLightCacheCell(ivec3 addressCoord_CascadeLocal, int addressVolumeCascade)
+{
+	uvec3 cell = uvec3(addressCoord_CascadeLocal) & 0x3FF;
+	return cell.x | (cell.y << 10) | (cell.z << 20) | (uint(addressVolumeCascade) << 30);
+}
+#endif
+
+#if LIGHTCACHEMODE != LIGHTCACHEMODE_CREATE
+vec3 GetLightCachePosition(uint cacheIndex)
+{
+#ifdef PACKED_LIGHTCACHES
+	uint packedCell = LightCachePackedCells[cacheIndex];
+	ivec3 addressCoord_CascadeLocal = ivec3(packedCell & 0x3FF, (packedCell >> 10) & 0x3FF, (packedCell >> 20) & 0x3FF);
+	int addressVolumeCascade = int(packedCell >> 30);
+	return addressCoord_CascadeLocal * AddressVolumeCascades[addressVolumeCascade].WorldVoxelSize + AddressVolumeCascades[addressVolumeCascade].Min;
+#else
+	return LightCachePositions[cacheIndex].xyz;
+#endif
+}
+
+#if defined(INDDIFFUSE_VIA_SH1) || defined(INDDIFFUSE_VIA_SH2)
+void LoadLightCacheSH(uint cacheIndex, out vec3 sh[LIGHTCACHE_NUM_SH_COEFFICIENTS])
+{
+#ifdef PACKED_LIGHTCACHES
+	float coefficients[PACKED_LIGHTCACHE_NUM_SH_UINTS * 2];
+	for(int i=0; i<PACKED_LIGHTCACHE_NUM_SH_UINTS; ++i)
+	{
+		vec2 unpacked = unpackHalf2x16(LightCacheEntries[cacheIndex].SH[i]);
+		coefficients[i*2] = unpacked.x;
+		coefficients[i*2 + 1] = unpacked.y;
+	}
+	for(int i=0; i<LIGHTCACHE_NUM_SH_COEFFICIENTS; ++i)
+		sh[i] = vec3(coefficients[i*3], coefficients[i*3 + 1], coefficients[i*3 + 2]);
+#else
+	sh[0] = vec3(LightCacheEntries[cacheIndex].SH00_r, LightCacheEntries[cacheIndex].SH00_g, LightCacheEntries[cacheIndex].SH00_b);
+	sh[1] = LightCacheEntries[cacheIndex].SH1neg1;
+	sh[2] = LightCacheEntries[cacheIndex].SH10;
+	sh[3] = LightCacheEntries[cacheIndex].SH1pos1;
+	#ifdef INDDIFFUSE_VIA_SH2
+	sh[4] = LightCacheEntries[cacheIndex].SH2neg2;
+	sh[5] = LightCacheEntries[cacheIndex].SH2neg1;
+	sh[6] = vec3(LightCacheEntries[cacheIndex].SH20_r, LightCacheEntries[cacheIndex].SH20_g, LightCacheEntries[cacheIndex].SH20_b);
+	sh[7] = LightCacheEntries[cacheIndex].SH2pos1;
+	sh[8] = LightCacheEntries[cacheIndex].SH2pos2;
+	#endif
+#endif
+}
+#endif
+#endif
+
+#if (defined(INDDIFFUSE_VIA_SH1) || defined(INDDIFFUSE_VIA_SH2)) && LIGHTCACHEMODE == LIGHTCACHEMODE_LIGHT
+void StoreLightCacheSH(uint cacheIndex, vec3 sh[LIGHTCACHE_NUM_SH_COEFFICIENTS])
+{
+#ifdef PACKED_LIGHTCACHES
+	float coefficients[PACKED_LIGHTCACHE_NUM_SH_UINTS * 2];
+	coefficients[PACKED_LIGHTCACHE_NUM_SH_UINTS * 2 - 1] = 0.0; // Unused for an odd number of floats.
+	for(int i=0; i<LIGHTCACHE_NUM_SH_COEFFICIENTS; ++i)
+	{
+		vec3 coefficient = clamp(sh[i], vec3(-65504.0), vec3(65504.0)); // Half float range
+		coefficients[i*3] = coefficient.r;
+		coefficients[i*3 + 1] = coefficient.g;
+		coefficients[i*3 + 2] = coefficient.b;
+	}
+	for(int i=0; i<PACKED_LIGHTCACHE_NUM_SH_UINTS; ++i)
+		LightCacheEntries[cacheIndex].SH[i] = packHalf2x16(vec2(coefficients[i*2], coefficients[i*2 + 1]));
+#else
+	LightCacheEntries[cacheIndex].SH1neg1 = sh[1];
+	LightCacheEntries[cacheIndex].SH00_r = sh[0].r;
+	LightCacheEntries[cacheIndex].SH10 = sh[2];
+	LightCacheEntries[cacheIndex].SH00_g = sh[0].g;
+	LightCacheEntries[cacheIndex].SH1pos1 = sh[3];
+	LightCacheEntries[cacheIndex].SH00_b = sh[0].b;
+	#ifdef INDDIFFUSE_VIA_SH2
+	LightCacheEntries[cacheIndex].SH2neg2 = sh[4];
+	LightCacheEntries[cacheIndex].SH20_r = sh[6].r;
+	LightCacheEntries[cacheIndex].SH2neg1 = sh[5];
+	LightCacheEntries[cacheIndex].SH20_g = sh[6].g;
+	LightCacheEntries[cacheIndex].SH2pos1 = sh[7];
+	LightCacheEntries[cacheIndex].SH20_b = sh[6].b;
+	LightCacheEntries[cacheIndex].SH2pos2 = sh[8];
+	#endif
+#endif
+}
+#endif
+
 /// Returns 0.0 if its not in transition area. 1.0 max transition to NEXT cascade.
 float ComputeAddressVolumeCascadeTransition(vec3 worldPosition, int addressVolumeCascade)
 {
@@ -138,25 +290,35 @@ float ComputeAddressVolumeCascadeTransition(vec3 worldPosition, int addressVolum
 	{
 		// IRRADIANCE VIA SH
 	#if defined(INDDIFFUSE_VIA_SH1) || defined(INDDIFFUSE_VIA_SH2)
+		vec3 sh[LIGHTCACHE_NUM_SH_COEFFICIENTS];
+		LoadLightCacheSH(cacheAddress, sh);
+		vec3 SH00 = sh[0];
+		vec3 SH1neg1 = sh[1];
+		vec3 SH10 = sh[2];
+		vec3 SH1pos1 = sh[3];
+		#ifdef INDDIFFUSE_VIA_SH2
+		vec3 SH2neg2 = sh[4];
+		vec3 SH2neg1 = sh[5];
+		vec3 SH20 = sh[6];
+		vec3 SH2pos1 = sh[7];
+		vec3 SH2pos2 = sh[8];
+		#endif
+
 		// Band 0
-		vec3 irradiance = vec3(LightCacheEntries[cacheAddress].SH00_r,
-								LightCacheEntries[cacheAddress].SH00_g,
-								LightCacheEntries[cacheAddress].SH00_b) * ShCosLobeFactor0;
+		vec3 irradiance = SH00 * ShCosLobeFactor0;
 
 		// Band 1
-		irradiance -= LightCacheEntries[cacheAddress].SH1neg1 * (ShCosLobeFactor1 * worldNormal.y);
-		irradiance += LightCacheEntries[cacheAddress].SH10 * (ShCosLobeFactor1 * worldNormal.z);
-		irradiance -= LightCacheEntries[cacheAddress].SH1pos1 * (ShCosLobeFactor1 * worldNormal.x);
+		irradiance -= SH1neg1 * (ShCosLobeFactor1 * worldNormal.y);
+		irradiance += SH10 * (ShCosLobeFactor1 * worldNormal.z);
+		irradiance -= SH1pos1 * (ShCosLobeFactor1 * worldNormal.x);
 
 		// Band 2
 		#ifdef INDDIFFUSE_VIA_SH2
-		irradiance -= LightCacheEntries[cacheAddress].SH2neg2 * (ShCosLobeFactor2n2_p1_n1 * worldNormal.x * worldNormal.y);
-		irradiance += LightCacheEntries[cacheAddress].SH2neg1 * (ShCosLobeFactor2n2_p1_n1 * worldNormal.y * worldNormal.z);
-		irradiance += vec3(LightCacheEntries[cacheAddress].SH20_r,
-								LightCacheEntries[cacheAddress].SH20_g,
-								LightCacheEntries[cacheAddress].SH20_b) * (ShCosLobeFactor20 * (worldNormal.z * worldNormal.z * 3.0 - 1.0));
-		irradiance += LightCacheEntries[cacheAddress].SH2pos1 * (ShCosLobeFactor2n2_p1_n1 * worldNormal.x * worldNormal.z);
-		irradiance += LightCacheEntries[cacheAddress].SH2pos2 * (ShCosLobeFactor2p2 * (worldNormal.x * worldNormal.x - worldNormal.y * worldNormal.y));	
+		irradiance -= SH2neg2 * (ShCosLobeFactor2n2_p1_n1 * worldNormal.x * worldNormal.y);
+		irradiance += SH2neg1 * (ShCosLobeFactor2n2_p1_n1 * worldNormal.y * worldNormal.z);
+		irradiance += SH20 * (ShCosLobeFactor20 * (worldNormal.z * worldNormal.z * 3.0 - 1.0));
+		irradiance += SH2pos1 * (ShCosLobeFactor2n2_p1_n1 * worldNormal.x * worldNormal.z);
+		irradiance += SH2pos2 * (ShCosLobeFactor2p2 * (worldNormal.x * worldNormal.x - worldNormal.y * worldNormal.y));	
 		#endif
 
 		// -----------------------------------------------
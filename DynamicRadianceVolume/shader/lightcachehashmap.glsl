@@ -0,0 +1,82 @@
+// Open addressing hash map from address volume cells to light caches.
+// Alternative to the dense address volume texture: Memory and clear costs scale with the maximum number of caches instead of the cascade resolution.
+// Linear probing with a bounded probe count. Cells that can not be inserted within LIGHTCACHE_HASHMAP_MAX_PROBES get no cache.
+// Needs to match LightCacheHashMap (lightcachehashmap.hpp), which is a CPU reference implementation of insert and lookup (see Renderer::TestLightCacheHashMap).
+// Expects lightcache.glsl to be included before.
+
+#define LIGHTCACHE_HASHMAP_MAX_PROBES 16
+#define LIGHTCACHE_HASHMAP_EMPTY_KEY 0
+#define LIGHTCACHE_HASHMAP_INVALID_SLOT 0xFFFFFFFF
+
+#if LIGHTCACHEMODE == LIGHTCACHEMODE_CREATE
+	#define LIGHTCACHE_HASHMAP_MODIFIER restrict coherent
+#else
+	#define LIGHTCACHE_HASHMAP_MODIFIER restrict readonly
+#endif
+
+struct LightCacheHashMapEntry
+{
+	uint Key;	// LIGHTCACHE_HASHMAP_EMPTY_KEY for empty slots.
+	uint Value;	// Light cache index + 1. Zero while the cache is allocated.
+};
+
+// Size is given by LightCacheHashMapSize, which is always a power of two.
+layout(std430, binding = 4) LIGHTCACHE_HASHMAP_MODIFIER buffer LightCacheHashMapBuffer
+{
+	LightCacheHashMapEntry LightCacheHashMapEntries[];
+};
+
+// Unique key for a cell in the given cascade. Cells are cascade local and may lie up to one cell outside of the cascade.
+uint ComputeLightCacheHashMapKey(ivec3 cell, int addressVolumeCascade)
+{
+	uint stride = uint(AddressVolumeResolution + 1);
+	return uint(cell.x) + (uint(cell.y) + (uint(cell.z) + uint(addressVolumeCascade) * stride) * stride) * stride + 1;
+}
+
+// Murmur3 finalizer.
+uint LightCacheHashMapHash(uint key)
+{
+	key ^= key >> 16;
+	key *= 0x85ebca6bu;
+	key ^= key >> 13;
+	key *= 0xc2b2ae35u;
+	key ^= key >> 16;
+	return key;
+}
+
+#if LIGHTCACHEMODE == LIGHTCACHEMODE_CREATE
+// Inserts the given key. Returns its slot if the key was not present before, otherwise or if all probed slots are taken LIGHTCACHE_HASHMAP_INVALID_SLOT.
+// The caller owns the returned slot and is responsible for writing its value.
+uint LightCacheHashMapInsert(uint key)
+{
+	uint slot = LightCacheHashMapHash(key) & (LightCacheHashMapSize - 1);
+	for(int probe=0; probe<LIGHTCACHE_HASHMAP_MAX_PROBES; ++probe)
+	{
+		uint previousKey = atomicCompSwap(LightCacheHashMapEntries[slot].Key, LIGHTCACHE_HASHMAP_EMPTY_KEY, key);
+		if(previousKey == LIGHTCACHE_HASHMAP_EMPTY_KEY)
+			return slot;
+		if(previousKey == key)
+			return LIGHTCACHE_HASHMAP_INVALID_SLOT;
+		slot = (slot + 1) & (LightCacheHashMapSize - 1);
+	}
+
+	atomicAdd(NumLightCacheHashMapOverflows, 1);
+	return LIGHTCACHE_HASHMAP_INVALID_SLOT;
+}
+#endif
+
+// Returns light cache index + 1 for the given key or zero if it is not present.
+uint LightCacheHashMapLookup(uint key)
+{
+	uint slot = LightCacheHashMapHash(key) & (LightCacheHashMapSize - 1);
+	for(int probe=0; probe<LIGHTCACHE_HASHMAP_MAX_PROBES; ++probe)
+	{
+		uint slotKey = LightCacheHashMapEntries[slot].Key;
+		if(slotKey == key)
+			return LightCacheHashMapEntries[slot].Value;
+		if(slotKey == LIGHTCACHE_HASHMAP_EMPTY_KEY)
+			return 0;
+		slot = (slot + 1) & (LightCacheHashMapSize - 1);
+	}
+	return 0;
+}
\ No newline at end of file
@@ -1,17 +1,48 @@
 //#define DIFFUSE_ONLY
 
-float ComputeSpotFalloff(float cosToLight)
+float ComputeSpotFalloff(float cosToLight, float cosHalfAngle)
 {
 	// Linear falloff as used in the Mitsuba renderer
-	//return saturate(acos(LightCosHalfAngle) - acos(cosToLight)) / (acos(LightCosHalfAngle));
+	//return saturate(acos(cosHalfAngle) - acos(cosToLight)) / (acos(cosHalfAngle));
 
 	// Much nicer and faster falloff
-	return saturate(cosToLight - LightCosHalfAngle) / (1.0 - LightCosHalfAngle);
+	return saturate(cosToLight - cosHalfAngle) / (1.0 - cosHalfAngle);
+}
+
+float ComputeSpotFalloff(float cosToLight)
+{
+	return ComputeSpotFalloff(cosToLight, SpotLights[LightIndex].CosHalfAngle);
 }
 
 float ComputeSpotFalloff(vec3 toLight)
 {
-	return ComputeSpotFalloff(dot(-toLight, LightDirection));
+	return ComputeSpotFalloff(dot(-toLight, SpotLights[LightIndex].Direction));
+}
+
+// Maps a texcoord of the given light's RSM/shadow map to the atlas.
+vec2 GetRSMAtlasTexcoord(vec2 rsmTexcoord, uint lightIndex)
+{
+	return SpotLights[lightIndex].RSMAtlasOffset + rsmTexcoord * SpotLights[lightIndex].RSMAtlasScale;
+}
+
+// Maps a texcoord of the current light's RSM/shadow map to the atlas.
+vec2 GetRSMAtlasTexcoord(vec2 rsmTexcoord)
+{
+	return GetRSMAtlasTexcoord(rsmTexcoord, LightIndex);
+}
+
+// Smooth window that reaches zero at the light's range, see "Real Shading in Unreal Engine 4" (Karis 2013)
+// Only used where lights are bounded by their range (light volumes and clustered shading).
+float ComputeRangeFalloff(float lightDistanceSq, float range)
+{
+	float distanceRatioSq = lightDistanceSq / (range * range);
+	float window = saturate(1.0 - distanceRatioSq * distanceRatioSq);
+	return window * window;
+}
+
+float ComputeRangeFalloff(float lightDistanceSq)
+{
+	return ComputeRangeFalloff(lightDistanceSq, SpotLights[LightIndex].Range);
 }
 
 
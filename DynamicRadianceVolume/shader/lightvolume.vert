@@ -0,0 +1,41 @@
+#version 450 core
+
+#include "utils.glsl"
+#include "globalubos.glsl"
+
+// Cone around the current spot light that contains every point within the light's range and the spot angle.
+// Generated from gl_VertexID, draw LIGHT_VOLUME_NUM_SEGMENTS * 6 vertices without any vertex buffer.
+// Triangles 0 to LIGHT_VOLUME_NUM_SEGMENTS-1 are the cone's side, the rest is its base.
+
+#define LIGHT_VOLUME_NUM_SEGMENTS 16
+
+void main()
+{
+	int triangle = gl_VertexID / 3;
+	int corner = gl_VertexID % 3;
+	bool base = triangle >= LIGHT_VOLUME_NUM_SEGMENTS;
+
+	// Local cone space: apex at origin, base circle with radius 1 at z=1.
+	vec3 localPosition;
+	if(corner == 0)
+		localPosition = base ? vec3(0.0, 0.0, 1.0) : vec3(0.0);
+	else
+	{
+		// Side triangles are apex, i+1, i, base triangles are center, i, i+1. Both outward facing.
+		int segment = triangle % LIGHT_VOLUME_NUM_SEGMENTS + ((corner == 1) != base ? 1 : 0);
+		float angle = segment * (PI_2 / LIGHT_VOLUME_NUM_SEGMENTS);
+		localPosition = vec3(cos(angle), sin(angle), 1.0);
+	}
+
+	// Points within range are at most the light's range away along the axis.
+	// The base polygon needs to circumscribe the cone's circle.
+	float sinHalfAngle = sqrt(1.0 - SpotLights[LightIndex].CosHalfAngle * SpotLights[LightIndex].CosHalfAngle);
+	float baseRadius = SpotLights[LightIndex].Range * sinHalfAngle / SpotLights[LightIndex].CosHalfAngle / cos(PI / LIGHT_VOLUME_NUM_SEGMENTS);
+
+	vec3 zAxis = SpotLights[LightIndex].Direction;
+	vec3 xAxis = normalize(cross(abs(zAxis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), zAxis));
+	vec3 yAxis = cross(zAxis, xAxis);
+	vec3 worldPosition = SpotLights[LightIndex].Position + zAxis * (localPosition.z * SpotLights[LightIndex].Range) + (xAxis * localPosition.x + yAxis * localPosition.y) * baseRadius;
+
+	gl_Position = vec4(worldPosition, 1.0) * ViewProjection;
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+// Light views for rendering the RSMs of several lights in a single pass. See MultiViewRSM.
+// Each view renders to its own viewport (= atlas region), its index is stored in the upper bits of the instance indices (see instancedata.glsl).
+
+struct RSMView
+{
+	mat4 ViewProjection;
+	vec3 Position;
+	float CosHalfAngle;
+	vec3 Direction;
+	float _padding0;
+	vec3 Intensity;
+	float RenderResolution;
+};
+
+layout(std430, binding = 15) restrict readonly buffer RSMViewBuffer
+{
+	RSMView RSMViews[];
+};
+
+// Needs to match MultiViewRSM::s_maxNumViews
+#define RSM_MAX_NUM_VIEWS 16
+#define RSM_VIEW_INDEX_SHIFT 28
\ No newline at end of file
@@ -0,0 +1,29 @@
+// LSD radix sort of 32bit keys, one pass per digit. Needs to match SortedCacheAllocation.
+// Every workgroup sorts a block of RADIX_BLOCK_SIZE consecutive keys, thread i handles the keys [i * RADIX_KEYS_PER_THREAD, (i + 1) * RADIX_KEYS_PER_THREAD) of its block.
+
+#define RADIX_BITS 4
+#define RADIX_NUM_DIGITS 16
+#define RADIX_THREADS 256
+#define RADIX_KEYS_PER_THREAD 4
+#define RADIX_BLOCK_SIZE (RADIX_THREADS * RADIX_KEYS_PER_THREAD)
+
+layout(std430, binding = 0) restrict readonly buffer InputKeyBuffer
+{
+	uint InputKeys[];
+};
+
+// Number of keys per digit and block, digit major. After an exclusive prefix sum the output offset of each digit in each block.
+layout(std430, binding = 2) restrict buffer BlockDigitOffsetBuffer
+{
+	uint BlockDigitOffsets[];
+};
+
+layout(location = 0) uniform uint NumKeys;
+layout(location = 1) uniform uint DigitShift;
+
+uint GetDigit(uint key)
+{
+	return (key >> DigitShift) & (RADIX_NUM_DIGITS - 1);
+}
+
+layout (local_size_x = RADIX_THREADS, local_size_y = 1, local_size_z = 1) in;
\ No newline at end of file
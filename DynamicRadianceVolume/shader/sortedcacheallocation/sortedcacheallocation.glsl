@@ -0,0 +1,51 @@
+// Cell keys of the sorted cache allocation. Needs to match SortedCacheAllocation.
+// Expects globalubos.glsl to be included before.
+
+#define INVALID_CELL_KEY 0xFFFFFFFF
+
+// Workgroups of the key emission cover TILE_SIZE x TILE_SIZE pixels.
+// Each tile emits the 8 corner cells of at most MAX_NUM_CELLS_PER_TILE distinct cells, so that every thread writes exactly one key.
+// Further cells of a tile are appended to an overflow list behind the keys of all tiles, see emitcellkeys.comp
+#define TILE_SIZE 16
+#define MAX_NUM_CELLS_PER_TILE (TILE_SIZE * TILE_SIZE / 8)
+
+#ifdef LIGHTCACHE_HASHMAP
+// Same as ComputeLightCacheHashMapKey - 1. Cells may lie up to one cell outside of their cascade.
+uint EncodeCellKey(ivec3 cell, int addressVolumeCascade)
+{
+	uint stride = uint(AddressVolumeResolution + 1);
+	return uint(cell.x) + (uint(cell.y) + (uint(cell.z) + uint(addressVolumeCascade) * stride) * stride) * stride;
+}
+
+void DecodeCellKey(uint key, out ivec3 cell, out int addressVolumeCascade)
+{
+	uint stride = uint(AddressVolumeResolution + 1);
+	cell.x = int(key % stride);
+	key /= stride;
+	cell.y = int(key % stride);
+	key /= stride;
+	cell.z = int(key % stride);
+	addressVolumeCascade = int(key / stride);
+}
+#else
+// Texel index in the address volume atlas.
+// Like in cacheGather.comp, cells beyond the x border of a cascade continue in the next one. Cells outside of the atlas are invalid.
+uint EncodeCellKey(ivec3 cell, int addressVolumeCascade)
+{
+	cell.x += addressVolumeCascade * AddressVolumeResolution;
+	if(any(lessThan(cell, ivec3(0))) || cell.x >= AddressVolumeResolution * NumAddressVolumeCascades || cell.y >= AddressVolumeResolution || cell.z >= AddressVolumeResolution)
+		return INVALID_CELL_KEY;
+	return uint(cell.x + (cell.y + cell.z * AddressVolumeResolution) * AddressVolumeResolution * NumAddressVolumeCascades);
+}
+
+void DecodeCellKey(uint key, out ivec3 cell, out int addressVolumeCascade)
+{
+	uint atlasWidth = uint(AddressVolumeResolution * NumAddressVolumeCascades);
+	uint atlasX = key % atlasWidth;
+	key /= atlasWidth;
+	cell.x = int(atlasX) % AddressVolumeResolution;
+	cell.y = int(key) % AddressVolumeResolution;
+	cell.z = int(key) / AddressVolumeResolution;
+	addressVolumeCascade = int(atlasX) / AddressVolumeResolution;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+// Per-light tree of virtual area lights (lightcuts style), built by cacheBuildVALTree.comp and traversed by cacheLightingRSM.comp with VAL_TREE.
+// VALs are in Morton order (see virtualarealights.glsl), so every four consecutive VALs form the leaves of a node - the tree follows the RSM mip chain.
+// Nodes are stored top-down from the root at depth 0, depth m starts at (4^m - 1) / 3. The VALs themselves are depth log2(RSMReadResolution).
+// Expects utils.glsl to be included before.
+
+#ifndef VAL_TREE_BUFFER_MODIFIER
+	#define VAL_TREE_BUFFER_MODIFIER restrict readonly
+#endif
+
+struct VALTreeNode
+{
+	vec3 BoundsMin;
+	float ConeCosHalfAngle;	// Normal cone around the cone axis.
+	vec3 BoundsMax;
+	float DiscArea;			// Summed disc area of all VALs.
+	vec3 Position;			// Flux weighted center, the node's representative light.
+	uint PackedConeAxis;	// 16 bit signed ints, see PackNormal16I.
+	vec3 Flux;				// Summed flux.
+	float _padding;
+};
+
+layout(std430, binding = 22) VAL_TREE_BUFFER_MODIFIER buffer VALTreeBuffer
+{
+	VALTreeNode VALTreeNodes[];
+};
+
+// Index of a node relative to the light's ValTreeOffset.
+uint GetVALTreeNodeIndex(int depth, uint indexInDepth)
+{
+	return ((1u << (2 * depth)) - 1) / 3 + indexInDepth;
+}
+
+uint PackVALTreeConeAxis(vec3 axis)
+{
+	ivec2 packedAxis = PackNormal16I(axis);
+	return (uint(packedAxis.x) & 0xFFFF) | (uint(packedAxis.y) << 16);
+}
+
+vec3 UnpackVALTreeConeAxis(uint packedAxis)
+{
+	return UnpackNormal16I(vec2(bitfieldExtract(int(packedAxis), 0, 16), bitfieldExtract(int(packedAxis), 16, 16)));
+}
+
+// Whether the node's representative light is accurate enough for the given receiver position.
+// Bounds the relative size of the node as seen from the receiver and the spread of its normals by errorBound.
+bool IsVALTreeNodeAccurate(VALTreeNode node, vec3 receiverPosition, float errorBound)
+{
+	vec3 toBox = max(node.BoundsMin - receiverPosition, vec3(0.0)) + max(receiverPosition - node.BoundsMax, vec3(0.0));
+	float minDistanceSq = dot(toBox, toBox);
+	vec3 extent = node.BoundsMax - node.BoundsMin;
+	float sinConeHalfAngle = sqrt(saturate(1.0 - node.ConeCosHalfAngle * node.ConeCosHalfAngle));
+
+	return dot(extent, extent) <= errorBound * errorBound * minDistanceSq &&
+		(node.ConeCosHalfAngle >= 0.0 && sinConeHalfAngle <= errorBound);
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+// Virtual area lights (VALs) of all lights, written once per frame by cachePrepareVALs.comp and streamed by cacheLightingRSM.comp.
+// Every light with indirect lighting has RSMReadResolution² VALs starting at its ValOffset, in Morton order of their RSM texels (see Morton_2D_Decode_16bit).
+// Expects utils.glsl to be included before.
+
+#ifndef VAL_BUFFER_MODIFIER
+	#define VAL_BUFFER_MODIFIER restrict readonly
+#endif
+
+struct VirtualAreaLight
+{
+	vec3 Position;
+	float DiscArea;		// Estimated area of the VAL, see ValAreaFactor.
+	uvec2 PackedFlux;	// Half floats. Flux / PI, already scaled by the light's IndirectScale.
+	uint PackedNormal;	// 16 bit signed ints as stored in the RSM, see PackNormal16I.
+	uint _padding;
+};
+
+layout(std430, binding = 21) VAL_BUFFER_MODIFIER buffer VirtualAreaLightBuffer
+{
+	VirtualAreaLight VirtualAreaLights[];
+};
+
+// Morton helper - http://and-what-happened.blogspot.de/2011/08/fast-2d-and-3d-hilbert-curves-and.html
+// unpack 2 16-bit indices from a 32-bit Morton code
+uvec2 Morton_2D_Decode_16bit(in uint morton)
+{
+	uvec2 coord;
+	coord.x = morton;
+	coord.y = ( coord.x >> 1 );
+	coord &= 0x55555555;
+	coord |= ( coord >> 1 );
+	coord &= 0x33333333;
+	coord |= ( coord >> 2 );
+	coord &= 0x0f0f0f0f;
+	coord |= ( coord >> 4 );
+	coord &= 0x00ff00ff;
+	coord |= ( coord >> 8 );
+	coord &= 0x0000ffff;
+	
+	return coord;
+}
+
+VirtualAreaLight PackVirtualAreaLight(vec3 position, float discArea, vec3 flux, ivec2 packedNormal)
+{
+	VirtualAreaLight val;
+	val.Position = position;
+	val.DiscArea = discArea;
+	val.PackedFlux = uvec2(packHalf2x16(flux.rg), packHalf2x16(vec2(flux.b, 0.0)));
+	val.PackedNormal = (uint(packedNormal.x) & 0xFFFF) | (uint(packedNormal.y) << 16);
+	val._padding = 0;
+	return val;
+}
+
+vec3 UnpackVALFlux(VirtualAreaLight val)
+{
+	return vec3(unpackHalf2x16(val.PackedFlux.x), unpackHalf2x16(val.PackedFlux.y).x);
+}
+
+vec3 UnpackVALNormal(VirtualAreaLight val)
+{
+	return UnpackNormal16I(vec2(bitfieldExtract(int(val.PackedNormal), 0, 16), bitfieldExtract(int(val.PackedNormal), 16, 16)));
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#version 450 core
+
+// Options:
+//#define ALPHATESTING <DesiredAlphaThreshhold>
+
+#include "visibilitybuffer.glsl"
+
+layout(location = 1) uniform uint TriangleBits;
+
+flat in uint DrawID;
+#ifdef ALPHATESTING
+in vec2 Texcoord;
+
+layout(binding = 0) uniform sampler2D BaseColorTexture;
+#endif
+
+layout(location = 0) out uint OutVisibility;
+
+void main()
+{
+#ifdef ALPHATESTING
+	if(texture(BaseColorTexture, Texcoord).a < 0.1)
+		discard;
+#endif
+
+	OutVisibility = PackVisibility(DrawID, uint(gl_PrimitiveID), TriangleBits);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#version 450 core
+#extension GL_ARB_shader_draw_parameters : require
+
+// Options:
+//#define ALPHATESTING <DesiredAlphaThreshhold>
+// Without alpha testing, only the position stream needs to be bound (see Model::BindPositionOnlyVAO)
+
+#include "../globalubos.glsl"
+#include "../meshdeform.glsl"
+#include "../instancedata.glsl"
+#include "../deformedvertices.glsl"
+
+// Draw id of the first instance of this draw call.
+layout(location = 0) uniform uint DrawBase;
+
+// Vertex input.
+layout(location = 0) in vec3 inPosition;
+#ifdef ALPHATESTING
+layout(location = 4) in vec2 inTexcoord;
+
+out vec2 Texcoord;
+#endif
+
+flat out uint DrawID;
+
+// Resolve reconstructs positions the same way.
+invariant gl_Position;
+
+void main(void)
+{
+	gl_Position = vec4(GetDeformedWorldPosition(inPosition), 1.0) * ViewProjection;
+
+	DrawID = DrawBase + uint(gl_InstanceID);
+#ifdef ALPHATESTING
+	Texcoord = inTexcoord;
+#endif
+}
\ No newline at end of file
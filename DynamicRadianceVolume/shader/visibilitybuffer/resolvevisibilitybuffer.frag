@@ -0,0 +1,141 @@
+#version 450 core
+#extension GL_ARB_bindless_texture : require
+
+#define INSTANCEDATA_BUFFERS_ONLY
+
+#include "../globalubos.glsl"
+#include "../meshdeform.glsl"
+#include "../instancedata.glsl"
+#include "../deformedvertices.glsl"
+#include "../utils.glsl"
+#include "visibilitybuffer.glsl"
+
+layout(location = 0) uniform uint TriangleBits;
+
+layout(binding = 0) uniform usampler2D VisibilityBuffer;
+
+layout(std430, binding = 7) restrict readonly buffer VisibilityDrawBuffer
+{
+	VisibilityDraw VisibilityDraws[];
+};
+// Model::Vertex as plain floats: position (3), normal (3), tangent (4), texcoord (2)
+#define VERTEX_NUM_FLOATS 12
+layout(std430, binding = 8) restrict readonly buffer SceneVertexBuffer
+{
+	float SceneVertices[];
+};
+layout(std430, binding = 9) restrict readonly buffer SceneIndexBuffer
+{
+	uint SceneIndices[];
+};
+
+// Same targets as fillgbuffer.frag
+layout(location = 0) out vec3 OutBaseColor;
+layout(location = 1) out ivec2 OutPackedNormal;
+layout(location = 2) out vec2 OutRoughnessMetallic;
+
+vec3 LoadVec3(uint vertex, uint offset)
+{
+	uint address = vertex * VERTEX_NUM_FLOATS + offset;
+	return vec3(SceneVertices[address], SceneVertices[address + 1], SceneVertices[address + 2]);
+}
+
+// Perspective correct barycentric coordinates and their screen space derivatives of a triangle given in clip space.
+// See Schied and Dachsbacher 2015, "Deferred Attribute Interpolation for Memory-Efficient Deferred Shading".
+void ComputeBarycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 pixelNdc, out vec3 barycentrics, out vec3 barycentricsDx, out vec3 barycentricsDy)
+{
+	vec3 invW = 1.0 / vec3(clip0.w, clip1.w, clip2.w);
+	vec2 ndc0 = clip0.xy * invW.x;
+	vec2 ndc1 = clip1.xy * invW.y;
+	vec2 ndc2 = clip2.xy * invW.z;
+
+	// Derivatives of the screen space (not perspective correct) barycentrics, scaled by 1/w.
+	float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+	vec3 ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+	vec3 ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+	float ddxSum = ddx.x + ddx.y + ddx.z;
+	float ddySum = ddy.x + ddy.y + ddy.z;
+
+	vec2 delta = pixelNdc - ndc0;
+	float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+	barycentrics = (vec3(invW.x, 0.0, 0.0) + delta.x * ddx + delta.y * ddy) / interpInvW;
+
+	// From ndc to pixel steps.
+	vec2 pixelSize = 2.0 / vec2(BackbufferResolution);
+	ddx *= pixelSize.x;
+	ddy *= pixelSize.y;
+	ddxSum *= pixelSize.x;
+	ddySum *= pixelSize.y;
+
+	barycentricsDx = (barycentrics * interpInvW + ddx) / (interpInvW + ddxSum) - barycentrics;
+	barycentricsDy = (barycentrics * interpInvW + ddy) / (interpInvW + ddySum) - barycentrics;
+}
+
+void main()
+{
+	uint visibility = texelFetch(VisibilityBuffer, ivec2(gl_FragCoord.xy), 0).r;
+	if(visibility == VISIBILITY_EMPTY)
+		discard;
+
+	uint drawID, triangleID;
+	UnpackVisibility(visibility, TriangleBits, drawID, triangleID);
+	VisibilityDraw draw = VisibilityDraws[drawID];
+	mat4 World = InstanceWorldMatrices[draw.EntityIndex];
+
+	uint vertices[3];
+	vec3 worldNormals[3];
+	vec4 clipPositions[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		uint modelVertex = SceneIndices[draw.FirstIndex + triangleID * 3 + i];
+		vertices[i] = draw.BaseVertex + modelVertex;
+	#ifdef PRETRANSFORMED_VERTICES
+		DeformedVertex deformedVertex = LoadDeformedVertex(draw.EntityIndex, modelVertex);
+		vec3 worldPosition = deformedVertex.Position;
+		worldNormals[i] = deformedVertex.Normal;
+	#else
+		vec3 undeformedWorldPosition = (vec4(LoadVec3(vertices[i], 0), 1.0) * World).xyz;
+		vec3 worldPosition = WorldPosDeform(undeformedWorldPosition);
+		worldNormals[i] = NormalDeform((vec4(LoadVec3(vertices[i], 3), 0.0) * World).xyz, undeformedWorldPosition);
+	#endif
+		clipPositions[i] = vec4(worldPosition, 1.0) * ViewProjection;
+	}
+
+	vec2 pixelNdc = gl_FragCoord.xy / vec2(BackbufferResolution) * 2.0 - 1.0;
+	vec3 barycentrics, barycentricsDx, barycentricsDy;
+	ComputeBarycentrics(clipPositions[0], clipPositions[1], clipPositions[2], pixelNdc, barycentrics, barycentricsDx, barycentricsDy);
+
+	// Interpolate attributes the same way defaultmodel.vert and the rasterizer do.
+	vec3 normal = vec3(0.0);
+	vec3 tangent = vec3(0.0);
+	float bitangentHandedness = 0.0;
+	vec2 texcoord = vec2(0.0);
+	vec2 texcoordDx = vec2(0.0);
+	vec2 texcoordDy = vec2(0.0);
+	for(int i = 0; i < 3; ++i)
+	{
+		uint address = vertices[i] * VERTEX_NUM_FLOATS;
+		vec2 vertexTexcoord = vec2(SceneVertices[address + 10], SceneVertices[address + 11]);
+
+		normal += worldNormals[i] * barycentrics[i];
+		tangent += (vec4(LoadVec3(vertices[i], 6), 0.0) * World).xyz * barycentrics[i];
+		bitangentHandedness += SceneVertices[address + 9] * barycentrics[i];
+		texcoord += vertexTexcoord * barycentrics[i];
+		texcoordDx += vertexTexcoord * barycentricsDx[i];
+		texcoordDy += vertexTexcoord * barycentricsDy[i];
+	}
+
+	// Material, see fillgbuffer.frag
+	OutBaseColor = textureGrad(sampler2D(draw.DiffuseHandle), texcoord, texcoordDx, texcoordDy).rgb;
+
+	vec3 normalMapNormal = textureGrad(sampler2D(draw.NormalmapHandle), texcoord, texcoordDx, texcoordDy).xyz;
+	normalMapNormal.xy = normalMapNormal.xy * 2.0 - 1.0;
+	normalMapNormal = normalize(normalMapNormal);
+	vec3 vnormal = normalize(normal);
+	vec3 vtangent = normalize(tangent);
+	vec3 vbitangent = cross(vtangent, vnormal) * bitangentHandedness;
+	vec3 finalNormal = mat3(vtangent, vbitangent, vnormal) * normalMapNormal;
+	OutPackedNormal = PackNormal16I(normalize(finalNormal));
+
+	OutRoughnessMetallic = textureGrad(sampler2D(draw.RoughnessMetallicHandle), texcoord, texcoordDx, texcoordDy).rg;
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+// Visibility buffer values store a draw id in the upper and a triangle id in the lower bits.
+// The number of triangle bits depends on the largest mesh in the scene. All bits set marks empty pixels.
+
+#define VISIBILITY_EMPTY 0xFFFFFFFFu
+
+uint PackVisibility(uint drawID, uint triangleID, uint triangleBits)
+{
+	return (drawID << triangleBits) | triangleID;
+}
+
+void UnpackVisibility(uint visibility, uint triangleBits, out uint drawID, out uint triangleID)
+{
+	drawID = visibility >> triangleBits;
+	triangleID = visibility & ((1u << triangleBits) - 1u);
+}
+
+// Per instance and mesh. See VisibilityBuffer::DrawInfo
+struct VisibilityDraw
+{
+	uint EntityIndex;
+	uint BaseVertex;
+	uint FirstIndex;
+	uint _padding0;
+
+	// Bindless texture handles (GL_ARB_bindless_texture).
+	uvec2 DiffuseHandle;
+	uvec2 NormalmapHandle;
+	uvec2 RoughnessMetallicHandle;
+	uvec2 _padding1;
+};
\ No newline at end of file
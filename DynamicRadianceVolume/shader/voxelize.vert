@@ -1,7 +1,10 @@
 	#version 450 core
+#extension GL_ARB_shader_draw_parameters : require
 
 #include "globalubos.glsl"
 #include "meshdeform.glsl"
+#include "instancedata.glsl"
+#include "deformedvertices.glsl"
 
 // Vertex input.
 layout(location = 0) in vec3 inPosition;
@@ -14,10 +17,10 @@ layout(location = 1) out vec2 vs_out_Texcoord;
 
 void main(void)
 {
-	vs_out_Normal = (vec4(inNormal, 0.0) * World).xyz;
+	vec3 worldPosition;
+	GetDeformedWorldVertex(inPosition, inNormal, worldPosition, vs_out_Normal);
 	vs_out_Texcoord = inTexcoord;
 
-	vec3 worldPosition = WorldPosDeform((vec4(inPosition, 1.0) * World).xyz);
 	gl_Position = vec4((worldPosition - VolumeWorldMin) /
 	                (VolumeWorldMax - VolumeWorldMin) * 2.0 - vec3(1.0), 1.0);
 }
\ No newline at end of file
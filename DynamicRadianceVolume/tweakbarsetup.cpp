@@ -117,6 +117,8 @@ void Application::ChangeLightCount(unsigned int lightCount)
 
 		m_mainTweakBar->AddReadWrite<float>(namePrefix + "SpotAngle", [=](){ return m_scene->GetLights()[i].halfAngle / (ei::PI / 180.0f); },
 			[=](float f){ m_scene->GetLights()[i].halfAngle = f  * (ei::PI / 180.0f); }, groupSetting + " label=\"Half Spot Angle\" min=1.0 max=89 step=1.0");
+		m_mainTweakBar->AddReadWrite<float>(namePrefix + "Range", [=](){ return m_scene->GetLights()[i].range; },
+			[=](float f){ m_scene->GetLights()[i].range = f; }, groupSetting + " label=\"Range\" min=0.1 step=0.5");
 
 		m_mainTweakBar->AddSeperator(namePrefix + "shadowseparator", groupSetting);
 
@@ -173,6 +175,32 @@ void Application::SetupMainTweakBarBinding()
 		m_mainTweakBar->AddEnum("Render Mode", "RenderModeType", [&](){ return static_cast<int>(m_renderer->GetMode()); }, [&](int mode){ return m_renderer->SetMode(static_cast<Renderer::Mode>(mode)); });
 		m_mainTweakBar->AddReadWrite<bool>("IndirectShadow", [&](){ return m_renderer->GetIndirectShadow(); }, [&](bool b){ return m_renderer->SetIndirectShadow(b); }, " label=\"Indirect Shadow\"");
 		m_mainTweakBar->AddReadWrite<bool>("IndirectSpecular", [&](){ return m_renderer->GetIndirectSpecular(); }, [&](bool b){ return m_renderer->SetIndirectSpecular(b); }, " label=\"Indirect Specular\"");
+		m_mainTweakBar->AddReadWrite<bool>("OcclusionCulling", [&](){ return m_renderer->GetOcclusionCulling(); }, [&](bool b){ return m_renderer->SetOcclusionCulling(b); }, " label=\"Occlusion Culling\"");
+		m_mainTweakBar->AddReadOnly("#Occlusion Culled", [&](){ return std::to_string(m_renderer->GetOcclusionCulledCount()); });
+		m_mainTweakBar->AddReadWrite<bool>("DepthPrepass", [&](){ return m_renderer->GetDepthPrepass(); }, [&](bool b){ return m_renderer->SetDepthPrepass(b); }, " label=\"Depth Prepass\"");
+		m_mainTweakBar->AddReadWrite<bool>("VisibilityBuffer", [&](){ return m_renderer->GetVisibilityBuffer(); }, [&](bool b){ return m_renderer->SetVisibilityBuffer(b); }, " label=\"Visibility Buffer\"");
+		m_mainTweakBar->AddReadWrite<bool>("PretransformedVertices", [&](){ return m_renderer->GetPretransformedVertices(); }, [&](bool b){ return m_renderer->SetPretransformedVertices(b); }, " label=\"Deform Prepass\"");
+		m_mainTweakBar->AddReadWrite<bool>("ClusteredShading", [&](){ return m_renderer->GetClusteredShading(); }, [&](bool b){ return m_renderer->SetClusteredShading(b); }, " label=\"Clustered Shading\"");
+		m_mainTweakBar->AddReadWrite<bool>("LightVolumes", [&](){ return m_renderer->GetLightVolumes(); }, [&](bool b){ return m_renderer->SetLightVolumes(b); }, " label=\"Light Volumes\"");
+		m_mainTweakBar->AddReadWrite<bool>("RSMCaching", [&](){ return m_renderer->GetRSMCaching(); }, [&](bool b){ return m_renderer->SetRSMCaching(b); }, " label=\"RSM Caching\"");
+		m_mainTweakBar->AddReadWrite<bool>("TimeDependentMeshDeformation", [&](){ return m_renderer->GetTimeDependentMeshDeformation(); }, [&](bool b){ return m_renderer->SetTimeDependentMeshDeformation(b); }, " label=\"Animated Deformation\" help=\"Set if meshdeform.glsl depends on time. RSMs are not reused then.\"");
+		m_mainTweakBar->AddReadOnly("#RSM Skipped", [&](){ return std::to_string(m_renderer->GetNumSkippedRSMs()); });
+		m_mainTweakBar->AddReadWrite<bool>("MultiViewRSM", [&](){ return m_renderer->GetMultiViewRSM(); }, [&](bool b){ return m_renderer->SetMultiViewRSM(b); }, " label=\"Multi View RSM\"");
+		m_mainTweakBar->AddReadWrite<bool>("RSMComputeDownsample", [&](){ return m_renderer->GetRSMComputeDownsample(); }, [&](bool b){ return m_renderer->SetRSMComputeDownsample(b); }, " label=\"RSM Compute Downsample\"");
+		m_mainTweakBar->AddReadWrite<bool>("AdaptiveRSMResolution", [&](){ return m_renderer->GetAdaptiveRSMResolution(); }, [&](bool b){ return m_renderer->SetAdaptiveRSMResolution(b); }, " label=\"Adaptive RSM Resolution\"");
+		m_mainTweakBar->AddReadWrite<float>("IndirectLightImportanceThreshold", [&](){ return m_renderer->GetIndirectLightImportanceThreshold(); }, [&](float f){ return m_renderer->SetIndirectLightImportanceThreshold(f); }, " label=\"Indirect Light Importance Threshold\" min=0.0 max=1.0 step=0.01");
+		m_mainTweakBar->AddReadWrite<bool>("BatchedLightCaches", [&](){ return m_renderer->GetBatchedLightCaches(); }, [&](bool b){ return m_renderer->SetBatchedLightCaches(b); }, " label=\"Batched Light Caches\"");
+		m_mainTweakBar->AddReadWrite<bool>("VALTree", [&](){ return m_renderer->GetVALTree(); }, [&](bool b){ return m_renderer->SetVALTree(b); }, " label=\"VAL Tree\" help=\"Needs indirect shadow and indirect specular to be off.\"");
+		m_mainTweakBar->AddReadOnly("VAL Tree Status", [&](){ return std::string(m_renderer->IsVALTreeActive() ? "active" : (m_renderer->GetVALTree() ? "off (indirect shadow/specular)" : "off")); });
+		m_mainTweakBar->AddReadWrite<float>("VALTreeErrorBound", [&](){ return m_renderer->GetVALTreeErrorBound(); }, [&](float f){ return m_renderer->SetVALTreeErrorBound(f); }, " label=\"VAL Tree Error Bound\" min=0.0 max=1.0 step=0.01");
+		m_mainTweakBar->AddReadWrite<bool>("VALTreeComparison", [&](){ return m_renderer->GetVALTreeComparison(); }, [&](bool b){ return m_renderer->SetVALTreeComparison(b); }, " label=\"VAL Tree Comparison\" help=\"Evaluates all VALs in addition to the VAL tree and reports the irradiance difference.\"");
+		m_mainTweakBar->AddReadOnly("VAL Tree Mean Error", [&](){ return std::to_string(m_renderer->GetLastVALTreeMeanError()); });
+		m_mainTweakBar->AddReadOnly("VAL Tree Max Error", [&](){ return std::to_string(m_renderer->GetLastVALTreeMaxError()); });
+		m_mainTweakBar->AddReadWrite<bool>("SampledVALs", [&](){ return m_renderer->GetSampledVALs(); }, [&](bool b){ return m_renderer->SetSampledVALs(b); }, " label=\"Sampled VALs\" help=\"Needs indirect shadow and indirect specular to be off.\"");
+		m_mainTweakBar->AddReadWrite<int>("VALSampleBudget", [&](){ return static_cast<int>(m_renderer->GetVALSampleBudget()); }, [&](int i){ return m_renderer->SetVALSampleBudget(static_cast<unsigned int>(i)); }, " label=\"VAL Sample Budget\" min=1 max=1024 step=8");
+		m_mainTweakBar->AddReadWrite<float>("VALSampleBlendFactor", [&](){ return m_renderer->GetVALSampleBlendFactor(); }, [&](float f){ return m_renderer->SetVALSampleBlendFactor(f); }, " label=\"VAL Sample Blend\" min=0.01 max=1.0 step=0.01");
+		m_mainTweakBar->AddReadWrite<bool>("PersistentLightCaches", [&](){ return m_renderer->GetPersistentLightCaches(); }, [&](bool b){ return m_renderer->SetPersistentLightCaches(b); }, " label=\"Persistent Light Caches\"");
+		m_mainTweakBar->AddReadWrite<float>("LightCacheRelightFraction", [&](){ return m_renderer->GetLightCacheRelightFraction(); }, [&](float f){ return m_renderer->SetLightCacheRelightFraction(f); }, " label=\"Light Cache Relight Fraction\" min=0.0 max=1.0 step=0.01");
 
 		std::vector<TwEnumVal> indirectDiffuseModeVals =
 		{
@@ -195,6 +223,11 @@ void Application::SetupMainTweakBarBinding()
 		std::string groupSetting = " group=AddressVolume";
 		m_mainTweakBar->AddReadWrite<float>("Transition Size", [&](){ return m_renderer->GetCAVCascadeTransitionSize(); }, [&](float f){ return m_renderer->SetCAVCascadeTransitionSize(f); }, groupSetting + " min=0.0 max=10.0 step=0.1");
 		m_mainTweakBar->AddReadWrite<bool>("Display Cascades", [&](){ return m_renderer->GetShowCAVCascades(); }, [&](bool b){ return m_renderer->SetShowCAVCascades(b); }, groupSetting);
+		m_mainTweakBar->AddReadWrite<bool>("Hash Map", [&](){ return m_renderer->GetLightCacheHashMap(); }, [&](bool b){ return m_renderer->SetLightCacheHashMap(b); }, groupSetting);
+		m_mainTweakBar->AddReadWrite<bool>("Validate Hash Map", [&](){ return m_renderer->GetValidateLightCacheHashMap(); }, [&](bool b){ return m_renderer->SetValidateLightCacheHashMap(b); }, groupSetting);
+		m_mainTweakBar->AddButton("Test Hash Map", [&](){ m_renderer->TestLightCacheHashMap(); }, groupSetting);
+		m_mainTweakBar->AddReadWrite<bool>("Sorted Allocation", [&](){ return m_renderer->GetSortedCacheAllocation(); }, [&](bool b){ return m_renderer->SetSortedCacheAllocation(b); }, groupSetting);
+		m_mainTweakBar->AddReadWrite<bool>("Packed Caches", [&](){ return m_renderer->GetPackedLightCaches(); }, [&](bool b){ return m_renderer->SetPackedLightCaches(b); }, groupSetting);
 		m_mainTweakBar->AddReadWrite<int>("Resolution", [&](){ return m_renderer->GetCAVResolution(); },
 			[&](int i){ return m_renderer->SetCAVCascades(m_renderer->GetCAVCascadeCount(), i); }, " min=16 max=256 step=16" + groupSetting);
 		m_mainTweakBar->AddReadWrite<int>("#Cascades", [&](){ return m_renderer->GetCAVCascadeCount(); },
@@ -260,7 +293,7 @@ void Application::SetupMainTweakBarBinding()
 	// Entity settings
 	{
 		std::function<void(const int&)> changeEntityCount = std::bind(&Application::ChangeEntityCount, this, std::placeholders::_1);
-		m_mainTweakBar->AddReadWrite<int>("Entity Count", [&](){ return static_cast<int>(m_scene->GetEntities().size()); }, changeEntityCount, " min=1 max=16 step=1 group=Entities");
+		m_mainTweakBar->AddReadWrite<int>("Entity Count", [&](){ return static_cast<int>(m_scene->GetEntities().size()); }, changeEntityCount, " min=1 max=8192 step=1 group=Entities");
 	}
 
 	// Light settings
@@ -276,7 +309,7 @@ void Application::SetupMainTweakBarBinding()
 		m_mainTweakBar->AddEnumType("RSMResolution", rsmResVals);
 
 		std::function<void(const int&)> changeLightCount = std::bind(&Application::ChangeLightCount, this, std::placeholders::_1);
-		m_mainTweakBar->AddReadWrite<int>("Light Count", [&](){ return static_cast<int>(m_scene->GetLights().size()); }, changeLightCount, " min=1 max=16 step=1 group=Lights");
+		m_mainTweakBar->AddReadWrite<int>("Light Count", [&](){ return static_cast<int>(m_scene->GetLights().size()); }, changeLightCount, " min=1 max=256 step=1 group=Lights");
 	}
 }
 